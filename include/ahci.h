@@ -3,6 +3,8 @@
 #include <pci.h>
 #include <types.h>
 
+struct disk_seg;
+
 // AHCI register layout definitions based on the AHCI specification, section 3.3.
 struct ahci_port
 {
@@ -50,5 +52,6 @@ void ahci_init(struct pci_device device);
 bool ahci_port_ready(void);
 int ahci_read(u64 lba, u32 sector_count, void *buffer);
 int ahci_write(u64 lba, u32 sector_count, const void *buffer);
+int ahci_rw_sg(u64 lba, const struct disk_seg *segs, u32 nsegs, bool write);
 
 #define AHCI_SECTOR_SIZE 512u
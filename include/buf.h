@@ -9,13 +9,27 @@ struct buf
     int flags;
     u32 dev;
     u32 blockno;
+    u32 size; // bytes in data: the block size of dev
     struct sleeplock lock;
     u32 refcnt;
     struct buf* prev; // LRU cache list
     struct buf* next;
     struct buf* qnext; // disk queue
-    u8 data[BSIZE];
+    u8 *data;
 };
 
 #define B_VALID 0x2  // buffer has been read from disk
-#define B_DIRTY 0x4  // buffer needs to be written to disk
\ No newline at end of file
+#define B_DIRTY 0x4  // buffer needs to be written to disk
+
+// Bytes in a disk sector, the unit of a direct transfer.
+#define DISK_SECTOR_SIZE 512
+
+// One physically contiguous piece of memory in a direct disk transfer.
+struct disk_seg
+{
+    u32 phys;
+    u32 len; // bytes, a multiple of the sector size
+};
+
+// Most segments one direct transfer may use.
+#define DISK_SEG_MAX 32
\ No newline at end of file
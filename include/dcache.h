@@ -0,0 +1,28 @@
+#pragma once
+
+#include "types.h"
+
+// Names longer than this are looked up in the directory every time.
+#define DCACHE_NAME_LEN 31
+
+/**
+ * @brief Cached result of looking up one name in one directory.
+ *
+ * inum is 0 for a negative entry: the name is known not to exist.
+ */
+struct dentry
+{
+    u32 dev;
+    u32 parent; // inode number of the directory
+    u32 inum;
+    u8 name_len;
+    char name[DCACHE_NAME_LEN + 1];
+    struct dentry *hash_next;
+    struct dentry *prev; // LRU list
+    struct dentry *next;
+};
+
+void dcache_init(void);
+bool dcache_lookup(u32 dev, u32 parent, const char *name, u32 *inum);
+void dcache_enter(u32 dev, u32 parent, const char *name, u32 inum);
+void dcache_purge(u32 dev, u32 parent);
@@ -3,14 +3,20 @@
 
 struct buf;
 struct context;
+struct disk_seg;
 struct file;
 struct inode;
+struct inode_operations;
+struct iovec;
 struct pci_device;
 struct pipe;
+struct poll_table;
 struct proc;
 struct rtcdate;
 struct spinlock;
 struct sleeplock;
+struct rwsleeplock;
+struct fdtable;
 struct stat;
 struct superblock;
 
@@ -25,8 +31,11 @@ typedef enum warning_level
 // bio.c
 void buffer_cache_init(void);
 struct buf* bread(u32, u32);
+struct buf* bgetblk(u32, u32);
+void bforget(u32, u32);
 void brelse(struct buf*);
 void bwrite(struct buf*);
+void bio_set_block_size(u32 dev, u32 size);
 
 // console.c
 void console_init(void);
@@ -40,25 +49,50 @@ void boot_message(warning_level_t level, const char* fmt, ...);
 // exec.c
 int exec(char*, char**);
 
+// fdtable.c
+void fdtable_init(struct fdtable*);
+int fdtable_copy(struct fdtable*, struct fdtable*);
+void fdtable_close_all(struct fdtable*);
+struct file* fd_get(int fd);
+int fd_install(struct file*);
+struct file* fd_remove(int fd);
+
 // file.c
 struct file* file_alloc(void);
 void file_close(struct file*);
 struct file* file_dup(struct file*);
 void file_init(void);
 int file_read(struct file*, char*, int n);
+int file_getdents(struct file*, char*, int n);
+int file_pread(struct file*, char*, int n, u32 off);
+int file_poll(struct file*, struct poll_table*);
+int file_pwrite(struct file*, char*, int n, u32 off);
+int file_readv(struct file*, const struct iovec*, int iovcnt);
+int file_writev(struct file*, const struct iovec*, int iovcnt);
+int file_splice(struct file *in, u32 *in_off, struct file *out, u32 *out_off, int n);
 int file_stat(struct file*, struct stat*);
+int file_sync(struct file*);
 int file_write(struct file*, char*, int n);
 
 // fs.c
 struct inode* idup(struct inode*);
 struct inode* iget(u32 dev, u32 inum);
+bool ismountpoint(struct inode*);
+int mount(char*, u32, u32, struct inode_operations*);
 int namecmp(const char*, const char*);
 struct inode* namei(char*);
 struct inode* nameiparent(char*, char*);
 
+// futex.c
+void futex_init(void);
+int futex_wait(u32, u32, int);
+int futex_wake(u32, int);
+
 // ide.c
 void ideintr(void);
 void iderw(struct buf*);
+bool disk_direct_ready(void);
+int disk_rw_direct(u64 lba, const struct disk_seg*, u32 nsegs, bool write);
 void ide_pci_init(struct pci_device device);
 
 // ioapic.c
@@ -69,6 +103,8 @@ void ioapic_int(void);
 // kalloc_page.c
 char* kalloc_page(void);
 void kfree_page(char*);
+u32 kfree_page_count(void);
+u32 kpage_total(void);
 void init_memory_range(void*, void*);
 void kalloc_enable_locking(void);
 
@@ -96,8 +132,12 @@ void disable_pic(void);
 // pipe.c
 int pipe_alloc(struct file**, struct file**);
 void pipe_close(struct pipe*, int);
-int pipe_read(struct pipe*, char*, int);
-int pipe_write(struct pipe*, char*, int);
+int pipe_get_size(struct pipe*);
+void pipe_init(void);
+int pipe_poll(struct pipe*, struct poll_table*);
+int pipe_read(struct pipe*, char*, int, int flags);
+int pipe_set_size(struct pipe*, int size);
+int pipe_write(struct pipe*, char*, int, int flags);
 
 // proc.c
 int cpu_index(void);
@@ -105,6 +145,7 @@ void exit(void);
 int fork(void);
 int resize_proc(int);
 int kill(int);
+struct proc* kernel_proc_create(char*, void (*)(void));
 struct cpu* current_cpu();
 struct proc* current_process();
 void process_table_init(void);
@@ -130,6 +171,13 @@ void acquiresleep(struct sleeplock*);
 void releasesleep(struct sleeplock*);
 int holdingsleep(struct sleeplock*);
 void initsleeplock(struct sleeplock*, char*);
+void acquirerwsleep(struct rwsleeplock*);
+void acquirerwsleep_shared(struct rwsleeplock*);
+int tryacquirerwsleep(struct rwsleeplock*);
+void downgraderwsleep(struct rwsleeplock*);
+void releaserwsleep(struct rwsleeplock*);
+int holdingrwsleep(struct rwsleeplock*);
+void initrwsleeplock(struct rwsleeplock*, char*);
 
 // syscall.c
 int argint(int, int*);
@@ -159,6 +207,7 @@ void segment_descriptors_init(void);
 void kernel_page_directory_init();
 pde_t* setup_kernel_page_directory();
 char* uva2ka(pde_t*, char*);
+char* uva2ka_writable(pde_t*, char*);
 int allocvm(pde_t*, u32, u32, int);
 u32 deallocvm(pde_t*, u32, u32);
 void freevm(pde_t*);
@@ -179,6 +228,7 @@ void unmap_vm_range(pde_t* pgdir, u32 start, u32 end, int free_frames);
 void* kmalloc(u32 nbytes);
 void* kzalloc(u32 nbytes);
 void kfree(void* ap);
+void kmalloc_enable_locking(void);
 void memory_enable_sse(void);
 void memory_enable_avx(void);
 void memory_disable_avx(void);
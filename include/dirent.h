@@ -0,0 +1,35 @@
+#pragma once
+
+#include "types.h"
+
+#define DIRENT_NAME_MAX 255
+
+// d_type values
+#define DT_UNKNOWN 0
+#define DT_FIFO    1
+#define DT_CHR     2
+#define DT_DIR     4
+#define DT_BLK     6
+#define DT_REG     8
+#define DT_LNK     10
+#define DT_SOCK    12
+
+/**
+ * @brief Directory entry as returned by getdents().
+ *
+ * getdents() packs as many records as fit into the caller's buffer. Each
+ * record is d_reclen bytes long, so the next one starts at
+ * (char *)d + d->d_reclen. d_name is NUL terminated.
+ */
+struct dirent
+{
+    u32 d_ino;    // inode number
+    u32 d_off;    // directory offset of the next entry
+    u16 d_reclen; // length of this record
+    u8 d_type;    // DT_* file type, DT_UNKNOWN if the file system does not record it
+    u8 d_namlen;  // length of d_name, not counting the NUL
+    char d_name[];
+};
+
+// Space a record with a name of namlen bytes takes in a getdents() buffer.
+#define DIRENT_RECLEN(namlen) ((sizeof(struct dirent) + (namlen) + 1 + 3) & ~3U)
@@ -8,10 +8,15 @@
 extern struct inode_operations ext2fs_inode_ops;
 extern struct icache icache;
 
-// Block size for ext2
-#define EXT2_BSIZE 1024
+// Block size of the mounted volume, from s_log_block_size
+extern u32 ext2_block_size;
 
-#define EXT2_MAX_INODE_SIZE EXT2_BSIZE
+// Block sizes ext2 supports; a block must fit in a buffer and in a page
+#define EXT2_MIN_BSIZE 1024
+#define EXT2_MAX_BSIZE BSIZE_MAX
+#define EXT2_BSIZE     ext2_block_size
+
+#define EXT2_MAX_INODE_SIZE EXT2_MIN_BSIZE
 
 #define GET_GROUP_NO(inum, ext2_sb) 	((inum - 1) / ext2_sb.s_inodes_per_group)
 #define GET_INODE_INDEX(inum, ext2_sb) 	((inum - 1) % ext2_sb.s_inodes_per_group)
@@ -27,13 +32,32 @@ extern struct icache icache;
 
 // Block sizes
 #define EXT2_INDIRECT                   (EXT2_BSIZE / sizeof(u32))
-#define EXT2_DINDIRECT                  (EXT2_BSIZE / sizeof(u32))*EXT2_INDIRECT
-#define EXT2_TINDIRECT                  (EXT2_BSIZE / sizeof(u32))*EXT2_DINDIRECT
+#define EXT2_DINDIRECT                  (EXT2_INDIRECT * EXT2_INDIRECT)
+#define EXT2_TINDIRECT                  (EXT2_INDIRECT * EXT2_DINDIRECT)
 #define EXT2_MAXFILE                    (EXT2_NDIR_BLOCKS + EXT2_INDIRECT + EXT2_DINDIRECT + EXT2_TINDIRECT)
 
 // for directory entry
 #define EXT2_NAME_LEN 255
 
+// i_flags
+#define EXT2_INDEX_FL 0x00001000 // directory has a hashed index
+
+// s_feature_compat
+#define EXT2_FEATURE_COMPAT_DIR_INDEX 0x0020
+
+// s_flags: how the directory index hashes treat bytes above 0x7f
+#define EXT2_FLAGS_SIGNED_HASH   0x0001
+#define EXT2_FLAGS_UNSIGNED_HASH 0x0002
+
+// Directory index hash versions. The unsigned variants are never stored
+// on disk; they are selected by EXT2_FLAGS_UNSIGNED_HASH.
+#define EXT2_HASH_LEGACY            0
+#define EXT2_HASH_HALF_MD4          1
+#define EXT2_HASH_TEA               2
+#define EXT2_HASH_LEGACY_UNSIGNED   3
+#define EXT2_HASH_HALF_MD4_UNSIGNED 4
+#define EXT2_HASH_TEA_UNSIGNED      5
+
 #define EXT2_FT_UNKNOWN 0
 #define EXT2_FT_REG_FILE 1
 #define EXT2_FT_DIR 2
@@ -43,13 +67,41 @@ extern struct icache icache;
 #define EXT2_FT_SOCK 6
 #define EXT2_FT_SYMLINK 7
 
+// Blocks a regular file looks ahead for its writes, including the one it asked for.
+#define EXT2_PREALLOC_BLOCKS 8
+
+// Blocks a write maps and allocates at a time.
+#define EXT2_WRITE_BATCH 16
+
+// Runs of blocks a truncate collects before it updates the bitmaps.
+#define EXT2_FREE_RUNS 32
+
+// Dirty inodes one writeback pass collects, and how often passes run.
+#define EXT2_SYNC_BATCH      32
+#define EXT2_WRITEBACK_TICKS (5 * TIMER_FREQUENCY_HZ)
+
+// Mappings of logical to disk blocks each inode keeps in core.
+#define EXT2_EXTENT_CACHE 8
+
+// A run of len file blocks starting at lblk stored contiguously from disk block pblk.
+struct ext2_extent
+{
+    u32 lblk;
+    u32 pblk;
+    u32 len;
+};
+
 struct ext2fs_addrs
 {
-    u32 busy;
     u32 addrs[EXT2_N_BLOCKS];
+    u32 goal;           // preferred next block: the one after the last allocation
+    u32 prealloc_start; // first block of the preallocation window, kept in memory only
+    u32 prealloc_count; // blocks left in the preallocation window
+    struct spinlock extent_lock; // protects extents and extent_next, which readers share
+    struct ext2_extent extents[EXT2_EXTENT_CACHE];
+    u32 extent_next; // slot to replace on the next miss
 };
 
-extern struct ext2fs_addrs ext2fs_addrs[NINODE];
 
 struct ext2_super_block
 {
@@ -120,8 +172,16 @@ struct ext2_super_block
     u8 s_reserved_char_pad;
     u16 s_reserved_word_pad;
     u32 s_default_mount_opts;
-    u32 s_first_meta_bg; /* First metablock block group */
-    u32 s_reserved[190]; /* Padding to the end of the block */
+    u32 s_first_meta_bg;     /* First metablock block group */
+    u32 s_mkfs_time;         /* When the filesystem was created */
+    u32 s_jnl_blocks[17];    /* Backup of the journal inode */
+    u32 s_blocks_count_hi;   /* Blocks count */
+    u32 s_r_blocks_count_hi; /* Reserved blocks count */
+    u32 s_free_blocks_hi;    /* Free blocks count */
+    u16 s_min_extra_isize;   /* All inodes have at least # bytes */
+    u16 s_want_extra_isize;  /* New inodes should reserve # bytes */
+    u32 s_flags;             /* Miscellaneous flags */
+    u32 s_reserved[167];     /* Padding to the end of the block */
 };
 
 struct ext2_group_desc
@@ -221,6 +281,34 @@ struct ext2_dir_entry_2
     char name[EXT2_NAME_LEN]; /* File name */
 };
 
+/*
+ * Hashed directory index (htree). Block 0 of an indexed directory holds
+ * "." and "..", whose rec_len covers the rest of the block, followed by
+ * the root info and the root's entries. Interior nodes are blocks whose
+ * single empty record spans the whole block, followed by entries. The
+ * count and limit of a node overlay the hash of its first entry.
+ */
+struct ext2_dx_root_info
+{
+    u32 reserved_zero;
+    u8 hash_version;
+    u8 info_length; /* 8 */
+    u8 indirect_levels;
+    u8 unused_flags;
+};
+
+struct ext2_dx_entry
+{
+    u32 hash;
+    u32 block; /* logical block of the directory */
+};
+
+struct ext2_dx_countlimit
+{
+    u16 limit;
+    u16 count;
+};
+
 // file type
 #define S_IFMT  00170000 // type of file
 #define S_IFSOCK 0140000 // socket
@@ -244,15 +332,27 @@ struct ext2_dir_entry_2
 
 
 void ext2fs_readsb(int dev, struct ext2_super_block *sb);
+void ext2fs_addrs_cache_init(void);
+void *ext2fs_addrs_alloc(void);
+void ext2fs_addrs_free(void *addrs);
+u32 ext2fs_dirhash(const char *name, u32 len, int version, const u32 seed[4]);
+int ext2fs_direct_io(struct inode *, char *, u32, u32, bool);
 int ext2fs_dirlink(struct inode *, char *, u32);
 struct inode *ext2fs_dirlookup(struct inode *, char *, u32 *);
+int ext2fs_getdents(struct inode *, char *, u32, u32 *);
+struct page *ext2fs_getpage(struct inode *, u32);
 struct inode *ext2fs_ialloc(u32, short);
 void ext2fs_iinit(int dev);
 void ext2fs_ilock(struct inode *);
+void ext2fs_ilock_shared(struct inode *);
 void ext2fs_iput(struct inode *);
 void ext2fs_iunlock(struct inode *);
 void ext2fs_iunlockput(struct inode *);
 void ext2fs_iupdate(struct inode *);
 int ext2fs_readi(struct inode *, char *, u32, u32);
 void ext2fs_stati(struct inode *, struct stat *);
+int ext2fs_fsync(struct inode *);
+void ext2fs_sync(bool wait);
+void ext2fs_sync_inodes(u32 dev, bool wait);
+void ext2fs_sync_super(int dev);
 int ext2fs_writei(struct inode *, char *, u32, u32);
@@ -4,4 +4,12 @@
 #define O_RDWR    0x002 // open for reading and writing
 #define O_CREATE  0x200 // create file if it does not exist
 #define O_TRUNC   0x400 // truncate file upon open
-#define O_APPEND  0x800 // append on each write
\ No newline at end of file
+#define O_APPEND  0x800 // append on each write
+#define O_NONBLOCK 0x1000 // fail with -EAGAIN instead of waiting for a device or pipe
+#define O_DIRECT  0x4000 // move aligned file data by DMA, bypassing the caches
+
+// fcntl commands
+#define F_GETFL 3 // get the access mode and status flags
+#define F_SETFL 4 // set the status flags; only O_NONBLOCK can change
+#define F_SETPIPE_SZ 1031 // resize a pipe, up to 64 KiB; returns the new size
+#define F_GETPIPE_SZ 1032 // get the capacity of a pipe
@@ -0,0 +1,34 @@
+#pragma once
+
+#include "types.h"
+#include "mmu.h"
+#include "param.h"
+
+struct file;
+
+/**
+ * @brief A process's open file descriptors.
+ *
+ * Starts out with room for NOFILE descriptors inside the table itself.
+ * Past that the files move to pages of FDT_PER_PAGE pointers, added one
+ * at a time as more are opened up to NOFILE_MAX, and the bitmap to a page
+ * of its own. Only the owning process touches its table, so it needs no
+ * lock.
+ */
+#define FDT_PER_PAGE (PGSIZE / sizeof(struct file *))
+
+struct fdtable
+{
+    u32 max;   // descriptors the table has room for, a multiple of 32
+    u32 next;  // no descriptor below this is free
+    u32 *open; // bit i is set when descriptor i is in use
+    // Until open moves to a page, descriptor i is fd_array[i]; after,
+    // fd_pages[i / FDT_PER_PAGE][i % FDT_PER_PAGE].
+    struct file **fd_pages[NOFILE_MAX / FDT_PER_PAGE];
+    struct file *fd_array[NOFILE];
+    u32 open_array[NOFILE / 32];
+};
+
+_Static_assert(NOFILE % 32 == 0 && NOFILE_MAX % 32 == 0, "fd tables must fill whole bitmap words");
+_Static_assert(NOFILE <= FDT_PER_PAGE && NOFILE_MAX % FDT_PER_PAGE == 0 && NOFILE_MAX / 8 <= PGSIZE,
+               "fd tables must grow into whole pages");
@@ -9,26 +9,38 @@
 #define SEEK_CUR 1
 #define SEEK_END 2
 
+struct page;
+struct poll_table;
+struct shm_object;
+
 struct file
 {
-    enum { FD_NONE, FD_PIPE, FD_INODE } type;
+    enum { FD_NONE, FD_PIPE, FD_INODE, FD_SHM } type;
 
     int ref; // reference count
     char readable;
     char writable;
     struct pipe *pipe;
     struct inode *ip;
+    struct shm_object *shm;
     u32 off;
+    char direct; // opened with O_DIRECT
+    int flags;   // O_NONBLOCK, set by open or fcntl
 };
 
 
 struct inode_operations
 {
+    int (*direct_io)(struct inode *, char *, u32, u32, bool);
     int (*dirlink)(struct inode *, char *, u32);
     struct inode * (*dirlookup)(struct inode *, char *, u32 *);
+    int (*fsync)(struct inode *);
+    int (*getdents)(struct inode *, char *, u32, u32 *);
+    struct page * (*getpage)(struct inode *, u32);
     struct inode * (*ialloc)(u32, short);
     void (*iinit)(int dev);
     void (*ilock)(struct inode *);
+    void (*ilock_shared)(struct inode *);
     void (*iput)(struct inode *);
     void (*iunlock)(struct inode *);
     void (*iunlockput)(struct inode *);
@@ -54,8 +66,14 @@ struct inode
     u16 i_gid;   /* Low 16 bits of Group Id */
     u32 i_flags; /* File flags */
 
-    struct sleeplock lock; // protects everything below here
-    int valid;             // inode has been read from disk?
+    // Inode cache links, protected by icache.lock
+    struct inode *hash_next;
+    struct inode *lru_prev; // LRU of unreferenced inodes
+    struct inode *lru_next;
+
+    struct rwsleeplock lock; // protects everything below here
+    int valid;               // inode has been read from disk?
+    char dirty;              // changed since it was last written to disk?
     struct inode_operations *iops;
 
     char path[MAX_FILE_PATH];
@@ -71,8 +89,14 @@ struct inode
 // device functions
 struct devsw
 {
-    int (*read)(struct inode *ip, char *buf, int n, u32 offset);
-    int (*write)(struct inode *ip, char *buf, int n, u32 offset);
+    // flags are the open file's status flags; with O_NONBLOCK a device
+    // returns -EAGAIN instead of waiting.
+    int (*read)(struct inode *ip, char *buf, int n, u32 offset, int flags);
+    int (*write)(struct inode *ip, char *buf, int n, u32 offset, int flags);
+    // Returns the POLLIN/POLLOUT events ready now, after joining the
+    // device's wait queue with poll_wait. Devices without one are
+    // always ready.
+    int (*poll)(struct inode *ip, struct poll_table *pt);
     int offset;
 };
 
@@ -8,6 +8,7 @@
 #define ROOTINO 1  // root i-number
 #define EXT2INO 2  // ext2 root i-number
 #define BSIZE 1024  // block size
+#define BSIZE_MAX 4096  // largest block size a device may use
 
 
 
@@ -54,12 +55,3 @@ struct dinode
 
 // Block of free map containing bit for block b
 #define BBLOCK(b, sb) (b/BPB + sb.bmapstart)
-
-// Directory is a file containing a sequence of dirent structures.
-#define DIRSIZ 14
-
-struct dirent
-{
-    u16 inum;
-    char name[DIRSIZ];
-};
\ No newline at end of file
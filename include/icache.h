@@ -4,7 +4,25 @@
 #include "spinlock.h"
 #include "file.h"
 
-struct icache{
+#define ICACHE_BUCKETS 128
+
+/**
+ * @brief In-core inode cache.
+ *
+ * Inodes are allocated on demand and hashed by (dev, inum). When the last
+ * reference goes away a valid inode stays cached on an LRU list, so a
+ * later iget finds it without reading the disk; once NINODE
+ * unreferenced inodes have piled up the least recently used one is
+ * reused for the next new inode.
+ */
+struct icache
+{
     struct spinlock lock;
-    struct inode inode[NINODE];
+    struct inode *hash[ICACHE_BUCKETS];
+    struct inode lru; // list head of unreferenced inodes, most recently used first
+    u32 ninodes;      // inodes in core
+    u32 nunused;      // in core with no references
 };
+
+void icache_init(void);
+bool irelease(struct inode *ip);
@@ -9,6 +9,7 @@ extern u32 phys_ram_end; // Top of usable RAM reported by firmware
 // #define DEVSPACE 0xFE000000 // start of legacy device MMIO window (3.75GB)
 #define MMIOBASE 0xFD000000 // lower bound we need mapped for framebuffer/MMIO (3.69GB)
 #define FB_MMAP_BASE 0x50000000 // User virtual address base for framebuffer mappings
+#define SHM_MMAP_BASE 0x60000000 // User virtual addresses for shared memory mappings, up to KERNBASE
 
 // Key addresses for address space layout (see kmap in vm.c for layout)
 #define KERNBASE 0x80000000          // First kernel virtual address (2GB)
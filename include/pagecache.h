@@ -0,0 +1,36 @@
+#pragma once
+
+#include "types.h"
+#include "sleeplock.h"
+
+/**
+ * @brief One page of cached file data.
+ *
+ * Pages are keyed by (dev, inum, index) where index is the file offset
+ * divided by PGSIZE. The frame behind data comes from kalloc_page(), so
+ * V2P(data) is a stable physical address that mmap or exec can map into
+ * a process for as long as they hold a reference on the page.
+ */
+struct page
+{
+    u32 dev;
+    u32 inum;
+    u32 index;             // page index within the file
+    u32 refcnt;            // protected by the page cache lock
+    int hashed;            // reachable through the hash table; protected by the page cache lock
+    struct sleeplock lock; // protects valid and data
+    int valid;             // data holds the file contents
+    char *data;            // PGSIZE bytes of file data
+    struct page *hash_next;
+    struct page *prev; // LRU list
+    struct page *next;
+};
+
+void page_cache_init(void);
+struct page *page_cache_get(u32 dev, u32 inum, u32 index);
+struct page *page_cache_find(u32 dev, u32 inum, u32 index);
+void page_cache_unlock(struct page *pg);
+void page_cache_lock(struct page *pg);
+void page_cache_put(struct page *pg);
+void page_cache_invalidate(u32 dev, u32 inum);
+u32 page_cache_reclaim(u32 target);
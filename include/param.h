@@ -2,12 +2,19 @@
 #define NPROC        64  // maximum number of processes
 #define KSTACKSIZE 4096  // size of per-process kernel stack
 #define NCPU          8  // maximum number of CPUs
-#define NOFILE       16  // open files per process
-#define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
+#define NOFILE       32  // open files a process has room for before its table grows
+#define NOFILE_MAX 4096  // open files per process
+#define NINODE      128  // unreferenced i-nodes kept cached
 #define NDEV         10  // maximum major device number
+#define NDENTRY     256  // size of the directory entry cache
 #define ROOTDEV       0  // device number of file system root disk
 #define EXT2DEV       2  // device number of file system ext2 disk
+#define TMPFSDEV      3  // device number of the tmpfs mounted on /tmp
+#define NMOUNT        4  // maximum number of mounted file systems
+#define TMPFS_NINODE 256  // files and directories a tmpfs can hold
+#define TMPFS_PAGES 4096  // pages a tmpfs can hold (16 MB)
+#define NSHM         32  // named shared memory objects
+#define SHM_PAGES  4096  // pages a shared memory object can hold (16 MB)
 #define MAXARG       32  // max exec arguments
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
 #define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
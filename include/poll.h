@@ -0,0 +1,15 @@
+#pragma once
+
+// Events a process can poll for; also what poll reports back in revents.
+#define POLLIN   0x001 // data can be read without blocking
+#define POLLOUT  0x004 // data can be written without blocking
+#define POLLERR  0x008 // the other end of a pipe is gone; always reported
+#define POLLHUP  0x010 // no writer is left; always reported
+#define POLLNVAL 0x020 // fd is not open; always reported
+
+struct pollfd
+{
+    int fd;        // ignored when negative
+    short events;  // POLLIN and/or POLLOUT
+    short revents; // filled in by poll
+};
@@ -3,6 +3,7 @@
 #include "mmu.h"
 #include "param.h"
 #include "spinlock.h"
+#include "fdtable.h"
 
 // Per-CPU state
 struct cpu
@@ -52,6 +53,7 @@ enum procstate { UNUSED, EMBRYO, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
 #define VMA_FLAG_HEAP   0x1
 #define VMA_FLAG_DEVICE 0x2
+#define VMA_FLAG_SHM    0x4 // pages of the shared memory object behind file
 
 struct vm_area
 {
@@ -78,7 +80,7 @@ struct proc
     struct context *context;      // switch_context() here to run process
     void *chan;                   // If non-zero, sleeping on chan
     int killed;                   // If non-zero, have been killed
-    struct file *ofile[NOFILE];   // Open files
+    struct fdtable fdt;           // Open files
     struct inode *cwd;            // Current directory
     struct vm_area *vma_list;     // Head of VM area list
     char cwd_path[MAX_FILE_PATH];
@@ -102,6 +104,9 @@ struct ptable_t
     struct proc proc[NPROC];
 };
 
+void vma_init(void);
+struct vm_area *vma_alloc(void);
+void vma_free(struct vm_area *vma);
 struct vm_area *proc_ensure_heap_vma(struct proc *p);
 void proc_free_vmas(struct proc *p);
 int proc_clone_vmas(struct proc *dst, struct proc *src);
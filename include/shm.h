@@ -0,0 +1,41 @@
+#pragma once
+
+#include "mmu.h"
+#include "param.h"
+#include "types.h"
+
+struct proc;
+struct vm_area;
+
+#define SHM_NAME_MAX 32 // including the terminating zero
+
+// Page pointers are kept in page-sized blocks, so an object of any size
+// needs no more than a few of them.
+#define SHM_PTRS_PER_PAGE (PGSIZE / sizeof(char *))
+#define SHM_NPTRPAGES ((SHM_PAGES + SHM_PTRS_PER_PAGE - 1) / SHM_PTRS_PER_PAGE)
+
+/**
+ * @brief A named shared memory object.
+ *
+ * The pages of an object never move while it exists, so every process that
+ * maps it sees the same physical memory. Open files and the name each hold
+ * a reference; the pages go back to the allocator with the last one.
+ */
+struct shm_object
+{
+    char name[SHM_NAME_MAX];
+    int ref;                        // open files, plus one while linked
+    bool linked;                    // name still visible to shm_open
+    u32 size;                       // bytes, as set by ftruncate
+    u32 npages;                     // pages backing size
+    int nmaps;                      // mappings in all processes
+    char **ptrpages[SHM_NPTRPAGES]; // kernel addresses of the pages
+};
+
+void shm_init(void);
+int shm_get(const char *name, int omode, struct shm_object **shmp);
+void shm_put(struct shm_object *shm);
+int shm_unlink(const char *name);
+int shm_truncate(struct shm_object *shm, u32 size);
+int shm_map(struct proc *p, struct vm_area *vma);
+void shm_unmap(struct proc *p, struct vm_area *vma);
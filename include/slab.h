@@ -0,0 +1,25 @@
+#pragma once
+
+#include "types.h"
+#include "spinlock.h"
+
+/**
+ * @brief Cache of equally sized kernel objects.
+ *
+ * Objects are carved out of whole pages from kalloc_page() and kept on a
+ * free list once released, so allocating one is a list pop. Pages are not
+ * given back to the page allocator.
+ */
+struct kmem_cache
+{
+    struct spinlock lock;
+    char *name;
+    u32 size;   // object size, rounded up to a pointer
+    void *free; // free objects, linked through their first word
+    u32 nalloc; // objects handed out
+    u32 npages; // pages backing the cache
+};
+
+void kmem_cache_init(struct kmem_cache *cache, char *name, u32 size);
+void *kmem_cache_alloc(struct kmem_cache *cache);
+void kmem_cache_free(struct kmem_cache *cache, void *obj);
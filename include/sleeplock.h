@@ -12,4 +12,19 @@ struct sleeplock
     // For debugging:
     char* name; // Name of lock.
     int pid; // Process holding lock
-};
\ No newline at end of file
+};
+
+// Long-term reader/writer lock for processes. Any number of processes
+// may hold it shared, or one may hold it exclusively. Writers are
+// preferred: once one is waiting, new readers queue up behind it.
+struct rwsleeplock
+{
+    struct spinlock lk;  // spinlock protecting this lock
+    int readers;         // processes holding it shared
+    u32 writer;          // held exclusively?
+    int waiting_writers; // writers asleep in acquirerwsleep
+
+    // For debugging:
+    char *name; // Name of lock.
+    int pid;    // Process holding it exclusively
+};
@@ -37,6 +37,8 @@
 #define ENOTTY 17
 // Is a directory
 #define EISDIR 18
+// Timed out
+#define ETIMEDOUT 19
 
 static inline char *strerror(const int error)
 {
@@ -73,6 +75,8 @@ static inline char *strerror(const int error)
         return "Operation not supported";
     case -EISDIR:
         return "Is a directory";
+    case -ETIMEDOUT:
+        return "Timed out";
     default:
         return "Unknown error";
     }
@@ -0,0 +1,13 @@
+#pragma once
+
+#include "types.h"
+
+// Most segments readv() and writev() take in one call; the kernel
+// copies the array onto its stack
+#define IOV_MAX 16
+
+struct iovec
+{
+    void *iov_base; // start of the segment
+    u32 iov_len;    // length of the segment in bytes
+};
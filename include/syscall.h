@@ -31,3 +31,17 @@
 #define SYS_tcgetattr 29
 #define SYS_tcsetattr 30
 #define SYS_ioctl 31
+#define SYS_getdents 32
+#define SYS_pread 33
+#define SYS_pwrite 34
+#define SYS_readv 35
+#define SYS_writev 36
+#define SYS_sendfile 37
+#define SYS_splice 38
+#define SYS_fsync 39
+#define SYS_fcntl 40
+#define SYS_poll 41
+#define SYS_shm_open 42
+#define SYS_shm_unlink 43
+#define SYS_ftruncate 44
+#define SYS_futex 45
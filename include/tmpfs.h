@@ -0,0 +1,29 @@
+#pragma once
+
+#include "types.h"
+#include "file.h"
+#include "stat.h"
+
+extern struct inode_operations tmpfs_inode_ops;
+
+// Inode number of the tmpfs root directory
+#define TMPFS_ROOTINO 1
+
+// Directories hold ext2 style records in chunks of this size, so no
+// record ever crosses a page.
+#define TMPFS_DIRBLK 512
+
+int tmpfs_dirlink(struct inode *, char *, u32);
+struct inode *tmpfs_dirlookup(struct inode *, char *, u32 *);
+int tmpfs_getdents(struct inode *, char *, u32, u32 *);
+struct inode *tmpfs_ialloc(u32, short);
+void tmpfs_iinit(int dev);
+void tmpfs_ilock(struct inode *);
+void tmpfs_ilock_shared(struct inode *);
+void tmpfs_iput(struct inode *);
+void tmpfs_iunlock(struct inode *);
+void tmpfs_iunlockput(struct inode *);
+void tmpfs_iupdate(struct inode *);
+int tmpfs_readi(struct inode *, char *, u32, u32);
+void tmpfs_stati(struct inode *, struct stat *);
+int tmpfs_writei(struct inode *, char *, u32, u32);
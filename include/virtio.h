@@ -0,0 +1,89 @@
+#pragma once
+
+#include <pci.h>
+#include <types.h>
+
+struct buf;
+struct disk_seg;
+
+// Legacy (virtio 0.9.5) PCI interface, used by transitional devices.
+// https://docs.oasis-open.org/virtio/virtio/v1.1/virtio-v1.1.html, section 4.1.4.8
+#define VIRTIO_VENDOR 0x1AF4
+#define VIRTIO_BLK_DEV 0x1001 // transitional block device
+
+// Registers in the I/O BAR.
+#define VIRTIO_PCI_HOST_FEATURES 0x00  // u32, features the device offers
+#define VIRTIO_PCI_GUEST_FEATURES 0x04 // u32, features the driver accepts
+#define VIRTIO_PCI_QUEUE_PFN 0x08      // u32, page number of the selected queue
+#define VIRTIO_PCI_QUEUE_NUM 0x0C      // u16, size of the selected queue
+#define VIRTIO_PCI_QUEUE_SEL 0x0E      // u16, queue the PFN and NUM registers refer to
+#define VIRTIO_PCI_QUEUE_NOTIFY 0x10   // u16, write a queue index to kick it
+#define VIRTIO_PCI_STATUS 0x12         // u8, device status
+#define VIRTIO_PCI_ISR 0x13            // u8, interrupt status; reading it acknowledges the interrupt
+#define VIRTIO_PCI_CONFIG 0x14         // device specific configuration without MSI-X
+
+// Device status bits.
+#define VIRTIO_STATUS_ACKNOWLEDGE 0x01
+#define VIRTIO_STATUS_DRIVER 0x02
+#define VIRTIO_STATUS_DRIVER_OK 0x04
+#define VIRTIO_STATUS_FAILED 0x80
+
+// Legacy queues are laid out in pages of this size.
+#define VIRTIO_PCI_VRING_ALIGN 4096
+
+// Split virtqueue structures.
+#define VRING_DESC_F_NEXT 1  // the buffer continues in the next field
+#define VRING_DESC_F_WRITE 2 // the device writes the buffer
+
+struct vring_desc
+{
+    u64 addr; // physical address
+    u32 len;
+    u16 flags;
+    u16 next;
+};
+
+struct vring_avail
+{
+    u16 flags;
+    u16 idx;
+    u16 ring[];
+};
+
+struct vring_used_elem
+{
+    u32 id; // head of the finished descriptor chain
+    u32 len;
+};
+
+struct vring_used
+{
+    u16 flags;
+    u16 idx;
+    struct vring_used_elem ring[];
+};
+
+// Bytes a legacy queue of num entries takes, descriptors and available
+// ring first, the used ring on the next page boundary.
+#define VRING_SIZE(num)                                                                                      \
+    ((((16 * (num) + 6 + 2 * (num)) + VIRTIO_PCI_VRING_ALIGN - 1) & ~(VIRTIO_PCI_VRING_ALIGN - 1)) +         \
+     (((6 + 8 * (num)) + VIRTIO_PCI_VRING_ALIGN - 1) & ~(VIRTIO_PCI_VRING_ALIGN - 1)))
+
+// virtio-blk requests.
+#define VIRTIO_BLK_T_IN 0  // read
+#define VIRTIO_BLK_T_OUT 1 // write
+#define VIRTIO_BLK_S_OK 0
+
+#define VIRTIO_BLK_SECTOR_SIZE 512u
+
+struct virtio_blk_req_hdr
+{
+    u32 type;
+    u32 reserved;
+    u64 sector;
+};
+
+void virtio_blk_init(struct pci_device device);
+bool virtio_blk_ready(void);
+void virtio_blk_rw(struct buf *b);
+int virtio_blk_rw_sg(u64 lba, const struct disk_seg *segs, u32 nsegs, bool write);
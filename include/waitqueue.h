@@ -0,0 +1,44 @@
+#pragma once
+
+#include "types.h"
+
+struct poll_table;
+struct wait_queue;
+
+// One poller waiting on one wait queue.
+struct wait_entry
+{
+    struct poll_table *pt;
+    struct wait_queue *wq;
+    struct wait_entry *next;
+};
+
+// Something poll can wait on, such as a pipe or a device's input. The
+// entries are protected by a single poll lock rather than one per queue,
+// so waking a queue is safe from interrupt handlers and with the owner's
+// own lock held.
+struct wait_queue
+{
+    struct wait_entry *head;
+};
+
+// State of one poll call: the wait queues it joined and whether any of
+// them was woken since it last looked.
+struct poll_table
+{
+    struct wait_entry *entries;
+    int nentries;
+    int max;
+    bool woken; // protected by the poll lock
+};
+
+// Woken on every clock tick while somebody polls with a timeout.
+extern struct wait_queue timer_wait_queue;
+
+void poll_init(void);
+void wait_queue_init(struct wait_queue *wq);
+void wait_queue_wake(struct wait_queue *wq);
+void poll_table_init(struct poll_table *pt, struct wait_entry *entries, int max);
+void poll_wait(struct poll_table *pt, struct wait_queue *wq);
+void poll_table_sleep(struct poll_table *pt);
+void poll_table_free(struct poll_table *pt);
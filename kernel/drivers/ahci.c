@@ -1,4 +1,5 @@
 #include <ahci.h>
+#include <buf.h>
 #include <printf.h>
 #include <spinlock.h>
 #include <status.h>
@@ -37,6 +38,7 @@
 #define AHCI_CMD_SLOT 0u
 #define AHCI_GENERIC_TIMEOUT 1000000u
 #define AHCI_MMIO_BYTES 0x1100u
+#define AHCI_PRDT_ENTRIES DISK_SEG_MAX
 
 struct ahci_prdt_entry
 {
@@ -61,9 +63,11 @@ struct ahci_command_table
     u8 cfis[64];
     u8 acmd[16];
     u8 reserved0[48];
-    struct ahci_prdt_entry prdt[1];
+    struct ahci_prdt_entry prdt[AHCI_PRDT_ENTRIES];
 } __attribute__((packed));
 
+_Static_assert(sizeof(struct ahci_command_table) <= PGSIZE, "AHCI command table must fit in a page");
+
 struct ahci_port_state
 {
     bool configured;
@@ -283,8 +287,8 @@ static int ahci_configure_active_port(volatile struct ahci_memory *memory, const
     struct ahci_command_header *const command_list =
         (struct ahci_command_header *)ahci_alloc_aligned(AHCI_COMMAND_LIST_BYTES, 1024);
     u8 *const fis                                  = ahci_alloc_aligned(AHCI_RECEIVED_FIS_BYTES, 256);
-    struct ahci_command_table *const command_table =
-        (struct ahci_command_table *)ahci_alloc_aligned(sizeof(struct ahci_command_table), 128);
+    // A whole page keeps the table physically contiguous however many PRDT entries it has.
+    struct ahci_command_table *const command_table = (struct ahci_command_table *)kalloc_page();
     u8 *const bounce_buffer = ahci_alloc_aligned(AHCI_SECTOR_SIZE, AHCI_SECTOR_SIZE);
 
     if (!command_list || !fis || !command_table || !bounce_buffer) {
@@ -473,12 +477,20 @@ bool ahci_port_ready(void)
     return active_port.configured;
 }
 
-static int ahci_issue_dma(u64 lba, const uptr buffer_phys, const u32 sector_count, const bool write)
+// Issue one READ/WRITE DMA EXT command whose data is scattered over nsegs
+// physically contiguous segments, one PRDT entry each.
+static int ahci_issue_dma(u64 lba, const struct disk_seg *segs, const u32 nsegs, const bool write)
 {
     if (!active_port.configured) {
         return -ENOTSUP;
     }
 
+    u32 bytes = 0;
+    for (u32 i = 0; i < nsegs; i++) {
+        bytes += segs[i].len;
+    }
+    const u32 sector_count = bytes / AHCI_SECTOR_SIZE;
+
     volatile struct ahci_port *const port = active_port.port;
 
     int status = ahci_port_wait(port, AHCI_TFD_BUSY | AHCI_TFD_DRQ);
@@ -500,15 +512,16 @@ static int ahci_issue_dma(u64 lba, const uptr buffer_phys, const u32 sector_coun
     } else {
         header->flags &= ~(1u << 6);
     }
-    header->prdtl = 1;
+    header->prdtl = (u16)nsegs;
     header->prdbc = 0;
 
-    struct ahci_prdt_entry *const prdt = &table->prdt[0];
-    const u32 bytes                    = sector_count * AHCI_SECTOR_SIZE;
-
-    prdt->dba  = (u32)buffer_phys;
-    prdt->dbau = ahci_upper32(buffer_phys);
-    prdt->dbc  = (bytes - 1) | (1u << 31); // Interrupt on completion
+    for (u32 i = 0; i < nsegs; i++) {
+        struct ahci_prdt_entry *const prdt = &table->prdt[i];
+        prdt->dba                          = segs[i].phys;
+        prdt->dbau                         = 0;
+        prdt->dbc                          = segs[i].len - 1;
+    }
+    table->prdt[nsegs - 1].dbc |= 1u << 31; // Interrupt on completion
 
     u8 *const cfis = table->cfis;
     memset(cfis, 0, sizeof(table->cfis));
@@ -605,7 +618,8 @@ int ahci_read(u64 lba, u32 sector_count, void *buffer)
         bool needs_bounce = false;
         u32 chunk         = ahci_calculate_chunk(byte_buffer, remaining, &buffer_phys, &needs_bounce);
 
-        result = ahci_issue_dma(lba, buffer_phys, chunk, false);
+        const struct disk_seg seg = {(u32)buffer_phys, chunk * AHCI_SECTOR_SIZE};
+        result                    = ahci_issue_dma(lba, &seg, 1, false);
         if (result != ALL_OK) {
             break;
         }
@@ -648,7 +662,8 @@ int ahci_write(u64 lba, u32 sector_count, const void *buffer)
             memcpy(active_port.bounce_buffer, byte_buffer_const, AHCI_SECTOR_SIZE);
         }
 
-        result = ahci_issue_dma(lba, buffer_phys, chunk, true);
+        const struct disk_seg seg = {(u32)buffer_phys, chunk * AHCI_SECTOR_SIZE};
+        result                    = ahci_issue_dma(lba, &seg, 1, true);
         if (result != ALL_OK) {
             break;
         }
@@ -661,3 +676,38 @@ int ahci_write(u64 lba, u32 sector_count, const void *buffer)
     release(&ahci_lock);
     return result;
 }
+
+/**
+ * @brief Transfer sectors between the disk and scattered physical memory.
+ *
+ * The whole transfer is one command with a PRDT entry per segment, so no
+ * data goes through the bounce buffer.
+ *
+ * @return ALL_OK, -EINVARG for an empty, oversized or misaligned list, or -EIO.
+ */
+int ahci_rw_sg(u64 lba, const struct disk_seg *segs, u32 nsegs, bool write)
+{
+    if (segs == nullptr || nsegs == 0 || nsegs > AHCI_PRDT_ENTRIES) {
+        return -EINVARG;
+    }
+    u32 bytes = 0;
+    for (u32 i = 0; i < nsegs; i++) {
+        if (segs[i].len == 0 || segs[i].len % AHCI_SECTOR_SIZE != 0 || segs[i].len > AHCI_PRDT_MAX_BYTES ||
+            (segs[i].phys & 1u) != 0) {
+            return -EINVARG;
+        }
+        bytes += segs[i].len;
+    }
+    if (bytes / AHCI_SECTOR_SIZE > 0xFFFFu) {
+        return -EINVARG;
+    }
+
+    if (!active_port.configured) {
+        return -ENOTSUP;
+    }
+
+    acquire(&ahci_lock);
+    const int result = ahci_issue_dma(lba, segs, nsegs, write);
+    release(&ahci_lock);
+    return result;
+}
@@ -6,10 +6,13 @@
 #include <console.h>
 #include <debug.h>
 #include <defs.h>
+#include <fcntl.h>
 #include <file.h>
+#include <poll.h>
 #include <printf.h>
 #include <proc.h>
 #include <scheduler.h>
+#include <status.h>
 #include <string.h>
 #include <sys/ioctl.h>
 #include <termcolors.h>
@@ -18,6 +21,7 @@
 #include <types.h>
 #include <vesa_terminal.h>
 #include <vga_terminal.h>
+#include <waitqueue.h>
 #include <x86.h>
 
 // Special keycodes
@@ -56,6 +60,16 @@ static int console_raw_mode;
 static int console_echo_enabled;
 static int console_opost_enabled;
 
+// Pollers of the console; keyboard and serial input both land here.
+static struct wait_queue console_wait_queue;
+
+// Wake readers and pollers after input became readable.
+static void input_wakeup_locked(void)
+{
+    wakeup(&input.r);
+    wait_queue_wake(&console_wait_queue);
+}
+
 static void reset_input_locked(void)
 {
     input.r = input.w = input.e = 0;
@@ -75,7 +89,7 @@ static void queue_sequence_locked(const char *seq)
     while (*seq) {
         input_push_locked(*seq++);
     }
-    wakeup(&input.r);
+    input_wakeup_locked();
 }
 
 void console_queue_input(const char *seq)
@@ -142,7 +156,7 @@ static void handle_raw_input(int c)
         c = '\n';
     }
     input_push_locked(c);
-    wakeup(&input.r);
+    input_wakeup_locked();
 }
 
 void panic(const char *fmt, ...)
@@ -256,7 +270,7 @@ void console_input_handler(int (*getc)(void))
         case 227: // Down arrow
             input.buf[input.e++ % INPUT_BUF] = c;
             input.w = input.e;
-            wakeup(&input.r);
+            input_wakeup_locked();
             break;
         default:
             if (c != 0 && input.e - input.r < INPUT_BUF) {
@@ -269,7 +283,7 @@ void console_input_handler(int (*getc)(void))
                 }
                 if (c == '\n' || c == CTRL('D') || input.e == input.r + INPUT_BUF) {
                     input.w = input.e;
-                    wakeup(&input.r);
+                    input_wakeup_locked();
                 }
             }
             break;
@@ -282,7 +296,7 @@ void console_input_handler(int (*getc)(void))
 }
 
 /** @brief Read from the console */
-int console_read(struct inode *ip, char *dst, int n, [[maybe_unused]] u32 offset)
+int console_read(struct inode *ip, char *dst, int n, [[maybe_unused]] u32 offset, int flags)
 {
     ip->iops->iunlock(ip);
     int target = n;
@@ -302,6 +316,12 @@ int console_read(struct inode *ip, char *dst, int n, [[maybe_unused]] u32 offset
                 return -1;
             }
 
+            if (flags & O_NONBLOCK) {
+                release(&cons.lock);
+                ip->iops->ilock(ip);
+                return n == target ? -EAGAIN : target - n;
+            }
+
             // Implement VTIME timeout for raw mode
             if (vmin == 0 && n == target) {
                 // VMIN=0: return immediately if no data
@@ -362,7 +382,7 @@ int console_read(struct inode *ip, char *dst, int n, [[maybe_unused]] u32 offset
 }
 
 /** @brief Write to the console */
-int console_write(struct inode *ip, char *buf, int n, [[maybe_unused]] u32 offset)
+int console_write(struct inode *ip, char *buf, int n, [[maybe_unused]] u32 offset, [[maybe_unused]] int flags)
 {
     ip->iops->iunlock(ip);
     acquire(&cons.lock);
@@ -375,6 +395,17 @@ int console_write(struct inode *ip, char *buf, int n, [[maybe_unused]] u32 offse
     return n;
 }
 
+/** @brief Report whether console input is waiting; output never blocks. */
+int console_poll([[maybe_unused]] struct inode *ip, struct poll_table *pt)
+{
+    poll_wait(pt, &console_wait_queue);
+
+    acquire(&cons.lock);
+    const int mask = POLLOUT | (input.r != input.w ? POLLIN : 0);
+    release(&cons.lock);
+    return mask;
+}
+
 static void console_apply_termios(void)
 {
     console_raw_mode      = (console_termios_state.c_lflag & ICANON) == 0;
@@ -394,7 +425,9 @@ void console_init(void)
 
     devsw[CONSOLE].write = console_write;
     devsw[CONSOLE].read  = console_read;
+    devsw[CONSOLE].poll  = console_poll;
     cons.locking         = 1;
+    wait_queue_init(&console_wait_queue);
 
 #ifndef GRAPHICS
     // Initialize VGA ANSI parser with VGA callbacks
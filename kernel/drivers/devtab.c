@@ -26,7 +26,7 @@ int devtab_lookup_major(struct inode *ip)
 void devtab_save()
 {
     const int fd      = open_file("/etc/devtab", O_RDWR | O_CREATE);
-    struct file *file = current_process()->ofile[fd];
+    struct file *file = fd_get(fd);
 
     for (int i = 0; i < NDEV; i++) {
         if (devtab[i].inum == 0) {
@@ -44,7 +44,7 @@ void devtab_save()
         file_write(file, buf, n);
     }
     file_close(file);
-    current_process()->ofile[fd] = nullptr;
+    fd_remove(fd);
 }
 
 void devtab_add_entry(struct inode *ip, const char *path)
@@ -89,7 +89,7 @@ void devtab_load()
     devtab_loaded = true;
 
     const int fd      = open_file("/etc/devtab", O_RDWR);
-    struct file *file = current_process()->ofile[fd];
+    struct file *file = fd_get(fd);
     char buf[512];
     struct stat st;
     file_stat(file, &st);
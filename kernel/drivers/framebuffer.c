@@ -94,7 +94,8 @@ void framebuffer_prepare_cpu(struct cpu *cpu)
     cpu->pat_wc_ready = configure_framebuffer_pat_entry();
 }
 
-int framebuffer_write(struct inode *ip, char *buf, int n, u32 offset)
+// Never waits, so O_NONBLOCK needs no handling.
+int framebuffer_write(struct inode *ip, char *buf, int n, u32 offset, [[maybe_unused]] int flags)
 {
     ip->iops->iunlock(ip);
 
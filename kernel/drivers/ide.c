@@ -1,4 +1,10 @@
-// Simple PIO-based (non-DMA) IDE driver code.
+// Legacy IDE driver for the primary channel.
+//
+// When the PCI IDE controller has a bus-master BAR, requests are moved
+// with DMA: a queued request is merged with the requests for the blocks
+// that follow it, up to IDE_DMA_MAX bytes, and the whole run goes to the
+// disk as one command with one PRD table entry per buffer. Otherwise the
+// driver falls back to PIO, one buffer per command.
 
 #include "ahci.h"
 #include "assert.h"
@@ -6,11 +12,13 @@
 #include "defs.h"
 #include "fs.h"
 #include "io.h"
+#include "memlayout.h"
 #include "pci.h"
 #include "proc.h"
 #include "spinlock.h"
 #include "status.h"
 #include "traps.h"
+#include "virtio.h"
 
 /** @brief Size in bytes of a hardware IDE sector. */
 #define SECTOR_SIZE 512
@@ -35,8 +43,41 @@
 #define IDE_CMD_WRMUL 0xc5
 /** @brief Command to set up multi-sector transfer count. */
 #define IDE_CMD_SETMUL 0xc6
+/** @brief DMA read command. */
+#define IDE_CMD_READ_DMA 0xc8
+/** @brief DMA write command. */
+#define IDE_CMD_WRITE_DMA 0xca
+
+/** @brief Bus-master command register, relative to the bus-master base. */
+#define BM_CMD 0x0
+/** @brief Bus-master status register. */
+#define BM_STATUS 0x2
+/** @brief Bus-master PRD table address register. */
+#define BM_PRDT 0x4
+/** @brief BM_CMD: start the transfer. */
+#define BM_CMD_START 0x01
+/** @brief BM_CMD: transfer from the disk to memory. */
+#define BM_CMD_READ 0x08
+/** @brief BM_STATUS: the transfer failed. */
+#define BM_STATUS_ERR 0x02
+/** @brief BM_STATUS: the drive raised its interrupt. */
+#define BM_STATUS_IRQ 0x04
+/** @brief PRD flag marking the last entry of the table. */
+#define PRD_EOT 0x8000
+
+/** @brief Most bytes one DMA command moves; 256 sectors, the 28-bit LBA limit. */
+#define IDE_DMA_MAX (128 * 1024)
+
+/** @brief Physical region descriptor: one piece of memory in a DMA transfer. */
+struct ide_prd
+{
+    u32 addr;
+    u16 len; // bytes; never crosses a 64 KiB boundary
+    u16 flags;
+};
 
-#define SECTOR_PER_BLOCK (BSIZE / SECTOR_SIZE)
+/** @brief Sectors moved per interrupt in multiple mode; covers the largest block. */
+#define IDE_MULTIPLE (BSIZE_MAX / SECTOR_SIZE)
 
 /** @brief Protects access to the IDE request queue. */
 static struct spinlock idelock;
@@ -47,6 +88,12 @@ static struct buf *idequeue;
 static int havedisk1;
 static int ide_initialized;
 static bool ide_controller_present;
+/** @brief I/O base of the primary channel's bus-master registers, 0 without DMA. */
+static u16 bm_base;
+/** @brief PRD table for the active DMA command. */
+static struct ide_prd *ide_prdt;
+/** @brief Buffers at the head of idequeue that the active command covers. */
+static u32 ide_active;
 static void ide_start(struct buf *);
 
 /**
@@ -120,23 +167,116 @@ static void ide_initialize_hardware(void)
     // Switch back to disk 0.
     outb(0x1f6, 0xe0 | (0 << 4));
 
-#if SECTOR_PER_BLOCK > 1
     if (ide_wait(0) < 0) {
         boot_message(WARNING_LEVEL_WARNING, "ideinit: controller not ready for SETMUL; keeping single-sector PIO");
         return;
     }
-    outb(0x1f2, SECTOR_PER_BLOCK);
+    outb(0x1f2, IDE_MULTIPLE);
     outb(0x1f7, IDE_CMD_SETMUL);
     if (ide_wait(1) < 0) {
         boot_message(WARNING_LEVEL_WARNING, "ideinit: set multiple failed");
     }
-#endif
 }
 
 /** @brief PCI driver hook for legacy IDE controllers. */
-void ide_pci_init([[maybe_unused]] struct pci_device device)
+void ide_pci_init(struct pci_device device)
 {
     ide_initialize_hardware();
+    if (!ide_controller_present) {
+        return;
+    }
+
+    // BAR4 holds the bus-master registers: primary channel first, then
+    // the secondary channel at +8.
+    const u32 bar4 = device.header.bars[4];
+    if ((bar4 & 0x1) != PCI_BAR_IO || (bar4 & ~0x3) == 0) {
+        boot_message(WARNING_LEVEL_INFO, "IDE controller has no bus-master BAR; using PIO");
+        return;
+    }
+    // One page holds IDE_DMA_MAX / SECTOR_SIZE entries and never crosses 64 KiB.
+    ide_prdt = (struct ide_prd *)kalloc_page();
+    if (ide_prdt == nullptr) {
+        boot_message(WARNING_LEVEL_WARNING, "ide_pci_init: no memory for the PRD table; using PIO");
+        return;
+    }
+    pci_enable_bus_mastering(device);
+    bm_base = (u16)(bar4 & ~0x3);
+    outb(bm_base + BM_CMD, 0);
+    outb(bm_base + BM_STATUS, inb(bm_base + BM_STATUS) | BM_STATUS_ERR | BM_STATUS_IRQ);
+    boot_message(WARNING_LEVEL_INFO, "IDE bus-master DMA at I/O 0x%x", bm_base);
+}
+
+/**
+ * @brief Pull the queued requests that continue b's run of blocks up behind it.
+ *
+ * Caller holds idelock and b is at the head of idequeue. Fills the PRD
+ * table with one entry per buffer.
+ *
+ * @return Number of buffers in the run, starting with b.
+ */
+static u32 ide_merge(struct buf *b)
+{
+    const u32 dirty  = b->flags & B_DIRTY;
+    struct buf *last = b;
+    u32 n            = 0;
+    u32 bytes        = 0;
+
+    for (;;) {
+        ide_prdt[n].addr  = V2P(last->data);
+        ide_prdt[n].len   = last->size;
+        ide_prdt[n].flags = 0;
+        n++;
+        bytes += last->size;
+        if (bytes + b->size > IDE_DMA_MAX) {
+            break;
+        }
+
+        struct buf **pp = &last->qnext;
+        while (*pp != nullptr && ((*pp)->dev != b->dev || (*pp)->size != b->size ||
+                                  (*pp)->blockno != last->blockno + 1 || ((*pp)->flags & B_DIRTY) != dirty)) {
+            pp = &(*pp)->qnext;
+        }
+        struct buf *next = *pp;
+        if (next == nullptr) {
+            break;
+        }
+        *pp         = next->qnext;
+        next->qnext = last->qnext;
+        last->qnext = next;
+        last        = next;
+    }
+    ide_prdt[n - 1].flags = PRD_EOT;
+    return n;
+}
+
+/**
+ * @brief Start a DMA command for b and the requests merged behind it.
+ *
+ * Caller must hold idelock.
+ */
+static void ide_start_dma(struct buf *b)
+{
+    ide_active       = ide_merge(b);
+    const u32 count  = ide_active * (b->size / SECTOR_SIZE);
+    const u32 sector = b->blockno * (b->size / SECTOR_SIZE);
+    const bool write = b->flags & B_DIRTY;
+
+    if (ide_wait(0) < 0) {
+        panic("ide_start: controller not ready");
+    }
+    outl(bm_base + BM_PRDT, V2P(ide_prdt));
+    outb(bm_base + BM_CMD, write ? 0 : BM_CMD_READ);
+    outb(bm_base + BM_STATUS, inb(bm_base + BM_STATUS) | BM_STATUS_ERR | BM_STATUS_IRQ);
+
+    outb(0x3f6, 0);            // generate interrupt
+    outb(0x1f2, count & 0xff); // 0 means 256 sectors
+    outb(0x1f3, sector & 0xff);
+    outb(0x1f4, (sector >> 8) & 0xff);
+    outb(0x1f5, (sector >> 16) & 0xff);
+    outb(0x1f6, 0xe0 | ((b->dev & 1) << 4) | ((sector >> 24) & 0x0f));
+    outb(0x1f7, write ? IDE_CMD_WRITE_DMA : IDE_CMD_READ_DMA);
+
+    outb(bm_base + BM_CMD, (write ? 0 : BM_CMD_READ) | BM_CMD_START);
 }
 
 /**
@@ -149,19 +289,26 @@ static void ide_start(struct buf *b)
     if (b == nullptr) {
         panic("ide_start");
     }
-    u32 sector    = b->blockno * SECTOR_PER_BLOCK;
-    int read_cmd  = (SECTOR_PER_BLOCK == 1) ? IDE_CMD_READ : IDE_CMD_RDMUL;
-    int write_cmd = (SECTOR_PER_BLOCK == 1) ? IDE_CMD_WRITE : IDE_CMD_WRMUL;
+    if (bm_base != 0) {
+        ide_start_dma(b);
+        return;
+    }
+    ide_active = 1;
 
-#if (SECTOR_PER_BLOCK > 7)
-    panic("ide_start");
-#endif
+    const u32 sector_per_block = b->size / SECTOR_SIZE;
+    u32 sector                 = b->blockno * sector_per_block;
+    int read_cmd               = (sector_per_block == 1) ? IDE_CMD_READ : IDE_CMD_RDMUL;
+    int write_cmd              = (sector_per_block == 1) ? IDE_CMD_WRITE : IDE_CMD_WRMUL;
+
+    if (sector_per_block > IDE_MULTIPLE) {
+        panic("ide_start");
+    }
 
     if (ide_wait(0) < 0) {
         panic("ide_start: controller not ready");
     }
     outb(0x3f6, 0);                // generate interrupt
-    outb(0x1f2, SECTOR_PER_BLOCK); // number of sectors
+    outb(0x1f2, sector_per_block); // number of sectors
     outb(0x1f3, sector & 0xff);
     outb(0x1f4, (sector >> 8) & 0xff);
     outb(0x1f5, (sector >> 16) & 0xff);
@@ -172,7 +319,7 @@ static void ide_start(struct buf *b)
         if (idewait_drq() < 0) {
             boot_message(WARNING_LEVEL_ERROR, "ide_start: write error before data transfer");
         }
-        outsl(0x1f0, b->data, BSIZE / 4);
+        outsl(0x1f0, b->data, b->size / 4);
     } else {
         outb(0x1f7, read_cmd);
     }
@@ -190,17 +337,28 @@ void ideintr(void)
         release(&idelock);
         return;
     }
-    idequeue = b->qnext;
 
-    // Read data if needed.
-    if (!(b->flags & B_DIRTY) && ide_wait(1) >= 0) {
-        insl(0x1f0, b->data, BSIZE / 4);
+    if (bm_base != 0) {
+        const u8 status = inb(bm_base + BM_STATUS);
+        outb(bm_base + BM_CMD, 0);
+        outb(bm_base + BM_STATUS, status | BM_STATUS_ERR | BM_STATUS_IRQ);
+        // Reading the status register acknowledges the drive's interrupt.
+        if ((status & BM_STATUS_ERR) != 0 || ide_wait(1) < 0) {
+            panic("ide dma %s failed for block %u", (b->flags & B_DIRTY) ? "write" : "read", b->blockno);
+        }
+    } else if (!(b->flags & B_DIRTY) && ide_wait(1) >= 0) {
+        // Read data if needed.
+        insl(0x1f0, b->data, b->size / 4);
     }
 
-    // Wake process waiting for this buf.
-    b->flags |= B_VALID;
-    b->flags &= ~B_DIRTY;
-    wakeup(b);
+    // Wake the processes waiting for the bufs the command covered.
+    for (u32 i = 0; i < ide_active; i++) {
+        b        = idequeue;
+        idequeue = b->qnext;
+        b->flags |= B_VALID;
+        b->flags &= ~B_DIRTY;
+        wakeup(b);
+    }
 
     // Start disk on next buf in queue.
     if (idequeue != nullptr) {
@@ -210,6 +368,37 @@ void ideintr(void)
     release(&idelock);
 }
 
+/** @brief Whether disk_rw_direct can be used. */
+bool disk_direct_ready(void)
+{
+    return virtio_blk_ready() || ahci_port_ready();
+}
+
+/**
+ * @brief Transfer sectors straight between the disk and physical memory.
+ *
+ * The buffer cache is not involved; callers keep it coherent. Only
+ * virtio-blk and AHCI take requests that are not buffers. The legacy
+ * controller's queue and interrupt handler deal only in struct buf, so
+ * it reports -ENOTSUP and callers fall back to buffered I/O.
+ *
+ * @param lba First sector.
+ * @param segs Memory the sectors go to or come from, in order.
+ * @param nsegs Number of segments, at most DISK_SEG_MAX.
+ * @param write Write to the disk instead of reading from it.
+ * @return ALL_OK, or a negative status code.
+ */
+int disk_rw_direct(u64 lba, const struct disk_seg *segs, u32 nsegs, bool write)
+{
+    if (virtio_blk_ready()) {
+        return virtio_blk_rw_sg(lba, segs, nsegs, write);
+    }
+    if (!ahci_port_ready()) {
+        return -ENOTSUP;
+    }
+    return ahci_rw_sg(lba, segs, nsegs, write);
+}
+
 /**
  * @brief Synchronize a buffer with disk, reading or writing as required.
  *
@@ -222,8 +411,13 @@ void iderw(struct buf *b)
     ASSERT(holdingsleep(&b->lock), "iderw: buf not locked");
     ASSERT((b->flags & (B_VALID | B_DIRTY)) != B_VALID, "iderw: nothing to do");
 
+    if (virtio_blk_ready()) {
+        virtio_blk_rw(b);
+        return;
+    }
+
     if (ahci_port_ready()) {
-        const u32 sectors_per_block = SECTOR_PER_BLOCK;
+        const u32 sectors_per_block = b->size / SECTOR_SIZE;
         const u64 lba               = (u64)b->blockno * sectors_per_block;
         const u32 sector_count      = sectors_per_block;
 
@@ -4,14 +4,19 @@
 #include <traps.h>
 #include <framebuffer.h>
 #include <defs.h>
+#include <fcntl.h>
 #include <file.h>
+#include <poll.h>
+#include <status.h>
 #include <string.h>
+#include <waitqueue.h>
 
 static struct ps2_mouse mouse_device = {};
 static struct ps2_mouse_packet mouse_buffer[32];
 static int mouse_buf_head = 0;
 static int mouse_buf_tail = 0;
 struct spinlock mouse_lock;
+static struct wait_queue mouse_wait_queue;
 
 /**
  * @brief Wait for the PS/2 controller to become ready for read or write.
@@ -99,12 +104,17 @@ static bool mouse_buffer_pop(struct ps2_mouse_packet *pkt)
     return true;
 }
 
-int mouse_read(struct inode *ip, char *dst, int n, [[maybe_unused]] u32 offset)
+int mouse_read(struct inode *ip, char *dst, int n, [[maybe_unused]] u32 offset, int flags)
 {
     ip->iops->iunlock(ip);
     acquire(&mouse_lock);
 
     while (mouse_buffer_empty()) {
+        if (flags & O_NONBLOCK) {
+            release(&mouse_lock);
+            ip->iops->ilock(ip);
+            return -EAGAIN;
+        }
         sleep(&mouse_device, &mouse_lock);
     }
 
@@ -119,6 +129,17 @@ int mouse_read(struct inode *ip, char *dst, int n, [[maybe_unused]] u32 offset)
     return bytes;
 }
 
+/** @brief Report whether a mouse packet is waiting to be read. */
+int mouse_poll([[maybe_unused]] struct inode *ip, struct poll_table *pt)
+{
+    poll_wait(pt, &mouse_wait_queue);
+
+    acquire(&mouse_lock);
+    const int mask = mouse_buffer_empty() ? 0 : POLLIN;
+    release(&mouse_lock);
+    return mask;
+}
+
 
 /**
  * @brief Interrupt handler for PS/2 mouse packets.
@@ -182,6 +203,7 @@ void mouse_handler([[maybe_unused]] struct trapframe *frame)
             acquire(&mouse_lock);
             mouse_buffer_push(mouse_device.packet);
             wakeup(&mouse_device);
+            wait_queue_wake(&mouse_wait_queue);
             release(&mouse_lock);
 
             mouse_device.cycle = 0;
@@ -204,6 +226,7 @@ void mouse_handler([[maybe_unused]] struct trapframe *frame)
 void mouse_init()
 {
     initlock(&mouse_lock, "mouse");
+    wait_queue_init(&mouse_wait_queue);
     mouse_buf_head = mouse_buf_tail = 0;
 
     mouse_wait(1);
@@ -234,6 +257,7 @@ void mouse_init()
 
     devsw[MOUSE_MAJOR].read  = mouse_read;
     devsw[MOUSE_MAJOR].write = nullptr;
+    devsw[MOUSE_MAJOR].poll  = mouse_poll;
 }
 
 // Function to get current mouse position and status
@@ -5,6 +5,7 @@
 #include "defs.h"
 #include "termcolors.h"
 #include "e1000.h"
+#include "virtio.h"
 
 // https://wiki.osdev.org/PCI
 
@@ -144,6 +145,7 @@ struct pci_vendor vendors[] = {
 struct pci_driver pci_drivers[] = {
     {.class = 0x01, .subclass = 0x01, .vendor_id = PCI_ANY_ID, .device_id = PCI_ANY_ID, .init = &ide_pci_init},
     {.class = 0x01, .subclass = 0x06, .vendor_id = PCI_ANY_ID, .device_id = PCI_ANY_ID, .init = &ahci_init},
+    {.class = 0x01, .subclass = 0x00, .vendor_id = VIRTIO_VENDOR, .device_id = VIRTIO_BLK_DEV, .init = &virtio_blk_init},
     {.class = 0x02, .subclass = 0x00, .vendor_id = INTEL_VEND, .device_id = E1000_DEV, .init = &e1000_init},
     {.class = 0x02, .subclass = 0x00, .vendor_id = INTEL_VEND, .device_id = E1000_I217, .init = &e1000_init},
     {.class = 0x02, .subclass = 0x00, .vendor_id = INTEL_VEND, .device_id = E1000_82577LM, .init = &e1000_init},
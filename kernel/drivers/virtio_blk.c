@@ -0,0 +1,258 @@
+// virtio-blk driver for the legacy PCI interface.
+//
+// One split virtqueue carries every request. A request is a chain of
+// descriptors: the request header, one descriptor per piece of data and
+// the status byte the device fills in. Any number of requests can be
+// outstanding at once, limited only by free descriptors; each waiter
+// sleeps on its own request until the interrupt handler sees it in the
+// used ring.
+
+#include "assert.h"
+#include "buf.h"
+#include "defs.h"
+#include "io.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "status.h"
+#include "string.h"
+#include "traps.h"
+#include "virtio.h"
+
+/** @brief Largest queue the ring memory has room for; QEMU offers 256. */
+#define VIRTIO_BLK_QMAX 256
+
+/** @brief State of one request, indexed by the head of its descriptor chain. */
+struct virtio_blk_req
+{
+    struct virtio_blk_req_hdr hdr;
+    u8 status; // written by the device
+    bool done; // seen in the used ring
+};
+
+/** @brief Driver state; protected by lock. */
+static struct
+{
+    struct spinlock lock;
+    u16 iobase;
+    u16 num; // queue size chosen by the device
+    struct vring_desc *desc;
+    struct vring_avail *avail;
+    volatile struct vring_used *used;
+    bool free[VIRTIO_BLK_QMAX]; // descriptor is not part of a request
+    u32 nfree;
+    u16 used_idx; // next used ring entry to look at
+    bool ready;
+    struct virtio_blk_req reqs[VIRTIO_BLK_QMAX];
+} vblk;
+
+// Legacy devices need the whole queue physically contiguous; the kernel
+// image is, so the ring lives here rather than in allocated pages.
+static u8 vring_mem[VRING_SIZE(VIRTIO_BLK_QMAX)] __attribute__((aligned(PGSIZE)));
+
+static void virtio_blk_interrupt(struct trapframe *tf);
+
+/**
+ * @brief Probe a virtio-blk device and set up its request queue.
+ *
+ * @param device PCI device descriptor for the controller.
+ */
+void virtio_blk_init(struct pci_device device)
+{
+    const u32 bar0 = device.header.bars[0];
+    if ((bar0 & 0x1) != PCI_BAR_IO) {
+        boot_message(WARNING_LEVEL_ERROR, "virtio-blk: no legacy I/O BAR");
+        return;
+    }
+    vblk.iobase = (u16)(bar0 & ~0x3);
+    pci_enable_bus_mastering(device);
+
+    outb(vblk.iobase + VIRTIO_PCI_STATUS, 0); // reset
+    outb(vblk.iobase + VIRTIO_PCI_STATUS, VIRTIO_STATUS_ACKNOWLEDGE);
+    outb(vblk.iobase + VIRTIO_PCI_STATUS, VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER);
+    // No optional features are needed.
+    outl(vblk.iobase + VIRTIO_PCI_GUEST_FEATURES, 0);
+
+    outw(vblk.iobase + VIRTIO_PCI_QUEUE_SEL, 0);
+    vblk.num = inw(vblk.iobase + VIRTIO_PCI_QUEUE_NUM);
+    if (vblk.num == 0 || vblk.num > VIRTIO_BLK_QMAX) {
+        boot_message(WARNING_LEVEL_ERROR, "virtio-blk: unsupported queue size %u", vblk.num);
+        outb(vblk.iobase + VIRTIO_PCI_STATUS, VIRTIO_STATUS_FAILED);
+        return;
+    }
+
+    const u32 used_off = (16 * vblk.num + 6 + 2 * vblk.num + VIRTIO_PCI_VRING_ALIGN - 1) &
+                         ~(VIRTIO_PCI_VRING_ALIGN - 1);
+    memset(vring_mem, 0, sizeof(vring_mem));
+    vblk.desc  = (struct vring_desc *)vring_mem;
+    vblk.avail = (struct vring_avail *)(vring_mem + 16 * vblk.num);
+    vblk.used  = (volatile struct vring_used *)(vring_mem + used_off);
+    for (u32 i = 0; i < vblk.num; i++) {
+        vblk.free[i] = true;
+    }
+    vblk.nfree = vblk.num;
+    outl(vblk.iobase + VIRTIO_PCI_QUEUE_PFN, V2P(vring_mem) / VIRTIO_PCI_VRING_ALIGN);
+
+    initlock(&vblk.lock, "virtio-blk");
+    idt_register_interrupt_callback(T_IRQ0 + device.header.irq, virtio_blk_interrupt);
+    enable_ioapic_interrupt(device.header.irq, 0);
+
+    outb(vblk.iobase + VIRTIO_PCI_STATUS,
+         VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER | VIRTIO_STATUS_DRIVER_OK);
+
+    const u64 capacity = inl(vblk.iobase + VIRTIO_PCI_CONFIG) |
+                         ((u64)inl(vblk.iobase + VIRTIO_PCI_CONFIG + 4) << 32);
+    boot_message(WARNING_LEVEL_INFO,
+                 "virtio-blk: %lu MiB, queue of %u",
+                 (unsigned long)(capacity * VIRTIO_BLK_SECTOR_SIZE / (1024 * 1024)),
+                 vblk.num);
+    vblk.ready = true;
+}
+
+/** @brief Whether a virtio-blk disk was found and set up. */
+bool virtio_blk_ready(void)
+{
+    return vblk.ready;
+}
+
+// Take a free descriptor. Caller holds vblk.lock and made sure one is free.
+static u16 virtio_blk_alloc_desc(void)
+{
+    for (u16 i = 0; i < vblk.num; i++) {
+        if (vblk.free[i]) {
+            vblk.free[i] = false;
+            vblk.nfree--;
+            return i;
+        }
+    }
+    panic("virtio_blk_alloc_desc");
+}
+
+// Free the descriptor chain starting at head and wake anyone waiting
+// for descriptors.
+static void virtio_blk_free_chain(u16 head)
+{
+    for (u16 i = head;;) {
+        const u16 flags = vblk.desc[i].flags;
+        const u16 next  = vblk.desc[i].next;
+        vblk.free[i]    = true;
+        vblk.nfree++;
+        if (!(flags & VRING_DESC_F_NEXT)) {
+            break;
+        }
+        i = next;
+    }
+    wakeup(&vblk.nfree);
+}
+
+// Put one request on the queue and sleep until the device finishes it.
+static int virtio_blk_transfer(u64 sector, const struct disk_seg *segs, u32 nsegs, bool write)
+{
+    acquire(&vblk.lock);
+    while (vblk.nfree < nsegs + 2) {
+        sleep(&vblk.nfree, &vblk.lock);
+    }
+
+    const u16 head             = virtio_blk_alloc_desc();
+    struct virtio_blk_req *req = &vblk.reqs[head];
+    req->hdr.type              = write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+    req->hdr.reserved          = 0;
+    req->hdr.sector            = sector;
+    req->status                = 0xff;
+    req->done                  = false;
+    vblk.desc[head].addr       = V2P(&req->hdr);
+    vblk.desc[head].len        = sizeof(req->hdr);
+    vblk.desc[head].flags      = VRING_DESC_F_NEXT;
+
+    u16 prev = head;
+    for (u32 i = 0; i < nsegs; i++) {
+        const u16 d          = virtio_blk_alloc_desc();
+        vblk.desc[prev].next = d;
+        vblk.desc[d].addr    = segs[i].phys;
+        vblk.desc[d].len     = segs[i].len;
+        vblk.desc[d].flags   = VRING_DESC_F_NEXT | (write ? 0 : VRING_DESC_F_WRITE);
+        prev                 = d;
+    }
+    const u16 st         = virtio_blk_alloc_desc();
+    vblk.desc[prev].next = st;
+    vblk.desc[st].addr   = V2P(&req->status);
+    vblk.desc[st].len    = 1;
+    vblk.desc[st].flags  = VRING_DESC_F_WRITE;
+    vblk.desc[st].next   = 0;
+
+    vblk.avail->ring[vblk.avail->idx % vblk.num] = head;
+    __sync_synchronize();
+    vblk.avail->idx++;
+    __sync_synchronize();
+    outw(vblk.iobase + VIRTIO_PCI_QUEUE_NOTIFY, 0);
+
+    while (!req->done) {
+        sleep(req, &vblk.lock);
+    }
+    const u8 status = req->status;
+    virtio_blk_free_chain(head);
+    release(&vblk.lock);
+
+    return status == VIRTIO_BLK_S_OK ? ALL_OK : -EIO;
+}
+
+/**
+ * @brief Read or write one buffer, as iderw does.
+ *
+ * @param b Locked buffer; written if B_DIRTY is set, read otherwise.
+ */
+void virtio_blk_rw(struct buf *b)
+{
+    const struct disk_seg seg = {.phys = V2P(b->data), .len = b->size};
+    const bool write          = b->flags & B_DIRTY;
+    const u64 sector          = (u64)b->blockno * (b->size / VIRTIO_BLK_SECTOR_SIZE);
+
+    const int rc = virtio_blk_transfer(sector, &seg, 1, write);
+    if (rc != ALL_OK) {
+        panic("virtio-blk %s failed for block %u: %s", write ? "write" : "read", b->blockno, strerror(rc));
+    }
+    b->flags |= B_VALID;
+    b->flags &= ~B_DIRTY;
+}
+
+/**
+ * @brief Transfer sectors between the disk and scattered physical memory.
+ *
+ * The whole transfer is one request with a descriptor per segment.
+ *
+ * @return ALL_OK, -EINVARG for an empty, oversized or misaligned list, or -EIO.
+ */
+int virtio_blk_rw_sg(u64 lba, const struct disk_seg *segs, u32 nsegs, bool write)
+{
+    if (segs == nullptr || nsegs == 0 || nsegs > DISK_SEG_MAX || nsegs + 2 > vblk.num) {
+        return -EINVARG;
+    }
+    for (u32 i = 0; i < nsegs; i++) {
+        if (segs[i].len == 0 || segs[i].len % VIRTIO_BLK_SECTOR_SIZE != 0) {
+            return -EINVARG;
+        }
+    }
+    if (!vblk.ready) {
+        return -ENOTSUP;
+    }
+    return virtio_blk_transfer(lba, segs, nsegs, write);
+}
+
+// Mark every request the device has finished as done and wake its waiter.
+static void virtio_blk_interrupt([[maybe_unused]] struct trapframe *tf)
+{
+    acquire(&vblk.lock);
+    // Reading the ISR acknowledges the interrupt.
+    inb(vblk.iobase + VIRTIO_PCI_ISR);
+    while (vblk.used_idx != vblk.used->idx) {
+        __sync_synchronize();
+        const u32 id = vblk.used->ring[vblk.used_idx % vblk.num].id;
+        ASSERT(id < vblk.num, "virtio_blk_interrupt: bad id");
+        vblk.reqs[id].done = true;
+        wakeup(&vblk.reqs[id]);
+        vblk.used_idx++;
+    }
+    release(&vblk.lock);
+    lapic_ack_interrupt();
+}
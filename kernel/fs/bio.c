@@ -13,6 +13,9 @@
 // * Only one process at a time can use a buffer,
 //     so do not keep them longer than necessary.
 //
+// Each device has its own block size, BSIZE until a file system sets it
+// with bio_set_block_size(). Every buffer has room for BSIZE_MAX bytes.
+//
 // The implementation uses two state flags internally:
 // * B_VALID: the buffer data has been read from the disk.
 // * B_DIRTY: the buffer data has been modified
@@ -24,6 +27,7 @@
 #include "param.h"
 #include "spinlock.h"
 #include "buf.h"
+#include "mmu.h"
 
 /**
  * @brief Global buffer cache containing disk block replicas.
@@ -36,8 +40,14 @@ struct
     // Linked list of all buffers, through prev/next.
     // head.next is most recently used.
     struct buf head;
+
+    u32 block_size[NDEV];
 } bcache;
 
+// Page aligned so a buffer never straddles a page, which keeps it
+// physically contiguous for DMA.
+static u8 buffer_data[NBUF][BSIZE_MAX] __attribute__((aligned(PGSIZE)));
+
 /**
  * @brief Initialize the buffer cache structures and MRU list.
  */
@@ -46,9 +56,14 @@ void buffer_cache_init(void)
     initlock(&bcache.lock, "bcache");
 
     // Create a linked list of buffers
+    for (int i = 0; i < NDEV; i++) {
+        bcache.block_size[i] = BSIZE;
+    }
+
     bcache.head.prev = &bcache.head;
     bcache.head.next = &bcache.head;
     for (struct buf *b = bcache.buf; b < bcache.buf + NBUF; b++) {
+        b->data = buffer_data[b - bcache.buf];
         b->next = bcache.head.next;
         b->prev = &bcache.head;
         initsleeplock(&b->lock, "buffer");
@@ -85,6 +100,7 @@ static struct buf *bget(u32 dev, u32 blockno)
         if (b->refcnt == 0 && (b->flags & B_DIRTY) == 0) {
             b->dev     = dev;
             b->blockno = blockno;
+            b->size    = bcache.block_size[dev];
             b->flags   = 0;
             b->refcnt  = 1;
             release(&bcache.lock);
@@ -95,6 +111,28 @@ static struct buf *bget(u32 dev, u32 blockno)
     panic("bget: no buffers");
 }
 
+/**
+ * @brief Change the block size used for dev.
+ *
+ * Block numbers for dev are interpreted in units of the new size from now
+ * on, so every cached buffer of dev is dropped. No buffer of dev may be in use.
+ */
+void bio_set_block_size(u32 dev, u32 size)
+{
+    ASSERT(dev < NDEV && size >= 512 && size <= BSIZE_MAX && size % 512 == 0, "bio_set_block_size");
+
+    acquire(&bcache.lock);
+    for (struct buf *b = bcache.head.next; b != &bcache.head; b = b->next) {
+        if (b->dev == dev) {
+            ASSERT(b->refcnt == 0, "bio_set_block_size: buffer in use");
+            b->dev   = (u32)-1;
+            b->flags = 0;
+        }
+    }
+    bcache.block_size[dev] = size;
+    release(&bcache.lock);
+}
+
 /** @brief Return a locked buffer filled with the requested block. */
 struct buf *bread(u32 dev, u32 blockno)
 {
@@ -105,6 +143,45 @@ struct buf *bread(u32 dev, u32 blockno)
     return b;
 }
 
+/**
+ * @brief Return a locked buffer for a block the caller will overwrite whole.
+ *
+ * Unlike bread, a block that is not cached is not read from the disk, so
+ * the buffer holds garbage until the caller fills it and calls bwrite.
+ */
+struct buf *bgetblk(u32 dev, u32 blockno)
+{
+    return bget(dev, blockno);
+}
+
+/**
+ * @brief Drop the cached contents of a block written behind the cache's back.
+ *
+ * Used after a direct transfer wrote blockno, so that the next bread
+ * goes back to the disk. A block that is not cached is left alone.
+ */
+void bforget(u32 dev, u32 blockno)
+{
+    struct buf *b;
+
+    acquire(&bcache.lock);
+    for (b = bcache.head.next; b != &bcache.head; b = b->next) {
+        if (b->dev == dev && b->blockno == blockno) {
+            break;
+        }
+    }
+    if (b == &bcache.head) {
+        release(&bcache.lock);
+        return;
+    }
+    b->refcnt++;
+    release(&bcache.lock);
+
+    acquiresleep(&b->lock);
+    b->flags &= ~B_VALID;
+    brelse(b);
+}
+
 /** @brief Write a locked buffer's contents to disk via the IDE layer. */
 void bwrite(struct buf *b)
 {
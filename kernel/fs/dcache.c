@@ -0,0 +1,168 @@
+// Directory entry cache.
+//
+// The dentry cache remembers the result of looking up a name in a
+// directory, keyed by (dev, parent inode number, name). Path resolution
+// in namex() consults it before scanning the directory, so resolving a
+// hot path like /bin/sh is a handful of hash lookups.
+//
+// Negative entries (inum 0) record names that do not exist, which keeps
+// repeated failed lookups, such as searching for a command, off the disk.
+//
+// Entries are added by namex() after a directory scan, by create() and
+// sys_link() after dirlink, and turned negative by sys_unlink(). Callers
+// hold the parent directory's lock while they look up or change an entry,
+// so the cache always agrees with the directory contents. When a
+// directory is removed, dcache_purge() drops everything cached under it.
+//
+// The cache holds NDENTRY entries and recycles the least recently used.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "spinlock.h"
+#include "string.h"
+#include "dcache.h"
+
+#define DCACHE_BUCKETS 128
+
+/**
+ * @brief Global dentry cache state.
+ */
+struct
+{
+    struct spinlock lock;
+    struct dentry entries[NDENTRY];
+    struct dentry *hash[DCACHE_BUCKETS];
+
+    // Linked list of all entries, through prev/next.
+    // head.next is most recently used.
+    struct dentry head;
+} dcache;
+
+/** @brief Initialize the dentry cache and its LRU list. */
+void dcache_init(void)
+{
+    initlock(&dcache.lock, "dcache");
+
+    dcache.head.prev = &dcache.head;
+    dcache.head.next = &dcache.head;
+    for (struct dentry *d = dcache.entries; d < dcache.entries + NDENTRY; d++) {
+        d->next                = dcache.head.next;
+        d->prev                = &dcache.head;
+        dcache.head.next->prev = d;
+        dcache.head.next       = d;
+    }
+}
+
+static u32 dcache_hash(u32 dev, u32 parent, const char *name, u32 len)
+{
+    u32 h = 2166136261u ^ dev ^ (parent * 16777619u);
+    for (u32 i = 0; i < len; i++) {
+        h = (h ^ (u8)name[i]) * 16777619u;
+    }
+    return h % DCACHE_BUCKETS;
+}
+
+static struct dentry *dcache_find(u32 dev, u32 parent, const char *name, u32 len)
+{
+    for (struct dentry *d = dcache.hash[dcache_hash(dev, parent, name, len)]; d != nullptr; d = d->hash_next) {
+        if (d->dev == dev && d->parent == parent && d->name_len == len && memcmp(d->name, name, len) == 0) {
+            return d;
+        }
+    }
+    return nullptr;
+}
+
+static void dcache_unhash(struct dentry *d)
+{
+    struct dentry **pp = &dcache.hash[dcache_hash(d->dev, d->parent, d->name, d->name_len)];
+    while (*pp != d) {
+        pp = &(*pp)->hash_next;
+    }
+    *pp          = d->hash_next;
+    d->hash_next = nullptr;
+    d->name_len  = 0;
+}
+
+static void dcache_touch(struct dentry *d)
+{
+    d->next->prev          = d->prev;
+    d->prev->next          = d->next;
+    d->next                = dcache.head.next;
+    d->prev                = &dcache.head;
+    dcache.head.next->prev = d;
+    dcache.head.next       = d;
+}
+
+/**
+ * @brief Look up a name in the cache.
+ *
+ * @param inum Receives the cached inode number; 0 means the name does not exist.
+ * @return true on a hit, false if the directory must be searched.
+ */
+bool dcache_lookup(u32 dev, u32 parent, const char *name, u32 *inum)
+{
+    const u32 len = strlen(name);
+    if (len == 0 || len > DCACHE_NAME_LEN) {
+        return false;
+    }
+
+    acquire(&dcache.lock);
+    struct dentry *d = dcache_find(dev, parent, name, len);
+    if (d != nullptr) {
+        *inum = d->inum;
+        dcache_touch(d);
+    }
+    release(&dcache.lock);
+    return d != nullptr;
+}
+
+/**
+ * @brief Record that name in directory parent refers to inum (0 if absent).
+ */
+void dcache_enter(u32 dev, u32 parent, const char *name, u32 inum)
+{
+    const u32 len = strlen(name);
+    if (len == 0 || len > DCACHE_NAME_LEN) {
+        return;
+    }
+
+    acquire(&dcache.lock);
+    struct dentry *d = dcache_find(dev, parent, name, len);
+    if (d == nullptr) {
+        // Recycle the least recently used entry.
+        d = dcache.head.prev;
+        if (d->name_len != 0) {
+            dcache_unhash(d);
+        }
+        d->dev      = dev;
+        d->parent   = parent;
+        d->name_len = len;
+        memmove(d->name, name, len);
+        d->name[len] = '\0';
+
+        const u32 h    = dcache_hash(dev, parent, name, len);
+        d->hash_next   = dcache.hash[h];
+        dcache.hash[h] = d;
+    }
+    d->inum = inum;
+    dcache_touch(d);
+    release(&dcache.lock);
+}
+
+/**
+ * @brief Drop every entry cached under directory parent.
+ *
+ * Called when a directory is removed so a directory that later reuses
+ * its inode number starts with nothing cached.
+ */
+void dcache_purge(u32 dev, u32 parent)
+{
+    acquire(&dcache.lock);
+    for (struct dentry *d = dcache.entries; d < dcache.entries + NDENTRY; d++) {
+        if (d->name_len != 0 && d->dev == dev && d->parent == parent) {
+            dcache_unhash(d);
+        }
+    }
+    release(&dcache.lock);
+}
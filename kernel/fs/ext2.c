@@ -10,14 +10,26 @@
 #include "file.h"
 #include "icache.h"
 #include "mbr.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "dirent.h"
+#include "pagecache.h"
+#include "proc.h"
+#include "slab.h"
+#include "status.h"
 #include <devtab.h>
 
 struct inode_operations ext2fs_inode_ops = {
+    ext2fs_direct_io,
     ext2fs_dirlink,
     ext2fs_dirlookup,
+    ext2fs_fsync,
+    ext2fs_getdents,
+    ext2fs_getpage,
     ext2fs_ialloc,
     ext2fs_iinit,
     ext2fs_ilock,
+    ext2fs_ilock_shared,
     ext2fs_iput,
     ext2fs_iunlock,
     ext2fs_iunlockput,
@@ -30,152 +42,508 @@ struct inode_operations ext2fs_inode_ops = {
 #define min(a,b) ((a) < (b) ? (a) : (b))
 
 static void ext2fs_bzero(int dev, int bno);
-static u32 ext2fs_balloc(u32 dev, u32 inum);
-static void ext2fs_bfree(int dev, u32 b);
-static u32 ext2fs_bmap(struct inode *ip, u32 bn);
+static u32 ext2fs_balloc(struct inode *ip, bool zero);
+static u32 ext2fs_bmap(struct inode *ip, u32 bn, bool alloc);
 static void ext2fs_itrunc(struct inode *ip);
-struct ext2fs_addrs ext2fs_addrs[NINODE];
+static void ext2fs_extent_clear(struct ext2fs_addrs *ad);
+static void ext2fs_writeback(void);
 struct ext2_super_block ext2_sb;
 u32 first_partition_block = 0;
+u32 ext2_block_size       = EXT2_MIN_BSIZE;
 extern struct mbr mbr;
 
+/**
+ * @brief In-core copy of one block group descriptor.
+ *
+ * The whole descriptor table is read once at mount time. Allocation and
+ * freeing update the cached free counts and mark the group dirty; dirty
+ * descriptors are written back by ext2fs_sync_super(), which the
+ * writeback process, fsync and shutdown call.
+ */
+struct ext2_group_info
+{
+    struct ext2_group_desc desc;
+    struct sleeplock lock; // protects desc, dirty and the group's bitmaps
+    bool dirty;
+};
+
+static struct kmem_cache ext2fs_addrs_cache;
+static struct ext2_group_info *ext2_groups;
+static u32 ext2_group_count;
+static struct spinlock ext2_sb_lock; // protects the superblock free counts
+static bool ext2_sb_dirty;
+static u32 ext2_dev; // device the volume is on
+
+// Read the superblock. Called before the block size is known, so the
+// device still uses EXT2_MIN_BSIZE blocks.
 void ext2fs_readsb(int dev, struct ext2_super_block *sb)
 {
-    first_partition_block = (mbr.part[0].lba_start / 2);
+    first_partition_block = mbr.part[0].lba_start / (EXT2_MIN_BSIZE / 512);
     const u32 sb_blockno  = first_partition_block + 1; // superblock is at offset 1024 bytes
     struct buf *bp        = bread(dev, sb_blockno);
     memmove(sb, bp->data, sizeof(*sb));
     brelse(bp);
 }
 
+// The group descriptor table starts in the block after the superblock.
+static u32 ext2fs_gdt_block(void)
+{
+    return ext2_sb.s_first_data_block + 1 + first_partition_block;
+}
+
+// Read the group descriptor table into ext2_groups.
+static void ext2fs_load_groups(int dev)
+{
+    constexpr u32 desc_size = sizeof(struct ext2_group_desc);
+    const u32 per_block     = EXT2_BSIZE / desc_size;
+
+    ext2_group_count = (ext2_sb.s_blocks_count - ext2_sb.s_first_data_block + ext2_sb.s_blocks_per_group - 1) /
+        ext2_sb.s_blocks_per_group;
+
+    ext2_groups = kzalloc(ext2_group_count * sizeof(*ext2_groups));
+    if (ext2_groups == nullptr) {
+        panic("ext2fs_load_groups: out of memory");
+    }
+
+    struct buf *bp = nullptr;
+    for (u32 g = 0; g < ext2_group_count; g++) {
+        if (g % per_block == 0) {
+            if (bp != nullptr) {
+                brelse(bp);
+            }
+            bp = bread(dev, ext2fs_gdt_block() + g / per_block);
+        }
+        memmove(&ext2_groups[g].desc, bp->data + (g % per_block) * desc_size, desc_size);
+        initsleeplock(&ext2_groups[g].lock, "ext2 group");
+    }
+    if (bp != nullptr) {
+        brelse(bp);
+    }
+}
+
+/**
+ * @brief Write dirty group descriptors and the superblock free counts.
+ *
+ * Descriptors that share a table block are written with one bwrite.
+ */
+void ext2fs_sync_super(int dev)
+{
+    constexpr u32 desc_size = sizeof(struct ext2_group_desc);
+    const u32 per_block     = EXT2_BSIZE / desc_size;
+
+    for (u32 first = 0; first < ext2_group_count; first += per_block) {
+        const u32 last = min(first + per_block, ext2_group_count);
+        struct buf *bp = nullptr;
+        for (u32 g = first; g < last; g++) {
+            struct ext2_group_info *gi = &ext2_groups[g];
+            acquiresleep(&gi->lock);
+            if (gi->dirty) {
+                if (bp == nullptr) {
+                    bp = bread(dev, ext2fs_gdt_block() + first / per_block);
+                }
+                memmove(bp->data + (g - first) * desc_size, &gi->desc, desc_size);
+                gi->dirty = false;
+            }
+            releasesleep(&gi->lock);
+        }
+        if (bp != nullptr) {
+            bwrite(bp);
+            brelse(bp);
+        }
+    }
+
+    acquire(&ext2_sb_lock);
+    const bool dirty      = ext2_sb_dirty;
+    const u32 free_blocks = ext2_sb.s_free_blocks_count;
+    const u32 free_inodes = ext2_sb.s_free_inodes_count;
+    ext2_sb_dirty         = false;
+    release(&ext2_sb_lock);
+    if (!dirty) {
+        return;
+    }
+
+    // The superblock is 1024 bytes into the partition, whatever the block size.
+    struct buf *bp          = bread(dev, first_partition_block + EXT2_MIN_BSIZE / EXT2_BSIZE);
+    auto sb                 = (struct ext2_super_block *)(bp->data + EXT2_MIN_BSIZE % EXT2_BSIZE);
+    sb->s_free_blocks_count = free_blocks;
+    sb->s_free_inodes_count = free_inodes;
+    bwrite(bp);
+    brelse(bp);
+}
+
+// Account for blocks taken from or returned to group gno.
+// Caller holds the group lock.
+static void ext2fs_count_blocks(u32 gno, int delta)
+{
+    ext2_groups[gno].desc.bg_free_blocks_count += delta;
+    ext2_groups[gno].dirty = true;
+
+    acquire(&ext2_sb_lock);
+    ext2_sb.s_free_blocks_count += delta;
+    ext2_sb_dirty = true;
+    release(&ext2_sb_lock);
+}
+
+// Account for inodes taken from or returned to group gno.
+// Caller holds the group lock.
+static void ext2fs_count_inodes(u32 gno, int delta, int dirs_delta)
+{
+    ext2_groups[gno].desc.bg_free_inodes_count += delta;
+    ext2_groups[gno].desc.bg_used_dirs_count += dirs_delta;
+    ext2_groups[gno].dirty = true;
+
+    acquire(&ext2_sb_lock);
+    ext2_sb.s_free_inodes_count += delta;
+    ext2_sb_dirty = true;
+    release(&ext2_sb_lock);
+}
+
+// Return the disk block holding inode inum and its slot within that block.
+static u32 ext2fs_inode_block(u32 inum, u32 *slot)
+{
+    const u32 per_block = EXT2_BSIZE / ext2_sb.s_inode_size;
+    const u32 gno       = GET_GROUP_NO(inum, ext2_sb);
+    const u32 ioff      = GET_INODE_INDEX(inum, ext2_sb);
+
+    *slot = ioff % per_block;
+    return ext2_groups[gno].desc.bg_inode_table + ioff / per_block + first_partition_block;
+}
+
 // Zero a block.
 static void ext2fs_bzero(int dev, int bno)
 {
-    struct buf *bp = bread(dev, bno);
-    memset(bp->data, 0, BSIZE);
+    struct buf *bp = bgetblk(dev, bno);
+    memset(bp->data, 0, EXT2_BSIZE);
     bwrite(bp);
     brelse(bp);
 }
 
-// check if a block is free and return its bit number
-static u32 ext2fs_get_free_bit(char *bitmap, u32 nbits)
+// Return the first clear bit at or after start in a bitmap of nbits bits,
+// or (u32)-1 if there is none. The bitmap is scanned a word at a time and
+// bsf picks the bit out of the first word that is not all ones.
+static u32 ext2fs_find_zero_bit(const u32 *map, u32 nbits, u32 start)
 {
-    const u32 bytes = (nbits + 7) / 8;
-    for (u32 i = 0; i < bytes && i < EXT2_BSIZE; i++) {
-        for (u32 j = 0; j < 8; j++) {
-            u32 bit = i * 8 + j;
-            if (bit >= nbits)
-                break;
-            const u8 mask = (u8)(1U << j);
-            if ((bitmap[i] & mask) != 0)
-                continue;
-            bitmap[i] |= mask;
-            return bit;
+    if (start >= nbits) {
+        return (u32)-1;
+    }
+    const u32 nwords = (nbits + 31) / 32;
+    u32 w            = start / 32;
+    u32 word         = map[w] | ((1u << (start % 32)) - 1); // ignore bits below start
+    while (word == 0xFFFFFFFF) {
+        if (++w >= nwords) {
+            return (u32)-1;
         }
+        word = map[w];
     }
-    return (u32)-1;
+    const u32 bit = w * 32 + __builtin_ctz(~word);
+    return bit < nbits ? bit : (u32)-1;
 }
 
-// Allocate a zeroed disk block.
-static u32 ext2fs_balloc(u32 dev, u32 inum)
+static inline bool ext2fs_test_bit(const u32 *map, u32 bit)
 {
-    struct ext2_group_desc bgdesc;
-    u32 desc_blockno = first_partition_block + 2; // block group descriptor table starts at block 2
+    return (map[bit / 32] >> (bit % 32)) & 1;
+}
 
-    int gno         = GET_GROUP_NO(inum, ext2_sb);
-    struct buf *bp1 = bread(dev, desc_blockno);
-    memmove(&bgdesc, bp1->data + gno * sizeof(bgdesc), sizeof(bgdesc));
-    brelse(bp1);
-    struct buf *bp2 = bread(dev, bgdesc.bg_block_bitmap + first_partition_block);
+static inline void ext2fs_set_bit(u32 *map, u32 bit)
+{
+    map[bit / 32] |= 1u << (bit % 32);
+}
 
-    u32 fbit = ext2fs_get_free_bit((char *)bp2->data, ext2_sb.s_blocks_per_group);
-    if (fbit != (u32)-1) {
-        bwrite(bp2);
-        brelse(bp2);
+// Number of blocks in group gno; the last group may be short.
+static u32 ext2fs_group_blocks(u32 gno)
+{
+    const u32 first = gno * ext2_sb.s_blocks_per_group;
+    return min(ext2_sb.s_blocks_per_group, ext2_sb.s_blocks_count - ext2_sb.s_first_data_block - first);
+}
 
-        u32 group_first_block = ext2_sb.s_first_data_block + gno * ext2_sb.s_blocks_per_group;
-        u32 rel_block         = group_first_block + fbit;
-        ext2fs_bzero(dev, rel_block + first_partition_block);
-        return rel_block;
+// Mark block in use if it is still free.
+static bool ext2fs_take_block(int dev, u32 block)
+{
+    const u32 gno              = (block - ext2_sb.s_first_data_block) / ext2_sb.s_blocks_per_group;
+    const u32 bit              = (block - ext2_sb.s_first_data_block) % ext2_sb.s_blocks_per_group;
+    struct ext2_group_info *gi = &ext2_groups[gno];
+
+    acquiresleep(&gi->lock);
+    struct buf *bp = bread(dev, gi->desc.bg_block_bitmap + first_partition_block);
+    u32 *map       = (u32 *)bp->data;
+    const bool ok  = !ext2fs_test_bit(map, bit);
+    if (ok) {
+        ext2fs_set_bit(map, bit);
+        bwrite(bp);
+        ext2fs_count_blocks(gno, -1);
+    }
+    brelse(bp);
+    releasesleep(&gi->lock);
+    return ok;
+}
+
+// Allocate a disk block for ip, zeroed on disk if zero is set.
+//
+// Blocks come from the inode's preallocation window first. Otherwise the
+// search starts at the inode's goal, the block after the one it was last
+// given, so sequential writes land in sequential blocks, and moves on to
+// the following groups when that group is full. A regular file that gets
+// a fresh block also notes up to EXT2_PREALLOC_BLOCKS - 1 free blocks
+// right after it as its window for the next writes. The window lives in
+// the in-core inode only: its blocks stay free on disk until handed out,
+// so another file may take them first, and nothing leaks on a crash.
+//
+// Data blocks are allocated without zeroing: whoever maps one writes all
+// of it, so zeroing it first would only cost an extra disk write.
+static u32 ext2fs_balloc(struct inode *ip, bool zero)
+{
+    struct ext2fs_addrs *ad = (struct ext2fs_addrs *)ip->addrs;
+    u32 block;
+
+    if (ad->prealloc_count > 0) {
+        block = ad->prealloc_start++;
+        ad->prealloc_count--;
+        if (ext2fs_take_block(ip->dev, block)) {
+            ad->goal = block + 1;
+            if (zero) {
+                ext2fs_bzero(ip->dev, block + first_partition_block);
+            }
+            return block;
+        }
+        // Somebody else took it, and likely the rest of the window too.
+        ad->prealloc_count = 0;
+    }
+
+    u32 goal = ad->goal;
+    if (goal < ext2_sb.s_first_data_block || goal >= ext2_sb.s_blocks_count) {
+        goal = ext2_sb.s_first_data_block + GET_GROUP_NO(ip->inum, ext2_sb) * ext2_sb.s_blocks_per_group;
+    }
+    const u32 goal_group = (goal - ext2_sb.s_first_data_block) / ext2_sb.s_blocks_per_group;
+    const u32 goal_bit   = (goal - ext2_sb.s_first_data_block) % ext2_sb.s_blocks_per_group;
+
+    for (u32 i = 0; i < ext2_group_count; i++) {
+        const u32 gno              = (goal_group + i) % ext2_group_count;
+        struct ext2_group_info *gi = &ext2_groups[gno];
+        if (gi->desc.bg_free_blocks_count == 0) {
+            continue;
+        }
+
+        acquiresleep(&gi->lock);
+        const u32 nbits = ext2fs_group_blocks(gno);
+        struct buf *bp  = bread(ip->dev, gi->desc.bg_block_bitmap + first_partition_block);
+        u32 *map        = (u32 *)bp->data;
+        u32 bit         = ext2fs_find_zero_bit(map, nbits, gno == goal_group ? goal_bit : 0);
+        if (bit == (u32)-1 && gno == goal_group) {
+            bit = ext2fs_find_zero_bit(map, nbits, 0);
+        }
+        if (bit == (u32)-1) {
+            brelse(bp);
+            releasesleep(&gi->lock);
+            continue;
+        }
+
+        ext2fs_set_bit(map, bit);
+        u32 window = 0;
+        if (ip->type == T_FILE) {
+            while (window < EXT2_PREALLOC_BLOCKS - 1 && bit + 1 + window < nbits &&
+                   !ext2fs_test_bit(map, bit + 1 + window)) {
+                window++;
+            }
+        }
+        bwrite(bp);
+        brelse(bp);
+        ext2fs_count_blocks(gno, -1);
+        releasesleep(&gi->lock);
+
+        block              = ext2_sb.s_first_data_block + gno * ext2_sb.s_blocks_per_group + bit;
+        ad->goal           = block + 1;
+        ad->prealloc_start = block + 1;
+        ad->prealloc_count = window;
+        if (zero) {
+            ext2fs_bzero(ip->dev, block + first_partition_block);
+        }
+        return block;
     }
-    brelse(bp2);
     panic("ext2_balloc: out of blocks\n");
 }
 
-// Free a disk block.
-static void ext2fs_bfree(int dev, u32 b)
+// A run of len blocks to free starting at block start.
+struct ext2_free_run
+{
+    u32 start;
+    u32 len;
+};
+
+// Blocks collected by a truncate, freed together by ext2fs_free_flush.
+struct ext2fs_free_batch
 {
-    struct ext2_group_desc bgdesc;
-    u32 desc_blockno = first_partition_block + 2; // block group descriptor table starts at block 2
+    int dev;
+    u32 nruns;
+    struct ext2_free_run runs[EXT2_FREE_RUNS];
+};
 
+// Group that block b belongs to.
+static u32 ext2fs_block_group(u32 b)
+{
     if (b < ext2_sb.s_first_data_block) {
         panic("ext2fs_bfree: invalid block\n");
     }
+    return (b - ext2_sb.s_first_data_block) / ext2_sb.s_blocks_per_group;
+}
 
-    u32 block_index = b - ext2_sb.s_first_data_block;
-    u32 gno         = block_index / ext2_sb.s_blocks_per_group;
-    u32 offset      = block_index % ext2_sb.s_blocks_per_group;
-
-    struct buf *bp1 = bread(dev, desc_blockno);
-    memmove(&bgdesc, bp1->data + gno * sizeof(bgdesc), sizeof(bgdesc));
-    struct buf *bp2 = bread(dev, bgdesc.bg_block_bitmap + first_partition_block);
-    u32 byte_index  = offset / 8;
-    if (byte_index >= EXT2_BSIZE) {
+// Clear the bits of the len blocks starting at block b in the block
+// bitmap of their group. Caller holds the group lock.
+static void ext2fs_clear_block_bits(u8 *bitmap, u32 b, u32 len)
+{
+    const u32 first = (b - ext2_sb.s_first_data_block) % ext2_sb.s_blocks_per_group;
+    if ((first + len + 7) / 8 > EXT2_BSIZE) {
         panic("ext2fs_bfree: bitmap overflow\n");
     }
-    u8 mask = (u8)(1U << (offset % 8));
+    for (u32 bit = first; bit < first + len; bit++) {
+        u8 mask = (u8)(1U << (bit % 8));
+        if ((bitmap[bit / 8] & mask) == 0) {
+            panic("ext2fs_bfree: block already free\n");
+        }
+        bitmap[bit / 8] &= ~mask;
+    }
+}
 
-    if ((bp2->data[byte_index] & mask) == 0) {
-        panic("ext2fs_bfree: block already free\n");
+// Free every run collected in fb. Runs are sorted first, so each group
+// bitmap they touch is read, written and counted once.
+static void ext2fs_free_flush(struct ext2fs_free_batch *fb)
+{
+    for (u32 i = 1; i < fb->nruns; i++) {
+        const struct ext2_free_run run = fb->runs[i];
+        u32 j                          = i;
+        for (; j > 0 && fb->runs[j - 1].start > run.start; j--) {
+            fb->runs[j] = fb->runs[j - 1];
+        }
+        fb->runs[j] = run;
     }
-    bp2->data[byte_index] &= ~mask;
-    bwrite(bp2);
-    brelse(bp2);
-    brelse(bp1);
+
+    for (u32 i = 0; i < fb->nruns;) {
+        const u32 gno              = ext2fs_block_group(fb->runs[i].start);
+        struct ext2_group_info *gi = &ext2_groups[gno];
+
+        acquiresleep(&gi->lock);
+        struct buf *bp = bread(fb->dev, gi->desc.bg_block_bitmap + first_partition_block);
+        u32 freed      = 0;
+        for (; i < fb->nruns && ext2fs_block_group(fb->runs[i].start) == gno; i++) {
+            ext2fs_clear_block_bits(bp->data, fb->runs[i].start, fb->runs[i].len);
+            freed += fb->runs[i].len;
+        }
+        bwrite(bp);
+        brelse(bp);
+        ext2fs_count_blocks(gno, (int)freed);
+        releasesleep(&gi->lock);
+    }
+    fb->nruns = 0;
+}
+
+// Queue block b to be freed by the next ext2fs_free_flush. A block
+// that continues the last run within the same group just extends it.
+static void ext2fs_free_add(struct ext2fs_free_batch *fb, u32 b)
+{
+    if (fb->nruns > 0) {
+        struct ext2_free_run *last = &fb->runs[fb->nruns - 1];
+        if (last->start + last->len == b && ext2fs_block_group(last->start) == ext2fs_block_group(b)) {
+            last->len++;
+            return;
+        }
+    }
+    if (fb->nruns == EXT2_FREE_RUNS) {
+        ext2fs_free_flush(fb);
+    }
+    fb->runs[fb->nruns].start = b;
+    fb->runs[fb->nruns].len   = 1;
+    fb->nruns++;
+}
+
+// Forget ip's preallocation window. Its blocks were never marked in use,
+// so there is nothing to write.
+static void ext2fs_discard_prealloc(struct inode *ip)
+{
+    struct ext2fs_addrs *ad = (struct ext2fs_addrs *)ip->addrs;
+    ad->prealloc_start += ad->prealloc_count;
+    ad->prealloc_count = 0;
+}
+
+/** @brief Set up the cache ext2fs_addrs come from. Called before the first iget. */
+void ext2fs_addrs_cache_init(void)
+{
+    kmem_cache_init(&ext2fs_addrs_cache, "ext2 addrs", sizeof(struct ext2fs_addrs));
+}
+
+/** @brief Allocate the ext2 part of an in-core inode. */
+void *ext2fs_addrs_alloc(void)
+{
+    struct ext2fs_addrs *ad = kmem_cache_alloc(&ext2fs_addrs_cache);
+    if (ad != nullptr) {
+        initlock(&ad->extent_lock, "ext2 extents");
+    }
+    return ad;
+}
+
+void ext2fs_addrs_free(void *addrs)
+{
+    kmem_cache_free(&ext2fs_addrs_cache, addrs);
 }
 
 void ext2fs_iinit(int dev)
 {
     mbr_load();
     ext2fs_readsb(dev, &ext2_sb);
-    const u32 block_bytes   = 1024u << ext2_sb.s_log_block_size;
+    const u32 block_bytes = EXT2_MIN_BSIZE << ext2_sb.s_log_block_size;
+    const u32 sectors     = block_bytes / 512;
+    if (block_bytes > EXT2_MAX_BSIZE || mbr.part[0].lba_start % sectors != 0) {
+        panic("ext2fs_iinit: unsupported block size %u", block_bytes);
+    }
+    // From here on block numbers on dev count blocks of the volume's size.
+    ext2_block_size       = block_bytes;
+    first_partition_block = mbr.part[0].lba_start / sectors;
+    bio_set_block_size(dev, block_bytes);
+
+    initlock(&ext2_sb_lock, "ext2 sb");
+    ext2fs_load_groups(dev);
+    ext2_dev = dev;
+    if (kernel_proc_create("ext2 writeback", ext2fs_writeback) == nullptr) {
+        panic("ext2fs_iinit: no process for writeback");
+    }
+
     const u64 partition_mb  = ((u64)ext2_sb.s_blocks_count * block_bytes) / (1024ull * 1024ull);
     const u64 size_value    = (partition_mb >= 1024ull) ? partition_mb / 1024ull : partition_mb;
     const char *size_suffix = (partition_mb >= 1024ull) ? "GB" : "MB";
     boot_message(WARNING_LEVEL_INFO,
-                 "ext2: size: %llu %s, block_size: %u, block_count: %u, inodes: %u",
+                 "ext2: size: %llu %s, block_size: %u, block_count: %u, inodes: %u, groups: %u",
                  (unsigned long long)size_value,
                  size_suffix,
                  block_bytes,
                  ext2_sb.s_blocks_count,
-                 ext2_sb.s_inodes_count);
+                 ext2_sb.s_inodes_count,
+                 ext2_group_count);
 }
 
 struct inode *ext2fs_ialloc(u32 dev, short type)
 {
-    struct ext2_group_desc bgdesc;
-    u32 desc_blockno = first_partition_block + 2; // block group descriptor table starts at block 2
-
-    int bgcount = ext2_sb.s_blocks_count / ext2_sb.s_blocks_per_group;
-    for (int i = 0; i <= bgcount; i++) {
-        struct buf *group_desc_buf = bread(dev, desc_blockno);
-        memmove(&bgdesc, group_desc_buf->data + i * sizeof(bgdesc), sizeof(bgdesc));
-        brelse(group_desc_buf);
+    for (u32 i = 0; i < ext2_group_count; i++) {
+        struct ext2_group_info *gi = &ext2_groups[i];
+        if (gi->desc.bg_free_inodes_count == 0) {
+            continue;
+        }
 
-        struct buf *ibitmap_buff = bread(dev, bgdesc.bg_inode_bitmap + first_partition_block);
-        u32 fbit                 = ext2fs_get_free_bit((char *)ibitmap_buff->data, ext2_sb.s_inodes_per_group);
+        acquiresleep(&gi->lock);
+        struct buf *ibitmap_buff = bread(dev, gi->desc.bg_inode_bitmap + first_partition_block);
+        u32 fbit = ext2fs_find_zero_bit((u32 *)ibitmap_buff->data, ext2_sb.s_inodes_per_group, 0);
         if (fbit == (u32)-1) {
             brelse(ibitmap_buff);
+            releasesleep(&gi->lock);
             continue;
         }
+        ext2fs_set_bit((u32 *)ibitmap_buff->data, fbit);
 
         int inodes_per_block = EXT2_BSIZE / ext2_sb.s_inode_size;
         if (inodes_per_block == 0) {
             panic("ext2fs_ialloc: invalid inode size");
         }
 
-        int bno                 = bgdesc.bg_inode_table + fbit / inodes_per_block + first_partition_block;
-        int iindex              = fbit % inodes_per_block;
+        u32 inum = i * ext2_sb.s_inodes_per_group + fbit + 1;
+        u32 iindex;
+        u32 bno                 = ext2fs_inode_block(inum, &iindex);
         struct buf *dinode_buff = bread(dev, bno);
         u8 *slot                = dinode_buff->data + (iindex * ext2_sb.s_inode_size);
 
@@ -192,32 +560,24 @@ struct inode *ext2fs_ialloc(u32 dev, short type)
         bwrite(ibitmap_buff);
         brelse(dinode_buff);
         brelse(ibitmap_buff);
+        ext2fs_count_inodes(i, -1, type == T_DIR ? 1 : 0);
+        releasesleep(&gi->lock);
 
-        int inum = i * ext2_sb.s_inodes_per_group + fbit + 1;
         return iget(dev, inum);
     }
     panic("ext2_ialloc: no inodes");
 }
 
-void ext2fs_iupdate(struct inode *ip)
+// Copy the in-core inode ip into its slot of a locked inode table
+// block and mark it clean. The caller holds the inode lock.
+static void ext2fs_inode_store(struct inode *ip, u8 *slot)
 {
-    struct ext2_group_desc bgdesc;
-    u32 desc_blockno = first_partition_block + 2; // block group descriptor table starts at block 2
-
-    int gno        = GET_GROUP_NO(ip->inum, ext2_sb);
-    int ioff       = GET_INODE_INDEX(ip->inum, ext2_sb);
-    struct buf *bp = bread(ip->dev, desc_blockno);
-    memmove(&bgdesc, bp->data + gno * sizeof(bgdesc), sizeof(bgdesc));
-    brelse(bp);
-    int bno         = bgdesc.bg_inode_table + ioff / (EXT2_BSIZE / ext2_sb.s_inode_size) + first_partition_block;
-    int iindex      = ioff % (EXT2_BSIZE / ext2_sb.s_inode_size);
-    struct buf *bp1 = bread(ip->dev, bno);
     if (ext2_sb.s_inode_size > EXT2_MAX_INODE_SIZE) {
         panic("ext2fs_iupdate: inode too large");
     }
 
     u8 raw[EXT2_MAX_INODE_SIZE];
-    memmove(raw, bp1->data + iindex * ext2_sb.s_inode_size, ext2_sb.s_inode_size);
+    memmove(raw, slot, ext2_sb.s_inode_size);
     auto din = (struct ext2_inode *)raw;
 
     if (ip->type == T_DIR) {
@@ -234,7 +594,7 @@ void ext2fs_iupdate(struct inode *ip)
     din->i_dtime       = 0;
     din->i_faddr       = 0;
     din->i_file_acl    = 0;
-    din->i_flags       = 0;
+    din->i_flags       = ip->i_flags;
     din->i_generation  = 0;
     din->i_gid         = 0;
     din->i_mtime       = 0;
@@ -243,33 +603,169 @@ void ext2fs_iupdate(struct inode *ip)
 
     struct ext2fs_addrs *ad = (struct ext2fs_addrs *)ip->addrs;
     memmove(din->i_block, ad->addrs, sizeof(ad->addrs));
-    memmove(bp1->data + (iindex * ext2_sb.s_inode_size), raw, ext2_sb.s_inode_size);
+    memmove(slot, raw, ext2_sb.s_inode_size);
+    ip->dirty = 0;
+}
+
+void ext2fs_iupdate(struct inode *ip)
+{
+    u32 iindex;
+    u32 bno         = ext2fs_inode_block(ip->inum, &iindex);
+    struct buf *bp1 = bread(ip->dev, bno);
+    ext2fs_inode_store(ip, bp1->data + iindex * ext2_sb.s_inode_size);
     bwrite(bp1);
     brelse(bp1);
 }
 
+// Write back up to EXT2_SYNC_BATCH dirty in-core inodes of dev and
+// return how many were collected. They are sorted by inode number, so
+// inodes sharing an inode table block go to the disk with one bwrite.
+static u32 ext2fs_sync_batch(u32 dev, bool wait)
+{
+    struct inode *batch[EXT2_SYNC_BATCH];
+    struct inode *busy[EXT2_SYNC_BATCH];
+    u32 n     = 0;
+    u32 nbusy = 0;
+
+    acquire(&icache.lock);
+    for (u32 h = 0; h < ICACHE_BUCKETS && n < EXT2_SYNC_BATCH; h++) {
+        for (struct inode *ip = icache.hash[h]; ip != nullptr && n < EXT2_SYNC_BATCH; ip = ip->hash_next) {
+            if (ip->dev == dev && ip->ref > 0 && ip->dirty) {
+                ip->ref++;
+                batch[n++] = ip;
+            }
+        }
+    }
+    release(&icache.lock);
+
+    for (u32 i = 1; i < n; i++) {
+        struct inode *ip = batch[i];
+        u32 j            = i;
+        for (; j > 0 && batch[j - 1]->inum > ip->inum; j--) {
+            batch[j] = batch[j - 1];
+        }
+        batch[j] = ip;
+    }
+
+    for (u32 i = 0; i < n;) {
+        u32 iindex;
+        const u32 bno  = ext2fs_inode_block(batch[i]->inum, &iindex);
+        struct buf *bp = bread(dev, bno);
+        bool stored    = false;
+        // Inode locks are normally taken before the inode table block, so
+        // only try them here.
+        for (; i < n && ext2fs_inode_block(batch[i]->inum, &iindex) == bno; i++) {
+            struct inode *ip = batch[i];
+            if (!tryacquirerwsleep(&ip->lock)) {
+                if (wait) {
+                    busy[nbusy++] = ip;
+                }
+                continue;
+            }
+            if (ip->valid && ip->dirty) {
+                ext2fs_inode_store(ip, bp->data + iindex * ext2_sb.s_inode_size);
+                stored = true;
+            }
+            releaserwsleep(&ip->lock);
+        }
+        if (stored) {
+            bwrite(bp);
+        }
+        brelse(bp);
+    }
+
+    // The busy ones are waited for with no inode table block held.
+    for (u32 i = 0; i < nbusy; i++) {
+        acquirerwsleep(&busy[i]->lock);
+        if (busy[i]->valid && busy[i]->dirty) {
+            ext2fs_iupdate(busy[i]);
+        }
+        releaserwsleep(&busy[i]->lock);
+    }
+
+    for (u32 i = 0; i < n; i++) {
+        batch[i]->iops->iput(batch[i]);
+    }
+    return n;
+}
+
+/**
+ * @brief Write back the dirty in-core inodes of dev.
+ *
+ * Without wait, one batch of EXT2_SYNC_BATCH inodes is written and an
+ * inode whose lock is busy is skipped, to be written by a later pass or
+ * by its last iput. With wait, busy inodes are waited for and batches
+ * are written until none is left.
+ */
+void ext2fs_sync_inodes(u32 dev, bool wait)
+{
+    while (ext2fs_sync_batch(dev, wait) == EXT2_SYNC_BATCH && wait)
+        ;
+}
+
+/**
+ * @brief Write back dirty inodes, then the group descriptors and
+ * superblock counts.
+ *
+ * @param wait Wait for busy inodes and write all of them, as before a
+ * shutdown, instead of skipping the busy ones as periodic writeback does.
+ */
+void ext2fs_sync(bool wait)
+{
+    if (ext2_groups == nullptr) {
+        return;
+    }
+    ext2fs_sync_inodes(ext2_dev, wait);
+    ext2fs_sync_super(ext2_dev);
+}
+
+/**
+ * @brief Write an inode to disk if it is dirty, then the group
+ * descriptors and superblock counts its blocks are accounted in.
+ *
+ * @return 0.
+ */
+int ext2fs_fsync(struct inode *ip)
+{
+    ip->iops->ilock(ip);
+    if (ip->dirty) {
+        ip->iops->iupdate(ip);
+    }
+    ip->iops->iunlock(ip);
+    ext2fs_sync_super((int)ip->dev);
+    return 0;
+}
+
+// Kernel process that writes dirty inodes, group descriptors and the
+// superblock counts back every EXT2_WRITEBACK_TICKS.
+static void ext2fs_writeback(void)
+{
+    for (;;) {
+        acquire(&tickslock);
+        const u32 ticks0 = ticks;
+        while (ticks - ticks0 < EXT2_WRITEBACK_TICKS) {
+            sleep((void *)&ticks, &tickslock);
+        }
+        release(&tickslock);
+        ext2fs_sync(false);
+    }
+}
+
 void ext2fs_ilock(struct inode *ip)
 {
-    struct ext2_group_desc bgdesc;
     if (ip == nullptr || ip->ref < 1) {
         panic("ext2fs_ilock");
     }
 
     ASSERT(ip->addrs != nullptr, "ip->addrs is null in ext2fs_ilock before lock");
-    acquiresleep(&ip->lock);
+    acquirerwsleep(&ip->lock);
     ASSERT(ip->addrs != nullptr, "ip->addrs is null in ext2fs_ilock");
-    const auto ad  = (struct ext2fs_addrs *)ip->addrs;
-    u32 desc_block = first_partition_block + 2; // Group descriptor at ext2 block 2 = sector 4
+    const auto ad = (struct ext2fs_addrs *)ip->addrs;
 
     if (ip->valid == 0) {
-        const int gno  = GET_GROUP_NO(ip->inum, ext2_sb);
-        const int ioff = GET_INODE_INDEX(ip->inum, ext2_sb);
-        struct buf *bp = bread(ip->dev, desc_block);
-        memmove(&bgdesc, bp->data + gno * sizeof(bgdesc), sizeof(bgdesc));
-        brelse(bp);
-        const int bno    = bgdesc.bg_inode_table + ioff / (EXT2_BSIZE / ext2_sb.s_inode_size) + first_partition_block;
-        const int iindex = ioff % (EXT2_BSIZE / ext2_sb.s_inode_size);
-        struct buf *bp1  = bread(ip->dev, bno);
+        u32 iindex;
+        const u32 bno   = ext2fs_inode_block(ip->inum, &iindex);
+        struct buf *bp1 = bread(ip->dev, bno);
         if (ext2_sb.s_inode_size > EXT2_MAX_INODE_SIZE)
             panic("ext2fs_ilock: inode too large");
         u8 raw[EXT2_MAX_INODE_SIZE];
@@ -297,6 +793,9 @@ void ext2fs_ilock(struct inode *ip)
         ip->size  = din->i_size;
         ip->iops  = &ext2fs_inode_ops;
         memmove(ad->addrs, din->i_block, sizeof(ad->addrs));
+        ad->goal           = 0;
+        ad->prealloc_count = 0;
+        ext2fs_extent_clear(ad);
 
         ip->valid = 1;
         if (ip->type == 0) {
@@ -305,25 +804,47 @@ void ext2fs_ilock(struct inode *ip)
     }
 }
 
+/**
+ * @brief Lock an inode for reading, sharing the lock with other readers.
+ *
+ * An inode that still has to be read from disk is loaded under the
+ * exclusive lock first. Devices stay locked exclusively, since their
+ * drivers drop and retake the lock while they sleep. Either way,
+ * iunlock releases it.
+ */
+void ext2fs_ilock_shared(struct inode *ip)
+{
+    if (ip == nullptr || ip->ref < 1) {
+        panic("ext2fs_ilock_shared");
+    }
+
+    acquirerwsleep_shared(&ip->lock);
+    if (ip->valid && ip->type != T_DEV) {
+        return;
+    }
+    releaserwsleep(&ip->lock);
+    ext2fs_ilock(ip);
+    if (ip->type != T_DEV) {
+        downgraderwsleep(&ip->lock);
+    }
+}
+
 void ext2fs_iunlock(struct inode *ip)
 {
-    if (ip == nullptr || !holdingsleep(&ip->lock) || ip->ref < 1)
+    if (ip == nullptr || !holdingrwsleep(&ip->lock) || ip->ref < 1)
         panic("ext2fs_iunlock");
 
-    releasesleep(&ip->lock);
+    releaserwsleep(&ip->lock);
 }
 
 // Free an inode
 static void ext2fs_ifree(struct inode *ip)
 {
-    struct ext2_group_desc bgdesc;
-    u32 desc_blockno = first_partition_block + 2; // block group descriptor table starts at block 2
+    u32 gno                    = GET_GROUP_NO(ip->inum, ext2_sb);
+    struct ext2_group_info *gi = &ext2_groups[gno];
 
-    int gno         = GET_GROUP_NO(ip->inum, ext2_sb);
-    struct buf *bp1 = bread(ip->dev, desc_blockno);
-    memmove(&bgdesc, bp1->data + gno * sizeof(bgdesc), sizeof(bgdesc));
-    brelse(bp1);
-    struct buf *bp2 = bread(ip->dev, bgdesc.bg_inode_bitmap + first_partition_block);
+    acquiresleep(&gi->lock);
+    struct buf *bp2 = bread(ip->dev, gi->desc.bg_inode_bitmap + first_partition_block);
     u32 index       = (ip->inum - 1) % ext2_sb.s_inodes_per_group;
     u32 byte_index  = index / 8;
     if (byte_index >= EXT2_BSIZE) {
@@ -341,36 +862,33 @@ static void ext2fs_ifree(struct inode *ip)
     bp2->data[byte_index] &= ~mask;
     bwrite(bp2);
     brelse(bp2);
+    ext2fs_count_inodes(gno, 1, ip->type == T_DIR ? -1 : 0);
+    releasesleep(&gi->lock);
 }
 
 void ext2fs_iput(struct inode *ip)
 {
-    acquiresleep(&ip->lock);
-    struct ext2fs_addrs *ad = (struct ext2fs_addrs *)ip->addrs;
+    acquirerwsleep(&ip->lock);
 
-    if (ip->valid && ip->nlink == 0) {
-        acquire(&icache.lock);
-        int r = ip->ref;
-        release(&icache.lock);
-        if (r == 1) {
+    acquire(&icache.lock);
+    int r = ip->ref;
+    release(&icache.lock);
+    if (r == 1 && ip->valid) {
+        ext2fs_discard_prealloc(ip);
+        if (ip->nlink == 0) {
             // inode has no links and no other references: truncate and free.
             ext2fs_ifree(ip);
             ext2fs_itrunc(ip);
-            ip->type = 0;
+            ip->type    = 0;
+            ip->i_flags = 0;
             ip->iops->iupdate(ip);
             ip->valid = 0;
+        } else if (ip->dirty) {
+            ip->iops->iupdate(ip);
         }
     }
-    releasesleep(&ip->lock);
-
-    acquire(&icache.lock);
-    ip->ref--;
-    if (ip->ref == 0) {
-        ad->busy  = 0;
-        ip->iops  = nullptr;
-        ip->addrs = nullptr;
-    }
-    release(&icache.lock);
+    releaserwsleep(&ip->lock);
+    irelease(ip);
 }
 
 void ext2fs_iunlockput(struct inode *ip)
@@ -403,43 +921,83 @@ void ext2fs_stati(struct inode *ip, struct stat *st)
 // are listed in ip->addrs[].  The next NINDIRECT blocks are
 // listed in block ip->addrs[NDIRECT].
 
-// Return the disk block address of the nth block in inode ip.
-// If there is no such block, bmap allocates one.
+// Length of the run of physically contiguous blocks starting at a[i].
+static u32 ext2fs_run_length(const u32 *a, u32 i, u32 limit)
+{
+    u32 n = 1;
+    while (i + n < limit && a[i + n] == a[i] + n) {
+        n++;
+    }
+    return n;
+}
+
+// Allocate data blocks for the holes among the want entries of leaf
+// table t from index i on, stopping at limit. Returns true if any entry
+// was filled in.
+static bool ext2fs_leaf_alloc(struct inode *ip, u32 *t, u32 i, u32 limit, u32 want)
+{
+    bool filled = false;
+
+    for (u32 j = i; j < limit && j - i < want; j++) {
+        if (t[j] == 0) {
+            t[j]   = ext2fs_balloc(ip, false);
+            filled = true;
+        }
+    }
+    return filled;
+}
+
+// Walk the block tree for the nth block in inode ip and return its disk
+// block address. If there is no such block, allocate one when alloc is
+// set and return 0 otherwise. With alloc set, the holes among the want
+// blocks from bn on that share bn's leaf are allocated too, so the leaf
+// is written once per batch rather than once per block. New data blocks
+// are not zeroed. *run is set to the number of blocks from bn on that
+// the same leaf maps contiguously.
 /*
- * EXT2BSIZE -> 1024
+ * EXT2_INDIRECT -> EXT2_BSIZE / 4 (256 for 1 KiB blocks, 1024 for 4 KiB)
  * If < EXT2_NDIR_BLOCKS then it is directly mapped, allocate and return
- * If < 128 (Indirect blocks) then need to allocate using indirect block
- * If < 128*128 (Double indirect) ...
- * If < 128*128*128 (Triple indirect) ...
+ * If < EXT2_INDIRECT (Indirect blocks) then need to allocate using indirect block
+ * If < EXT2_INDIRECT^2 (Double indirect) ...
+ * If < EXT2_INDIRECT^3 (Triple indirect) ...
  * Else panic()
 */
-static u32 ext2fs_bmap(struct inode *ip, u32 bn)
+static u32 ext2fs_bmap_walk(struct inode *ip, u32 bn, bool alloc, u32 want, u32 *run)
 {
     u32 addr, *a, *b;
     struct buf *bp, *bp1;
     struct ext2fs_addrs *ad = (struct ext2fs_addrs *)ip->addrs;
 
     if (bn < EXT2_NDIR_BLOCKS) {
-        if ((addr = ad->addrs[bn]) == 0) {
-            addr          = ext2fs_balloc(ip->dev, ip->inum);
-            ad->addrs[bn] = addr;
+        if (ad->addrs[bn] == 0 && !alloc) {
+            return 0;
+        }
+        if (alloc) {
+            ext2fs_leaf_alloc(ip, ad->addrs, bn, EXT2_NDIR_BLOCKS, want);
         }
-        return addr + first_partition_block;
+        *run = ext2fs_run_length(ad->addrs, bn, EXT2_NDIR_BLOCKS);
+        return ad->addrs[bn] + first_partition_block;
     }
     bn -= EXT2_NDIR_BLOCKS;
     if (bn < EXT2_INDIRECT) {
         if ((addr = ad->addrs[EXT2_IND_BLOCK]) == 0) {
-            addr                      = ext2fs_balloc(ip->dev, ip->inum);
+            if (!alloc) {
+                return 0;
+            }
+            addr                      = ext2fs_balloc(ip, true);
             ad->addrs[EXT2_IND_BLOCK] = addr;
         }
-        bp        = bread(ip->dev, first_partition_block + addr);
-        a         = (u32 *)bp->data;
-        u32 entry = a[bn];
-        if (entry == 0) {
-            entry = ext2fs_balloc(ip->dev, ip->inum);
-            a[bn] = entry;
+        bp = bread(ip->dev, first_partition_block + addr);
+        a  = (u32 *)bp->data;
+        if (a[bn] == 0 && !alloc) {
+            brelse(bp);
+            return 0;
+        }
+        if (alloc && ext2fs_leaf_alloc(ip, a, bn, EXT2_INDIRECT, want)) {
             bwrite(bp);
         }
+        u32 entry = a[bn];
+        *run      = ext2fs_run_length(a, bn, EXT2_INDIRECT);
         brelse(bp);
         return entry + first_partition_block;
     }
@@ -447,7 +1005,10 @@ static u32 ext2fs_bmap(struct inode *ip, u32 bn)
 
     if (bn < EXT2_DINDIRECT) {
         if ((addr = ad->addrs[EXT2_DIND_BLOCK]) == 0) {
-            addr                       = ext2fs_balloc(ip->dev, ip->inum);
+            if (!alloc) {
+                return 0;
+            }
+            addr                       = ext2fs_balloc(ip, true);
             ad->addrs[EXT2_DIND_BLOCK] = addr;
         }
         bp              = bread(ip->dev, first_partition_block + addr);
@@ -455,7 +1016,11 @@ static u32 ext2fs_bmap(struct inode *ip, u32 bn)
         u32 first_index = bn / EXT2_INDIRECT;
         u32 entry       = a[first_index];
         if (entry == 0) {
-            entry          = ext2fs_balloc(ip->dev, ip->inum);
+            if (!alloc) {
+                brelse(bp);
+                return 0;
+            }
+            entry          = ext2fs_balloc(ip, true);
             a[first_index] = entry;
             bwrite(bp);
         }
@@ -464,12 +1029,15 @@ static u32 ext2fs_bmap(struct inode *ip, u32 bn)
         bp1              = bread(ip->dev, first_partition_block + entry);
         b                = (u32 *)bp1->data;
         u32 second_index = bn % EXT2_INDIRECT;
-        u32 leaf         = b[second_index];
-        if (leaf == 0) {
-            leaf            = ext2fs_balloc(ip->dev, ip->inum);
-            b[second_index] = leaf;
+        if (b[second_index] == 0 && !alloc) {
+            brelse(bp1);
+            return 0;
+        }
+        if (alloc && ext2fs_leaf_alloc(ip, b, second_index, EXT2_INDIRECT, want)) {
             bwrite(bp1);
         }
+        u32 leaf = b[second_index];
+        *run     = ext2fs_run_length(b, second_index, EXT2_INDIRECT);
         brelse(bp1);
         return leaf + first_partition_block;
     }
@@ -477,7 +1045,10 @@ static u32 ext2fs_bmap(struct inode *ip, u32 bn)
 
     if (bn < EXT2_TINDIRECT) {
         if ((addr = ad->addrs[EXT2_TIND_BLOCK]) == 0) {
-            addr                       = ext2fs_balloc(ip->dev, ip->inum);
+            if (!alloc) {
+                return 0;
+            }
+            addr                       = ext2fs_balloc(ip, true);
             ad->addrs[EXT2_TIND_BLOCK] = addr;
         }
         bp              = bread(ip->dev, first_partition_block + addr);
@@ -485,7 +1056,11 @@ static u32 ext2fs_bmap(struct inode *ip, u32 bn)
         u32 first_index = bn / EXT2_DINDIRECT;
         u32 entry       = a[first_index];
         if (entry == 0) {
-            entry          = ext2fs_balloc(ip->dev, ip->inum);
+            if (!alloc) {
+                brelse(bp);
+                return 0;
+            }
+            entry          = ext2fs_balloc(ip, true);
             a[first_index] = entry;
             bwrite(bp);
         }
@@ -497,7 +1072,11 @@ static u32 ext2fs_bmap(struct inode *ip, u32 bn)
         u32 second_idx = remainder / EXT2_INDIRECT;
         u32 mid        = b[second_idx];
         if (mid == 0) {
-            mid           = ext2fs_balloc(ip->dev, ip->inum);
+            if (!alloc) {
+                brelse(bp1);
+                return 0;
+            }
+            mid           = ext2fs_balloc(ip, true);
             b[second_idx] = mid;
             bwrite(bp1);
         }
@@ -506,114 +1085,214 @@ static u32 ext2fs_bmap(struct inode *ip, u32 bn)
         struct buf *bp2 = bread(ip->dev, first_partition_block + mid);
         u32 *c          = (u32 *)bp2->data;
         u32 third_idx   = remainder % EXT2_INDIRECT;
-        u32 leaf        = c[third_idx];
-        if (leaf == 0) {
-            leaf         = ext2fs_balloc(ip->dev, ip->inum);
-            c[third_idx] = leaf;
+        if (c[third_idx] == 0 && !alloc) {
+            brelse(bp2);
+            return 0;
+        }
+        if (alloc && ext2fs_leaf_alloc(ip, c, third_idx, EXT2_INDIRECT, want)) {
             bwrite(bp2);
         }
+        u32 leaf = c[third_idx];
+        *run     = ext2fs_run_length(c, third_idx, EXT2_INDIRECT);
         brelse(bp2);
         return leaf + first_partition_block;
     }
     panic("ext2_bmap: block number out of range\n");
 }
 
-// Truncate inode (discard contents).
-// Only called when the inode has no links
-// to it (no directory entries referring to it)
-// and has no in-memory reference to it (is
-// not an open file or current directory).
-static void ext2fs_itrunc(struct inode *ip)
+// Find bn in the inode's extent cache. On a hit, return its disk block
+// address and set *len to the number of blocks mapped contiguously from bn.
+static u32 ext2fs_extent_lookup(struct ext2fs_addrs *ad, u32 bn, u32 *len)
 {
-    u32 i, j;
-    struct buf *bp1, *bp2;
-    u32 *a, *b;
-    struct ext2fs_addrs *ad = (struct ext2fs_addrs *)ip->addrs;
-
-    // for direct blocks
-    for (i = 0; i < EXT2_NDIR_BLOCKS; i++) {
-        if (ad->addrs[i]) {
-            ext2fs_bfree(ip->dev, ad->addrs[i]);
-            ad->addrs[i] = 0;
+    u32 addr = 0;
+    acquire(&ad->extent_lock);
+    for (u32 i = 0; i < EXT2_EXTENT_CACHE; i++) {
+        const struct ext2_extent *e = &ad->extents[i];
+        if (e->len != 0 && bn >= e->lblk && bn - e->lblk < e->len) {
+            *len = e->len - (bn - e->lblk);
+            addr = e->pblk + (bn - e->lblk);
+            break;
         }
     }
-    // EXT2_INDIRECT -> (EXT2_BSIZE / sizeof(u32))
-    // for indirect blocks
-    if (ad->addrs[EXT2_IND_BLOCK]) {
-        bp1 = bread(ip->dev, ad->addrs[EXT2_IND_BLOCK] + first_partition_block);
-        a   = (u32 *)bp1->data;
-        for (i = 0; i < EXT2_INDIRECT; i++) {
-            if (a[i]) {
-                ext2fs_bfree(ip->dev, a[i]);
-                a[i] = 0;
-            }
-        }
-        brelse(bp1);
-        ext2fs_bfree(ip->dev, ad->addrs[EXT2_IND_BLOCK]);
-        ad->addrs[EXT2_IND_BLOCK] = 0;
-    }
-
-    // for double indirect blocks
-    if (ad->addrs[EXT2_DIND_BLOCK]) {
-        bp1 = bread(ip->dev, ad->addrs[EXT2_DIND_BLOCK] + first_partition_block);
-        a   = (u32 *)bp1->data;
-        for (i = 0; i < EXT2_INDIRECT; i++) {
-            if (a[i]) {
-                bp2 = bread(ip->dev, a[i] + first_partition_block);
-                b   = (u32 *)bp2->data;
-                for (j = 0; j < EXT2_INDIRECT; j++) {
-                    if (b[j]) {
-                        ext2fs_bfree(ip->dev, b[j]);
-                        b[j] = 0;
-                    }
-                }
-                brelse(bp2);
-                ext2fs_bfree(ip->dev, a[i]);
-                a[i] = 0;
-            }
-        }
-        brelse(bp1);
-        ext2fs_bfree(ip->dev, ad->addrs[EXT2_DIND_BLOCK]);
-        ad->addrs[EXT2_DIND_BLOCK] = 0;
-    }
-
-    // for triple indirect blocks
-    if (ad->addrs[EXT2_TIND_BLOCK]) {
-        bp1 = bread(ip->dev, ad->addrs[EXT2_TIND_BLOCK] + first_partition_block);
-        a   = (u32 *)bp1->data;
-        for (i = 0; i < EXT2_INDIRECT; i++) {
-            if (a[i]) {
-                bp2 = bread(ip->dev, a[i] + first_partition_block);
-                b   = (u32 *)bp2->data;
-                for (j = 0; j < EXT2_INDIRECT; j++) {
-                    if (b[j]) {
-                        struct buf *bp3 = bread(ip->dev, b[j] + first_partition_block);
-                        u32 *c          = (u32 *)bp3->data;
-                        for (u32 k = 0; k < EXT2_INDIRECT; k++) {
-                            if (c[k]) {
-                                ext2fs_bfree(ip->dev, c[k]);
-                                c[k] = 0;
-                            }
-                        }
-                        brelse(bp3);
-                        ext2fs_bfree(ip->dev, b[j]);
-                        b[j] = 0;
-                    }
-                }
-                brelse(bp2);
-                ext2fs_bfree(ip->dev, a[i]);
-                a[i] = 0;
-            }
+    release(&ad->extent_lock);
+    return addr;
+}
+
+// Remember that len blocks from bn map to disk blocks from pblk.
+static void ext2fs_extent_insert(struct ext2fs_addrs *ad, u32 bn, u32 pblk, u32 len)
+{
+    acquire(&ad->extent_lock);
+    // Grow the extent this run continues, if there is one.
+    for (u32 i = 0; i < EXT2_EXTENT_CACHE; i++) {
+        struct ext2_extent *e = &ad->extents[i];
+        if (e->len != 0 && e->lblk + e->len == bn && e->pblk + e->len == pblk) {
+            e->len += len;
+            release(&ad->extent_lock);
+            return;
         }
-        brelse(bp1);
-        ext2fs_bfree(ip->dev, ad->addrs[EXT2_TIND_BLOCK]);
-        ad->addrs[EXT2_TIND_BLOCK] = 0;
     }
+    struct ext2_extent *e = &ad->extents[ad->extent_next];
+    ad->extent_next       = (ad->extent_next + 1) % EXT2_EXTENT_CACHE;
+    e->lblk               = bn;
+    e->pblk               = pblk;
+    e->len                = len;
+    release(&ad->extent_lock);
+}
+
+// Forget every cached mapping of ip.
+static void ext2fs_extent_clear(struct ext2fs_addrs *ad)
+{
+    acquire(&ad->extent_lock);
+    memset(ad->extents, 0, sizeof(ad->extents));
+    ad->extent_next = 0;
+    release(&ad->extent_lock);
+}
+
+// Return the disk block address of the nth block in inode ip.
+// If there is no such block, bmap allocates one when alloc is set
+// and returns 0 otherwise.
+//
+// Mappings are served from the inode's extent cache when possible.
+// A miss walks the indirect blocks once and caches the whole run of
+// contiguous blocks the leaf maps from bn on.
+static u32 ext2fs_bmap(struct inode *ip, u32 bn, bool alloc)
+{
+    struct ext2fs_addrs *ad = (struct ext2fs_addrs *)ip->addrs;
+    u32 len;
+
+    u32 addr = ext2fs_extent_lookup(ad, bn, &len);
+    if (addr != 0) {
+        return addr;
+    }
+    addr = ext2fs_bmap_walk(ip, bn, alloc, 1, &len);
+    if (addr != 0) {
+        ext2fs_extent_insert(ad, bn, addr, len);
+    }
+    return addr;
+}
+
+// Map n consecutive blocks starting at bn into out[]. Holes are reported
+// as 0 unless alloc is set, in which case they are filled a leaf at a time
+// with data blocks that are not zeroed. Returns the number of blocks mapped.
+static u32 ext2fs_bmap_range(struct inode *ip, u32 bn, u32 n, u32 *out, bool alloc)
+{
+    struct ext2fs_addrs *ad = (struct ext2fs_addrs *)ip->addrs;
+    u32 done                = 0;
+
+    while (done < n) {
+        u32 len;
+        u32 addr = ext2fs_extent_lookup(ad, bn + done, &len);
+        if (addr == 0 && alloc) {
+            addr = ext2fs_bmap_walk(ip, bn + done, true, n - done, &len);
+            ext2fs_extent_insert(ad, bn + done, addr, len);
+        } else if (addr == 0) {
+            addr = ext2fs_bmap(ip, bn + done, false);
+            len  = 1;
+            if (addr == 0) {
+                out[done++] = 0;
+                continue;
+            }
+        }
+        for (u32 i = 0; i < len && done < n; i++) {
+            out[done++] = addr + i;
+        }
+    }
+    return done;
+}
+
+// Queue the blocks mapped by indirect block ind, down depth more levels
+// of indirection, and ind itself.
+static void ext2fs_free_indirect(struct ext2fs_free_batch *fb, u32 ind, int depth)
+{
+    struct buf *bp = bread(fb->dev, ind + first_partition_block);
+    const u32 *a   = (u32 *)bp->data;
+    for (u32 i = 0; i < EXT2_INDIRECT; i++) {
+        if (a[i] == 0) {
+            continue;
+        }
+        if (depth > 0) {
+            ext2fs_free_indirect(fb, a[i], depth - 1);
+        } else {
+            ext2fs_free_add(fb, a[i]);
+        }
+    }
+    brelse(bp);
+    ext2fs_free_add(fb, ind);
+}
+
+// Truncate inode (discard contents).
+// Only called when the inode has no links
+// to it (no directory entries referring to it)
+// and has no in-memory reference to it (is
+// not an open file or current directory).
+//
+// Blocks are collected into runs and freed a batch at a time, so a
+// large file costs a few bitmap writes rather than one per block.
+static void ext2fs_itrunc(struct inode *ip)
+{
+    struct ext2fs_addrs *ad = (struct ext2fs_addrs *)ip->addrs;
+    struct ext2fs_free_batch fb;
+
+    page_cache_invalidate(ip->dev, ip->inum);
+    ext2fs_discard_prealloc(ip);
+    ext2fs_extent_clear(ad);
+    ad->goal = 0;
+
+    fb.dev   = ip->dev;
+    fb.nruns = 0;
+    for (u32 i = 0; i < EXT2_NDIR_BLOCKS; i++) {
+        if (ad->addrs[i]) {
+            ext2fs_free_add(&fb, ad->addrs[i]);
+            ad->addrs[i] = 0;
+        }
+    }
+    for (u32 i = EXT2_IND_BLOCK; i <= EXT2_TIND_BLOCK; i++) {
+        if (ad->addrs[i]) {
+            ext2fs_free_indirect(&fb, ad->addrs[i], (int)(i - EXT2_IND_BLOCK));
+            ad->addrs[i] = 0;
+        }
+    }
+    ext2fs_free_flush(&fb);
 
     ip->size = 0;
     ip->iops->iupdate(ip);
 }
 
+// Copy part of one block straight out of the buffer cache.
+// Used when the page cache cannot get a page.
+static void ext2fs_read_block(struct inode *ip, char *dst, u32 off, u32 n)
+{
+    u32 block = ext2fs_bmap(ip, off / EXT2_BSIZE, false);
+    if (block == 0) {
+        memset(dst, 0, n);
+        return;
+    }
+    struct buf *bp = bread(ip->dev, block);
+    memmove(dst, bp->data + off % EXT2_BSIZE, n);
+    brelse(bp);
+}
+
+// Fill a page cache page from the blocks backing it.
+// Holes and blocks past the end of the file read as zeros.
+static void ext2fs_fill_page(struct inode *ip, struct page *pg)
+{
+    const u32 blocks_per_page = PGSIZE / EXT2_BSIZE;
+    const u32 first           = pg->index * blocks_per_page;
+    u32 blocks[PGSIZE / EXT2_MIN_BSIZE];
+
+    ext2fs_bmap_range(ip, first, blocks_per_page, blocks, false);
+    for (u32 i = 0; i < blocks_per_page; i++) {
+        char *dst = pg->data + i * EXT2_BSIZE;
+        if (blocks[i] == 0 || (u64)(first + i) * EXT2_BSIZE >= ip->size) {
+            memset(dst, 0, EXT2_BSIZE);
+            continue;
+        }
+        struct buf *bp = bread(ip->dev, blocks[i]);
+        memmove(dst, bp->data, EXT2_BSIZE);
+        brelse(bp);
+    }
+    pg->valid = 1;
+}
 
 int ext2fs_readi(struct inode *ip, char *dst, u32 off, u32 n)
 {
@@ -624,7 +1303,7 @@ int ext2fs_readi(struct inode *ip, char *dst, u32 off, u32 n)
         if (major < 0 || major >= NDEV || !devsw[major].read) {
             return -1;
         }
-        return devsw[major].read(ip, dst, n, off);
+        return devsw[major].read(ip, dst, n, off, 0);
     }
 
     if (off > ip->size || off + n < off) {
@@ -635,53 +1314,298 @@ int ext2fs_readi(struct inode *ip, char *dst, u32 off, u32 n)
     }
 
     for (u32 tot = 0; tot < n; tot += m, off += m, dst += m) {
-        u32 block      = ext2fs_bmap(ip, off / EXT2_BSIZE);
-        struct buf *bp = bread(ip->dev, block);
-        m              = min(n - tot, EXT2_BSIZE - off % EXT2_BSIZE);
-        memmove(dst, bp->data + off % EXT2_BSIZE, m);
-        brelse(bp);
+        struct page *pg = page_cache_get(ip->dev, ip->inum, off / PGSIZE);
+        if (pg == nullptr) {
+            m = min(n - tot, EXT2_BSIZE - off % EXT2_BSIZE);
+            ext2fs_read_block(ip, dst, off, m);
+            continue;
+        }
+        if (!pg->valid) {
+            ext2fs_fill_page(ip, pg);
+        }
+        m = min(n - tot, PGSIZE - off % PGSIZE);
+        memmove(dst, pg->data + off % PGSIZE, m);
+        page_cache_put(pg);
     }
     return n;
 }
 
+/**
+ * @brief Get a filled page cache page of a regular file.
+ *
+ * Lets callers move file data without copying it out of the page cache
+ * first. The inode must be locked.
+ *
+ * @param index Page index within the file.
+ * @return Locked, referenced page, or nullptr if no memory is available.
+ */
+struct page *ext2fs_getpage(struct inode *ip, u32 index)
+{
+    struct page *pg = page_cache_get(ip->dev, ip->inum, index);
+    if (pg != nullptr && !pg->valid) {
+        ext2fs_fill_page(ip, pg);
+    }
+    return pg;
+}
+
+// The page cache is write-through: copy n bytes just written at off
+// into the cached page, if there is one. The range must not cross a page.
+static void ext2fs_page_update(struct inode *ip, u32 off, const char *src, u32 n)
+{
+    struct page *pg = page_cache_find(ip->dev, ip->inum, off / PGSIZE);
+    if (pg != nullptr) {
+        if (pg->valid) {
+            memmove(pg->data + off % PGSIZE, src, n);
+        }
+        page_cache_put(pg);
+    }
+}
+
+// Map the blocks a write of n bytes at off touches, at most
+// EXT2_WRITE_BATCH of them, into blocks[]. fresh[i] is set for blocks that
+// had no data yet: they are allocated here and read as zeros, and the
+// inode is marked dirty since its block map changed. Returns
+// the number of blocks mapped.
+static u32 ext2fs_write_map(struct inode *ip, u32 off, u32 n, u32 *blocks, bool *fresh)
+{
+    const u32 bn         = off / EXT2_BSIZE;
+    const u32 eof_blocks = (ip->size + EXT2_BSIZE - 1) / EXT2_BSIZE;
+    u32 count            = min((off % EXT2_BSIZE + n + EXT2_BSIZE - 1) / EXT2_BSIZE, EXT2_WRITE_BATCH);
+
+    // Nothing is mapped past the end of the file, so appends allocate
+    // the whole batch up front.
+    if (bn >= eof_blocks) {
+        ext2fs_bmap_range(ip, bn, count, blocks, true);
+        memset(fresh, true, count * sizeof(*fresh));
+        ip->dirty = 1;
+        return count;
+    }
+
+    count = min(count, eof_blocks - bn);
+    ext2fs_bmap_range(ip, bn, count, blocks, false);
+    for (u32 i = 0; i < count; i++) {
+        fresh[i] = blocks[i] == 0;
+        if (fresh[i]) {
+            blocks[i] = ext2fs_bmap(ip, bn + i, true);
+            ip->dirty = 1;
+        }
+    }
+    return count;
+}
+
+// Writes hold the inode lock for their whole length. Blocks are mapped
+// and allocated a batch at a time, and blocks that are overwritten whole
+// or were just allocated are never read from the disk. A write that
+// grows the file only marks the in-core inode dirty; it reaches the disk
+// on the last iput, on fsync, or from the writeback process.
 int ext2fs_writei(struct inode *ip, char *src, u32 off, u32 n)
 {
-    u32 m;
+    u32 blocks[EXT2_WRITE_BATCH];
+    bool fresh[EXT2_WRITE_BATCH];
 
     if (ip->type == T_DEV) {
         int major = devtab_lookup_major(ip);
         if (major < 0 || major >= NDEV || !devsw[major].write) {
             return -1;
         }
-        return devsw[major].write(ip, src, n, off);
+        return devsw[major].write(ip, src, n, off, 0);
     }
 
     if (off > ip->size || off + n < off) {
         return -1;
     }
-    if (off + n > EXT2_MAXFILE * EXT2_BSIZE) {
+    if ((u64)off + n > (u64)EXT2_MAXFILE * EXT2_BSIZE) {
         return -1;
     }
 
-    for (u32 tot = 0; tot < n; tot += m, off += m, src += m) {
-        u32 block      = ext2fs_bmap(ip, off / EXT2_BSIZE);
-        struct buf *bp = bread(ip->dev, block);
-        m              = min(n - tot, EXT2_BSIZE - off%EXT2_BSIZE);
-        memmove(bp->data + off % EXT2_BSIZE, src, m);
-        bwrite(bp);
-        brelse(bp);
+    for (u32 tot = 0; tot < n;) {
+        const u32 count = ext2fs_write_map(ip, off, n - tot, blocks, fresh);
+        for (u32 i = 0; i < count; i++) {
+            const u32 boff = off % EXT2_BSIZE;
+            const u32 m    = min(n - tot, EXT2_BSIZE - boff);
+            struct buf *bp;
+            if (m == EXT2_BSIZE) {
+                bp = bgetblk(ip->dev, blocks[i]);
+            } else if (fresh[i]) {
+                bp = bgetblk(ip->dev, blocks[i]);
+                memset(bp->data, 0, EXT2_BSIZE);
+            } else {
+                bp = bread(ip->dev, blocks[i]);
+            }
+            memmove(bp->data + boff, src, m);
+            bwrite(bp);
+            brelse(bp);
+
+            ext2fs_page_update(ip, off, src, m);
+            tot += m;
+            off += m;
+            src += m;
+        }
     }
 
     if (n > 0 && off > ip->size) {
-        ip->size = off;
-        ip->iops->iupdate(ip);
+        ip->size  = off;
+        ip->dirty = 1;
     }
     return n;
 }
 
-int ext2fs_namecmp(const char *s, const char *t)
+// Check that the user buffer [addr, addr + n) can take part in direct
+// I/O. Only memory below brk qualifies: those frames belong to this
+// process alone and only it can free them, which it cannot do during the
+// system call, so they stay put until the transfer is done. Shared
+// memory and device mappings may be freed or remapped by someone else,
+// so they get -ENOTSUP and go through the caches instead. A buffer the
+// disk writes into (to_user) must be writable by the user.
+static int ext2fs_user_buf_check(char *addr, u32 n, bool to_user)
+{
+    struct proc *p = current_process();
+    if ((u32)addr + n < (u32)addr || (u32)addr + n > p->brk) {
+        return -ENOTSUP;
+    }
+    for (u32 a = PGROUNDDOWN((u32)addr); a < (u32)addr + n; a += PGSIZE) {
+        char *ka = to_user ? uva2ka_writable(p->page_directory, (char *)a) : uva2ka(p->page_directory, (char *)a);
+        if (ka == nullptr) {
+            return -EFAULT;
+        }
+    }
+    return ALL_OK;
+}
+
+// Describe a user buffer that passed ext2fs_user_buf_check as physically
+// contiguous segments. Returns the number of segments, or -1 if the
+// buffer needs more than max.
+static int ext2fs_user_segs(char *addr, u32 n, struct disk_seg *segs, int max)
 {
-    return strncmp(s, t, EXT2_NAME_LEN);
+    pde_t *pgdir = current_process()->page_directory;
+    int count    = 0;
+
+    while (n > 0) {
+        char *page = (char *)PGROUNDDOWN((u32)addr);
+        char *ka   = uva2ka(pgdir, page);
+        if (ka == nullptr) {
+            return -1;
+        }
+        const u32 phys = V2P(ka) + (addr - page);
+        const u32 len  = min(n, PGSIZE - (u32)(addr - page));
+        if (count > 0 && segs[count - 1].phys + segs[count - 1].len == phys) {
+            segs[count - 1].len += len;
+        } else {
+            if (count == max) {
+                return -1;
+            }
+            segs[count].phys = phys;
+            segs[count].len  = len;
+            count++;
+        }
+        addr += len;
+        n -= len;
+    }
+    return count;
+}
+
+/**
+ * @brief Move whole blocks between a file and user memory by DMA.
+ *
+ * Backs O_DIRECT. The data goes straight between the disk and the pages
+ * of the user buffer, one command per run of contiguous blocks, without
+ * passing through the buffer cache or the page cache. Both caches are
+ * write-through, so the disk is current for reads; writes drop any copy
+ * of the block in the buffer cache and refresh a cached page in place.
+ *
+ * A read that ends in the middle of the last block of the file copies
+ * that tail through the page cache.
+ *
+ * @param addr User buffer, aligned to a sector.
+ * @param off File offset, aligned to a block.
+ * @param n Bytes to move, a multiple of the block size.
+ * @param write Write the buffer to the file instead of reading.
+ * @return Bytes moved, -1 on error, -EINVARG if addr, off or n are not
+ * aligned, -EFAULT if a read would land in memory the user cannot write,
+ * or -ENOTSUP if the disk or the buffer cannot do it and the caller
+ * should use readi or writei instead.
+ */
+int ext2fs_direct_io(struct inode *ip, char *addr, u32 off, u32 n, bool write)
+{
+    u32 blocks[EXT2_WRITE_BATCH];
+    bool fresh[EXT2_WRITE_BATCH];
+    struct disk_seg segs[DISK_SEG_MAX];
+
+    if (ip->type != T_FILE) {
+        return -ENOTSUP;
+    }
+    if (off % EXT2_BSIZE != 0 || n % EXT2_BSIZE != 0 || (u32)addr % DISK_SECTOR_SIZE != 0) {
+        return -EINVARG;
+    }
+    if (!disk_direct_ready()) {
+        return -ENOTSUP;
+    }
+    if (off > ip->size || off + n < off) {
+        return -1;
+    }
+    const int rc = ext2fs_user_buf_check(addr, n, !write);
+    if (rc != ALL_OK) {
+        return rc;
+    }
+    if (write && (u64)off + n > (u64)EXT2_MAXFILE * EXT2_BSIZE) {
+        return -1;
+    }
+
+    u32 tail = 0;
+    if (!write && off + n > ip->size) {
+        n    = ip->size - off;
+        tail = n % EXT2_BSIZE;
+        n -= tail;
+    }
+
+    u32 tot = 0;
+    while (tot < n) {
+        u32 count;
+        if (write) {
+            count = ext2fs_write_map(ip, off + tot, n - tot, blocks, fresh);
+        } else {
+            count = min((n - tot) / EXT2_BSIZE, EXT2_WRITE_BATCH);
+            ext2fs_bmap_range(ip, (off + tot) / EXT2_BSIZE, count, blocks, false);
+        }
+
+        for (u32 i = 0; i < count;) {
+            if (blocks[i] == 0) {
+                memset(addr + tot, 0, EXT2_BSIZE);
+                tot += EXT2_BSIZE;
+                i++;
+                continue;
+            }
+            u32 run = 1;
+            while (i + run < count && blocks[i + run] == blocks[i] + run) {
+                run++;
+            }
+            const u32 len   = run * EXT2_BSIZE;
+            const int nsegs = ext2fs_user_segs(addr + tot, len, segs, DISK_SEG_MAX);
+            const u64 lba   = (u64)blocks[i] * (EXT2_BSIZE / DISK_SECTOR_SIZE);
+            if (nsegs < 0 || disk_rw_direct(lba, segs, nsegs, write) != ALL_OK) {
+                goto out;
+            }
+            if (write) {
+                for (u32 j = 0; j < run; j++) {
+                    bforget(ip->dev, blocks[i + j]);
+                    ext2fs_page_update(ip, off + tot + j * EXT2_BSIZE, addr + tot + j * EXT2_BSIZE, EXT2_BSIZE);
+                }
+            }
+            tot += len;
+            i += run;
+        }
+    }
+
+    if (tail > 0) {
+        tot += ext2fs_readi(ip, addr + tot, off + tot, tail);
+    }
+
+out:
+    if (write && off + tot > ip->size) {
+        ip->size  = off + tot;
+        ip->dirty = 1;
+    }
+    return tot > 0 || n + tail == 0 ? (int)tot : -1;
 }
 
 static inline u16 ext2_dirent_size(u8 name_len)
@@ -690,44 +1614,571 @@ static inline u16 ext2_dirent_size(u8 name_len)
     return (size + 3) & ~3;
 }
 
-struct inode *ext2fs_dirlookup(struct inode *dp, char *name, u32 *poff)
+// Directories are parsed a whole block at a time, straight out of the
+// buffer cache. Records never cross a block boundary and the last record
+// of a block runs to its end. Indexed directories (EXT2_INDEX_FL) keep a
+// hashed b-tree in block 0 that maps name hashes to leaf blocks; see
+// struct ext2_dx_root_info.
+
+#define EXT2_DX_ROOT_INFO 24 // offset of the root info in block 0, after "." and ".."
+#define EXT2_DX_ROOT      32 // offset of the root's entries
+#define EXT2_DX_NODE      8  // offset of an interior node's entries
+#define EXT2_DX_MAX_DEPTH 2  // root plus one level of interior nodes
+
+// One level of a walk down a directory index.
+struct ext2_dx_frame
+{
+    struct buf *bp;
+    u32 lblk;
+    struct ext2_dx_entry *entries;
+    struct ext2_dx_entry *at; // entry covering the hash
+};
+
+static inline struct ext2_dx_countlimit *ext2_dx_countlimit(struct ext2_dx_entry *entries)
+{
+    return (struct ext2_dx_countlimit *)entries;
+}
+
+static inline struct ext2_dir_entry_2 *ext2_dirent_at(u8 *block, u32 off)
+{
+    return (struct ext2_dir_entry_2 *)(block + off);
+}
+
+static u32 ext2fs_dir_blocks(struct inode *dp)
+{
+    return (dp->size + EXT2_BSIZE - 1) / EXT2_BSIZE;
+}
+
+static bool ext2fs_dx_enabled(void)
+{
+    return ext2_sb.s_rev_level >= 1 && (ext2_sb.s_feature_compat & EXT2_FEATURE_COMPAT_DIR_INDEX);
+}
+
+// Read logical block lblk of directory dp. Directories have no holes.
+static struct buf *ext2fs_dir_bread(struct inode *dp, u32 lblk)
+{
+    u32 block = ext2fs_bmap(dp, lblk, false);
+    if (block == 0) {
+        panic("ext2fs_dir_bread: hole");
+    }
+    return bread(dp->dev, block);
+}
+
+// Write a modified directory block and keep the page cache in step.
+static void ext2fs_dir_bwrite(struct inode *dp, u32 lblk, struct buf *bp)
+{
+    bwrite(bp);
+    ext2fs_page_update(dp, lblk * EXT2_BSIZE, (char *)bp->data, EXT2_BSIZE);
+}
+
+// Add an empty block to the end of directory dp.
+// Returns the locked, zeroed buffer and its logical block number in *lblk.
+// The caller must write the buffer back.
+static struct buf *ext2fs_dir_grow(struct inode *dp, u32 *lblk)
+{
+    *lblk          = ext2fs_dir_blocks(dp);
+    struct buf *bp = bgetblk(dp->dev, ext2fs_bmap(dp, *lblk, true));
+    memset(bp->data, 0, EXT2_BSIZE);
+    dp->size = (*lblk + 1) * EXT2_BSIZE;
+    dp->iops->iupdate(dp);
+    return bp;
+}
+
+// Walk the records of one directory block looking for name.
+// Returns the offset of its record, or -1. If slot is not null and no
+// slot has been found yet, *slot is set to the first record with room
+// for need more bytes.
+static int ext2fs_dir_scan(u8 *data, const char *name, u32 len, u16 need, int *slot)
 {
-    struct ext2_dir_entry_2 de;
-    char file_name[EXT2_NAME_LEN + 1];
-    for (u32 off = 0; off < dp->size;) {
-        memset(&de, 0, sizeof(de));
-        if (dp->iops->readi(dp, (char *)&de, off, 8) != 8) {
-            panic("ext2fs_dirlookup: header read");
+    for (u32 off = 0; off < EXT2_BSIZE;) {
+        struct ext2_dir_entry_2 *de = ext2_dirent_at(data, off);
+        if (de->rec_len < 8 || de->rec_len % 4 != 0 || off + de->rec_len > EXT2_BSIZE) {
+            panic("ext2fs_dir_scan: bad rec_len");
         }
-        if (de.rec_len < 8 || de.rec_len > EXT2_BSIZE) {
-            panic("ext2fs_dirlookup: bad rec_len");
+        if (de->inode != 0 && de->name_len == len && memcmp(de->name, name, len) == 0) {
+            return off;
         }
-        if (de.name_len > 0) {
-            int to_copy = de.name_len;
-            if (to_copy > EXT2_NAME_LEN) {
-                to_copy = EXT2_NAME_LEN;
-            }
-            if (dp->iops->readi(dp, (char *)de.name, off + 8, to_copy) != to_copy) {
-                panic("ext2fs_dirlookup: name read");
-            }
+        u16 used = de->inode != 0 ? ext2_dirent_size(de->name_len) : 0;
+        if (slot != nullptr && *slot < 0 && de->rec_len >= used + need) {
+            *slot = off;
+        }
+        off += de->rec_len;
+    }
+    return -1;
+}
+
+// Fill the record at off, splitting off its slack if it is in use.
+static void ext2fs_dir_insert(u8 *data, u32 off, const char *name, u32 len, u32 inum)
+{
+    struct ext2_dir_entry_2 *de = ext2_dirent_at(data, off);
+    if (de->inode != 0) {
+        u16 used                      = ext2_dirent_size(de->name_len);
+        struct ext2_dir_entry_2 *next = ext2_dirent_at(data, off + used);
+        next->rec_len                 = de->rec_len - used;
+        de->rec_len                   = used;
+        de                            = next;
+    }
+    de->inode     = inum;
+    de->name_len  = len;
+    de->file_type = EXT2_FT_UNKNOWN;
+    memmove(de->name, name, len);
+}
+
+// Hash version of an index root, or -1 if the root is not one we understand.
+static int ext2fs_dx_hash_version(const struct ext2_dx_root_info *info)
+{
+    if (info->reserved_zero != 0 || info->info_length != sizeof(*info) || info->hash_version > EXT2_HASH_TEA ||
+        info->indirect_levels >= EXT2_DX_MAX_DEPTH) {
+        return -1;
+    }
+    if (ext2_sb.s_flags & EXT2_FLAGS_UNSIGNED_HASH) {
+        return info->hash_version + EXT2_HASH_LEGACY_UNSIGNED;
+    }
+    return info->hash_version;
+}
+
+static void ext2fs_dx_release(struct ext2_dx_frame *frames, int depth)
+{
+    for (int i = 0; i < depth; i++) {
+        brelse(frames[i].bp);
+    }
+}
+
+// Point frame at the last entry whose hash is not above hash. The first
+// entry has no hash of its own and covers everything below the second.
+static bool ext2fs_dx_search(struct ext2_dx_frame *frame, u32 limit, u32 nblocks, u32 hash)
+{
+    struct ext2_dx_countlimit *cl = ext2_dx_countlimit(frame->entries);
+    if (cl->limit != limit || cl->count == 0 || cl->count > limit) {
+        return false;
+    }
+
+    u32 lo = 1;
+    u32 hi = cl->count;
+    while (lo < hi) {
+        u32 mid = (lo + hi) / 2;
+        if (frame->entries[mid].hash > hash) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    frame->at = &frame->entries[lo - 1];
+    return frame->at->block != 0 && frame->at->block < nblocks;
+}
+
+// Walk the index of dp down to the leaf that covers the hash of name.
+// On success the hash is stored in *hash, frames[] hold the locked index
+// blocks and the depth is returned; the caller releases them with
+// ext2fs_dx_release. Returns -1 if the index cannot be used.
+static int ext2fs_dx_probe(struct inode *dp, const char *name, u32 len, u32 *hash, struct ext2_dx_frame *frames)
+{
+    const u32 nblocks = ext2fs_dir_blocks(dp);
+    struct buf *bp    = ext2fs_dir_bread(dp, 0);
+    auto info         = (struct ext2_dx_root_info *)(bp->data + EXT2_DX_ROOT_INFO);
+    int version       = ext2fs_dx_hash_version(info);
+    if (version < 0) {
+        brelse(bp);
+        return -1;
+    }
+    *hash = ext2fs_dirhash(name, len, version, ext2_sb.s_hash_seed);
+
+    const int depth = info->indirect_levels + 1;
+    frames[0]       = (struct ext2_dx_frame){bp, 0, (struct ext2_dx_entry *)(bp->data + EXT2_DX_ROOT), nullptr};
+    u32 limit       = (EXT2_BSIZE - EXT2_DX_ROOT) / sizeof(struct ext2_dx_entry);
+    for (int i = 0;; i++) {
+        if (!ext2fs_dx_search(&frames[i], limit, nblocks, *hash)) {
+            ext2fs_dx_release(frames, i + 1);
+            return -1;
+        }
+        if (i + 1 == depth) {
+            return depth;
+        }
+        u32 lblk      = frames[i].at->block;
+        bp            = ext2fs_dir_bread(dp, lblk);
+        frames[i + 1] = (struct ext2_dx_frame){bp, lblk, (struct ext2_dx_entry *)(bp->data + EXT2_DX_NODE), nullptr};
+        limit         = (EXT2_BSIZE - EXT2_DX_NODE) / sizeof(struct ext2_dx_entry);
+    }
+}
+
+// Move frames to the next leaf if it continues the run of names with
+// this hash; a split between equal hashes sets the low bit of the next
+// leaf's hash. Returns false when there is nothing more to search.
+static bool ext2fs_dx_next_leaf(struct inode *dp, struct ext2_dx_frame *frames, int depth, u32 hash)
+{
+    int i = depth - 1;
+    while (frames[i].at + 1 >= frames[i].entries + ext2_dx_countlimit(frames[i].entries)->count) {
+        if (i == 0) {
+            return false;
         }
-        if (de.inode == 0) {
-            off += de.rec_len;
+        i--;
+    }
+    frames[i].at++;
+    if ((frames[i].at->hash & ~1U) != hash) {
+        return false;
+    }
+    for (; i + 1 < depth; i++) {
+        u32 lblk = frames[i].at->block;
+        if (lblk == 0 || lblk >= ext2fs_dir_blocks(dp)) {
+            return false;
+        }
+        brelse(frames[i + 1].bp);
+        frames[i + 1].bp      = ext2fs_dir_bread(dp, lblk);
+        frames[i + 1].lblk    = lblk;
+        frames[i + 1].entries = (struct ext2_dx_entry *)(frames[i + 1].bp->data + EXT2_DX_NODE);
+        frames[i + 1].at      = frames[i + 1].entries;
+    }
+    return true;
+}
+
+// Look name up through the index of dp.
+// Returns 1 and fills *inum and *poff if found, 0 if not, -1 if the
+// index cannot be used.
+static int ext2fs_dx_find(struct inode *dp, const char *name, u32 len, u32 *inum, u32 *poff)
+{
+    struct ext2_dx_frame frames[EXT2_DX_MAX_DEPTH];
+    u32 hash;
+    const int depth = ext2fs_dx_probe(dp, name, len, &hash, frames);
+    if (depth < 0) {
+        return -1;
+    }
+
+    int found = 0;
+    do {
+        u32 lblk       = frames[depth - 1].at->block;
+        struct buf *bp = ext2fs_dir_bread(dp, lblk);
+        int off        = ext2fs_dir_scan(bp->data, name, len, 0, nullptr);
+        if (off >= 0) {
+            *inum = ext2_dirent_at(bp->data, off)->inode;
+            *poff = lblk * EXT2_BSIZE + off;
+            found = 1;
+        }
+        brelse(bp);
+    } while (!found && ext2fs_dx_next_leaf(dp, frames, depth, hash));
+
+    ext2fs_dx_release(frames, depth);
+    return found;
+}
+
+// Look name up by reading every block of dp.
+static bool ext2fs_dir_find(struct inode *dp, const char *name, u32 len, u32 *inum, u32 *poff)
+{
+    const u32 nblocks = ext2fs_dir_blocks(dp);
+    for (u32 lblk = 0; lblk < nblocks; lblk++) {
+        struct buf *bp = ext2fs_dir_bread(dp, lblk);
+        int off        = ext2fs_dir_scan(bp->data, name, len, 0, nullptr);
+        if (off >= 0) {
+            *inum = ext2_dirent_at(bp->data, off)->inode;
+            *poff = lblk * EXT2_BSIZE + off;
+            brelse(bp);
+            return true;
+        }
+        brelse(bp);
+    }
+    return false;
+}
+
+// Insert a new entry after frame->at.
+static void ext2fs_dx_insert(struct ext2_dx_frame *frame, u32 hash, u32 lblk)
+{
+    struct ext2_dx_countlimit *cl = ext2_dx_countlimit(frame->entries);
+    struct ext2_dx_entry *end     = frame->entries + cl->count;
+    struct ext2_dx_entry *new     = frame->at + 1;
+
+    memmove(new + 1, new, (end - new) * sizeof(*new));
+    new->hash  = hash;
+    new->block = lblk;
+    cl->count++;
+}
+
+// Copy the live records of a leaf listed in map[from..to) into dst,
+// packed from the start, with the last record running to the block end.
+struct ext2_dx_map
+{
+    u32 hash;
+    u16 off;
+    u16 size;
+};
+
+static void ext2fs_dx_pack(u8 *dst, const u8 *src, const struct ext2_dx_map *map, u32 from, u32 to)
+{
+    u32 off                       = 0;
+    struct ext2_dir_entry_2 *last = nullptr;
+    for (u32 i = from; i < to; i++) {
+        memmove(dst + off, src + map[i].off, map[i].size);
+        last          = ext2_dirent_at(dst, off);
+        last->rec_len = map[i].size;
+        off += map[i].size;
+    }
+    if (last != nullptr) {
+        last->rec_len += EXT2_BSIZE - off;
+    } else {
+        ext2_dirent_at(dst, 0)->inode   = 0;
+        ext2_dirent_at(dst, 0)->rec_len = EXT2_BSIZE;
+    }
+}
+
+// Make room for a record of size need in a full leaf. If packing the
+// leaf frees enough space that is all it does; otherwise the upper half
+// of its names by hash move to a new leaf, which gets an entry in frame.
+// Returns the buffer and logical block the name with this hash belongs
+// in; the other buffer is released. Returns nullptr if memory is short.
+static struct buf *ext2fs_dx_split_leaf(struct inode *dp, struct ext2_dx_frame *frame, struct buf *bp, u32 *lblk,
+                                        u32 hash, u16 need, int version)
+{
+    auto map = (struct ext2_dx_map *)kalloc_page();
+    u8 *copy = (u8 *)kalloc_page();
+    if (map == nullptr || copy == nullptr) {
+        if (map != nullptr) {
+            kfree_page((char *)map);
+        }
+        if (copy != nullptr) {
+            kfree_page((char *)copy);
+        }
+        brelse(bp);
+        return nullptr;
+    }
+    memmove(copy, bp->data, EXT2_BSIZE);
+
+    u32 count = 0;
+    u32 used  = 0;
+    for (u32 off = 0; off < EXT2_BSIZE; off += ext2_dirent_at(copy, off)->rec_len) {
+        struct ext2_dir_entry_2 *de = ext2_dirent_at(copy, off);
+        if (de->inode == 0) {
             continue;
         }
-        if (de.name_len > EXT2_NAME_LEN)
-            panic("ext2fs_dirlookup: name too long");
-        memmove(file_name, de.name, de.name_len);
-        file_name[de.name_len] = '\0';
-        if (ext2fs_namecmp(name, file_name) == 0) {
-            if (poff) {
-                *poff = off;
+        u32 h = ext2fs_dirhash(de->name, de->name_len, version, ext2_sb.s_hash_seed);
+        u32 i = count++;
+        // Insertion sort by hash; leaves hold a few dozen names.
+        for (; i > 0 && map[i - 1].hash > h; i--) {
+            map[i] = map[i - 1];
+        }
+        map[i] = (struct ext2_dx_map){h, off, ext2_dirent_size(de->name_len)};
+        used += map[i].size;
+    }
+
+    if (count < 2 || used + need <= EXT2_BSIZE) {
+        ext2fs_dx_pack(bp->data, copy, map, 0, count);
+        ext2fs_dir_bwrite(dp, *lblk, bp);
+        kfree_page((char *)map);
+        kfree_page((char *)copy);
+        return bp;
+    }
+
+    const u32 split = count / 2;
+    u32 hash2       = map[split].hash;
+    if (hash2 == map[split - 1].hash) {
+        hash2 |= 1;
+    }
+
+    u32 new_lblk;
+    struct buf *nbp = ext2fs_dir_grow(dp, &new_lblk);
+    ext2fs_dx_pack(nbp->data, copy, map, split, count);
+    ext2fs_dx_pack(bp->data, copy, map, 0, split);
+    ext2fs_dir_bwrite(dp, new_lblk, nbp);
+    ext2fs_dir_bwrite(dp, *lblk, bp);
+    kfree_page((char *)map);
+    kfree_page((char *)copy);
+
+    ext2fs_dx_insert(frame, hash2, new_lblk);
+    ext2fs_dir_bwrite(dp, frame->lblk, frame->bp);
+
+    if (hash >= (hash2 & ~1U)) {
+        brelse(bp);
+        *lblk = new_lblk;
+        return nbp;
+    }
+    brelse(nbp);
+    return bp;
+}
+
+// Make room in the bottom level of a full index. A full root moves its
+// entries into a new interior node; a full interior node is split in two
+// if the root can take another entry. Returns false if the index is at
+// its maximum size.
+static bool ext2fs_dx_grow_index(struct inode *dp, struct ext2_dx_frame *frames, int depth)
+{
+    struct ext2_dx_frame *root         = &frames[0];
+    auto info                          = (struct ext2_dx_root_info *)(root->bp->data + EXT2_DX_ROOT_INFO);
+    struct ext2_dx_countlimit *root_cl = ext2_dx_countlimit(root->entries);
+    const u16 node_limit               = (EXT2_BSIZE - EXT2_DX_NODE) / sizeof(struct ext2_dx_entry);
+
+    if (depth == 1) {
+        u32 lblk;
+        struct buf *nbp                       = ext2fs_dir_grow(dp, &lblk);
+        ext2_dirent_at(nbp->data, 0)->rec_len = EXT2_BSIZE;
+        auto entries                          = (struct ext2_dx_entry *)(nbp->data + EXT2_DX_NODE);
+        memmove(entries, root->entries, root_cl->count * sizeof(*entries));
+        ext2_dx_countlimit(entries)->limit = node_limit;
+        ext2fs_dir_bwrite(dp, lblk, nbp);
+        brelse(nbp);
+
+        root_cl->count         = 1;
+        root->entries[0].block = lblk;
+        info->indirect_levels  = 1;
+        ext2fs_dir_bwrite(dp, 0, root->bp);
+        return true;
+    }
+
+    if (root_cl->count >= root_cl->limit) {
+        return false;
+    }
+
+    struct ext2_dx_frame *node    = &frames[1];
+    struct ext2_dx_countlimit *cl = ext2_dx_countlimit(node->entries);
+    const u16 split               = cl->count / 2;
+    const u16 moved               = cl->count - split;
+    const u32 hash2               = node->entries[split].hash;
+
+    u32 lblk;
+    struct buf *nbp                       = ext2fs_dir_grow(dp, &lblk);
+    ext2_dirent_at(nbp->data, 0)->rec_len = EXT2_BSIZE;
+    auto entries                          = (struct ext2_dx_entry *)(nbp->data + EXT2_DX_NODE);
+    memmove(entries, node->entries + split, moved * sizeof(*entries));
+    ext2_dx_countlimit(entries)->limit = node_limit;
+    ext2_dx_countlimit(entries)->count = moved;
+    ext2fs_dir_bwrite(dp, lblk, nbp);
+    brelse(nbp);
+
+    cl->count = split;
+    ext2fs_dir_bwrite(dp, node->lblk, node->bp);
+
+    ext2fs_dx_insert(root, hash2, lblk);
+    ext2fs_dir_bwrite(dp, 0, root->bp);
+    return true;
+}
+
+// Add name to an indexed directory. The caller has checked that the
+// name is not there yet. Returns false if the index cannot take it.
+static bool ext2fs_dx_add(struct inode *dp, const char *name, u32 len, u32 inum)
+{
+    const u16 need = ext2_dirent_size(len);
+
+    for (;;) {
+        struct ext2_dx_frame frames[EXT2_DX_MAX_DEPTH];
+        u32 hash;
+        const int depth = ext2fs_dx_probe(dp, name, len, &hash, frames);
+        if (depth < 0) {
+            return false;
+        }
+
+        struct ext2_dx_frame *bottom = &frames[depth - 1];
+        u32 lblk                     = bottom->at->block;
+        struct buf *bp               = ext2fs_dir_bread(dp, lblk);
+        int slot                     = -1;
+        ext2fs_dir_scan(bp->data, name, len, need, &slot);
+
+        if (slot < 0) {
+            struct ext2_dx_countlimit *cl = ext2_dx_countlimit(bottom->entries);
+            if (cl->count >= cl->limit) {
+                brelse(bp);
+                bool grown = ext2fs_dx_grow_index(dp, frames, depth);
+                ext2fs_dx_release(frames, depth);
+                if (!grown) {
+                    return false;
+                }
+                continue;
+            }
+            int version = ext2fs_dx_hash_version((struct ext2_dx_root_info *)(frames[0].bp->data + EXT2_DX_ROOT_INFO));
+            bp          = ext2fs_dx_split_leaf(dp, bottom, bp, &lblk, hash, need, version);
+            if (bp == nullptr) {
+                ext2fs_dx_release(frames, depth);
+                return false;
+            }
+            ext2fs_dir_scan(bp->data, name, len, need, &slot);
+            if (slot < 0) {
+                panic("ext2fs_dx_add: no room after split");
             }
-            return iget(dp->dev, de.inode);
         }
-        off += de.rec_len;
+
+        ext2fs_dir_insert(bp->data, slot, name, len, inum);
+        ext2fs_dir_bwrite(dp, lblk, bp);
+        brelse(bp);
+        ext2fs_dx_release(frames, depth);
+        return true;
+    }
+}
+
+// Turn a one-block directory that has just filled up into an indexed
+// one: the names move to a new leaf and block 0 becomes the index root.
+// Returns false if block 0 does not start with "." and "..".
+static bool ext2fs_dx_make_index(struct inode *dp)
+{
+    struct buf *bp               = ext2fs_dir_bread(dp, 0);
+    struct ext2_dir_entry_2 *dot = ext2_dirent_at(bp->data, 0);
+    if (dot->rec_len != ext2_dirent_size(1) || dot->name_len != 1 || dot->name[0] != '.') {
+        brelse(bp);
+        return false;
+    }
+    struct ext2_dir_entry_2 *dotdot = ext2_dirent_at(bp->data, dot->rec_len);
+    if (dotdot->name_len != 2 || dotdot->name[0] != '.' || dotdot->name[1] != '.') {
+        brelse(bp);
+        return false;
+    }
+
+    u32 lblk;
+    struct buf *nbp = ext2fs_dir_grow(dp, &lblk);
+    u32 from        = dot->rec_len + dotdot->rec_len;
+    memmove(nbp->data, bp->data + from, EXT2_BSIZE - from);
+    // The last record now ends short of the block; stretch it.
+    u32 off = 0;
+    while (off + ext2_dirent_at(nbp->data, off)->rec_len < EXT2_BSIZE - from) {
+        off += ext2_dirent_at(nbp->data, off)->rec_len;
     }
-    return nullptr;
+    ext2_dirent_at(nbp->data, off)->rec_len = EXT2_BSIZE - off;
+    ext2fs_dir_bwrite(dp, lblk, nbp);
+    brelse(nbp);
+
+    dotdot->rec_len = EXT2_BSIZE - dot->rec_len;
+    memset(bp->data + EXT2_DX_ROOT_INFO, 0, EXT2_BSIZE - EXT2_DX_ROOT_INFO);
+    auto info          = (struct ext2_dx_root_info *)(bp->data + EXT2_DX_ROOT_INFO);
+    info->hash_version = ext2_sb.s_def_hash_version <= EXT2_HASH_TEA ? ext2_sb.s_def_hash_version : EXT2_HASH_HALF_MD4;
+    info->info_length  = sizeof(*info);
+
+    auto entries     = (struct ext2_dx_entry *)(bp->data + EXT2_DX_ROOT);
+    auto cl          = ext2_dx_countlimit(entries);
+    cl->limit        = (EXT2_BSIZE - EXT2_DX_ROOT) / sizeof(*entries);
+    cl->count        = 1;
+    entries[0].block = lblk;
+    ext2fs_dir_bwrite(dp, 0, bp);
+    brelse(bp);
+
+    dp->i_flags |= EXT2_INDEX_FL;
+    dp->iops->iupdate(dp);
+    return true;
+}
+
+// Stop using a directory's index. Its blocks read as ordinary, if
+// sparse, directory blocks afterwards.
+static void ext2fs_dx_drop_index(struct inode *dp)
+{
+    dp->i_flags &= ~EXT2_INDEX_FL;
+    dp->iops->iupdate(dp);
+}
+
+struct inode *ext2fs_dirlookup(struct inode *dp, char *name, u32 *poff)
+{
+    const u32 len = strlen(name);
+    if (len == 0 || len > EXT2_NAME_LEN) {
+        return nullptr;
+    }
+
+    u32 inum;
+    u32 off;
+    int found = -1;
+    if (dp->i_flags & EXT2_INDEX_FL) {
+        found = ext2fs_dx_find(dp, name, len, &inum, &off);
+    }
+    if (found < 0) {
+        found = ext2fs_dir_find(dp, name, len, &inum, &off);
+    }
+    if (!found) {
+        return nullptr;
+    }
+    if (poff) {
+        *poff = off;
+    }
+    return iget(dp->dev, inum);
 }
 
 int ext2fs_dirlink(struct inode *dp, char *name, u32 inum)
@@ -736,30 +2187,133 @@ int ext2fs_dirlink(struct inode *dp, char *name, u32 inum)
         return -1;
     }
 
-    int name_len = strlen(name);
-    if (name_len <= 0 || name_len > EXT2_NAME_LEN) {
+    const u32 len = strlen(name);
+    if (len == 0 || len > EXT2_NAME_LEN) {
         return -1;
     }
 
-    struct ext2_dir_entry_2 de;
-    struct inode *ip;
+    u32 found_inum;
+    u32 off;
+    if (dp->i_flags & EXT2_INDEX_FL) {
+        int found = ext2fs_dx_find(dp, name, len, &found_inum, &off);
+        if (found > 0) {
+            return -1;
+        }
+        if (found == 0 && ext2fs_dx_add(dp, name, len, inum)) {
+            return 0;
+        }
+        ext2fs_dx_drop_index(dp);
+    }
 
-    if ((ip = dp->iops->dirlookup(dp, name, nullptr)) != nullptr) {
-        ip->iops->iput(ip);
-        return -1;
+    // One pass over the blocks both checks for the name and finds room.
+    const u16 need    = ext2_dirent_size(len);
+    const u32 nblocks = ext2fs_dir_blocks(dp);
+    int slot          = -1;
+    u32 lblk          = 0;
+    for (u32 b = 0; b < nblocks; b++) {
+        struct buf *bp = ext2fs_dir_bread(dp, b);
+        int s          = slot;
+        int found      = ext2fs_dir_scan(bp->data, name, len, need, &s);
+        brelse(bp);
+        if (found >= 0) {
+            return -1;
+        }
+        if (slot < 0 && s >= 0) {
+            slot = s;
+            lblk = b;
+        }
     }
 
-    u32 off     = dp->size;
-    u16 rec_len = ext2_dirent_size((u8)name_len);
+    struct buf *bp;
+    if (slot >= 0) {
+        bp = ext2fs_dir_bread(dp, lblk);
+    } else if (nblocks == 1 && ext2fs_dx_enabled() && ext2fs_dx_make_index(dp)) {
+        if (!ext2fs_dx_add(dp, name, len, inum)) {
+            panic("ext2fs_dirlink: new index");
+        }
+        return 0;
+    } else {
+        bp                                   = ext2fs_dir_grow(dp, &lblk);
+        ext2_dirent_at(bp->data, 0)->rec_len = EXT2_BSIZE;
+        slot                                 = 0;
+    }
 
-    memset(&de, 0, sizeof(de));
-    de.inode     = inum;
-    de.rec_len   = rec_len;
-    de.name_len  = name_len;
-    de.file_type = EXT2_FT_UNKNOWN;
-    memmove(de.name, name, name_len);
+    ext2fs_dir_insert(bp->data, slot, name, len, inum);
+    ext2fs_dir_bwrite(dp, lblk, bp);
+    brelse(bp);
+    return 0;
+}
 
-    dp->iops->writei(dp, (char *)&de, off, rec_len);
+static u8 ext2fs_dirent_type(u8 file_type)
+{
+    switch (file_type) {
+    case EXT2_FT_REG_FILE:
+        return DT_REG;
+    case EXT2_FT_DIR:
+        return DT_DIR;
+    case EXT2_FT_CHRDEV:
+        return DT_CHR;
+    case EXT2_FT_BLKDEV:
+        return DT_BLK;
+    case EXT2_FT_FIFO:
+        return DT_FIFO;
+    case EXT2_FT_SOCK:
+        return DT_SOCK;
+    case EXT2_FT_SYMLINK:
+        return DT_LNK;
+    default:
+        return DT_UNKNOWN;
+    }
+}
 
-    return 0;
-}
\ No newline at end of file
+/**
+ * @brief Copy directory entries starting at *off into dst as struct dirent records.
+ *
+ * Entries are taken a block at a time from the buffer cache. *off is the
+ * directory offset to resume from and is advanced past the last entry
+ * returned. An offset inside a record resumes at the next record.
+ *
+ * @return Bytes stored in dst, 0 at the end of the directory, or -1 if
+ *         dst cannot hold the next entry.
+ */
+int ext2fs_getdents(struct inode *dp, char *dst, u32 n, u32 *off)
+{
+    const u32 nblocks = ext2fs_dir_blocks(dp);
+    u32 pos           = *off;
+    u32 copied        = 0;
+
+    for (u32 lblk = pos / EXT2_BSIZE; lblk < nblocks; lblk++) {
+        struct buf *bp = ext2fs_dir_bread(dp, lblk);
+        for (u32 rec = 0; rec < EXT2_BSIZE;) {
+            struct ext2_dir_entry_2 *de = ext2_dirent_at(bp->data, rec);
+            if (de->rec_len < 8 || de->rec_len % 4 != 0 || rec + de->rec_len > EXT2_BSIZE) {
+                panic("ext2fs_getdents: bad rec_len");
+            }
+            const u32 here = lblk * EXT2_BSIZE + rec;
+            rec += de->rec_len;
+            if (here < pos || de->inode == 0) {
+                continue;
+            }
+
+            const u16 reclen = DIRENT_RECLEN(de->name_len);
+            if (copied + reclen > n) {
+                brelse(bp);
+                *off = here;
+                return copied > 0 ? (int)copied : -1;
+            }
+            auto d      = (struct dirent *)(dst + copied);
+            d->d_ino    = de->inode;
+            d->d_off    = lblk * EXT2_BSIZE + rec;
+            d->d_reclen = reclen;
+            d->d_type   = ext2fs_dirent_type(de->file_type);
+            d->d_namlen = de->name_len;
+            memmove(d->d_name, de->name, de->name_len);
+            d->d_name[de->name_len] = '\0';
+            copied += reclen;
+        }
+        brelse(bp);
+    }
+
+    *off = nblocks * EXT2_BSIZE;
+    return (int)copied;
+}
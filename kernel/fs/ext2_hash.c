@@ -0,0 +1,183 @@
+// Directory index hashes.
+//
+// Indexed ext2 directories order their leaves by a 32-bit hash of each
+// name. The hash functions must match the ones e2fsprogs and Linux use
+// bit for bit, or directories written by one cannot be searched by the
+// other: the old "legacy" hash, a cut-down MD4 and TEA. Each comes in a
+// signed and an unsigned flavour that differ only in how bytes above
+// 0x7f are widened, which the superblock's s_flags selects.
+
+#include "types.h"
+#include "ext2.h"
+
+#define TEA_DELTA 0x9E3779B9
+
+static inline u32 rol32(u32 word, unsigned int shift)
+{
+    return (word << shift) | (word >> (32 - shift));
+}
+
+static void tea_transform(u32 buf[4], const u32 in[4])
+{
+    u32 sum = 0;
+    u32 b0  = buf[0], b1 = buf[1];
+    u32 a   = in[0], b = in[1], c = in[2], d = in[3];
+
+    for (int n = 16; n > 0; n--) {
+        sum += TEA_DELTA;
+        b0 += ((b1 << 4) + a) ^ (b1 + sum) ^ ((b1 >> 5) + b);
+        b1 += ((b0 << 4) + c) ^ (b0 + sum) ^ ((b0 >> 5) + d);
+    }
+    buf[0] += b0;
+    buf[1] += b1;
+}
+
+#define F(x, y, z)                ((z) ^ ((x) & ((y) ^ (z))))
+#define G(x, y, z)                (((x) & (y)) + (((x) ^ (y)) & (z)))
+#define H(x, y, z)                ((x) ^ (y) ^ (z))
+#define ROUND(f, a, b, c, d, x, s) (a += f(b, c, d) + x, a = rol32(a, s))
+#define K1                        0
+#define K2                        013240474631U
+#define K3                        015666365641U
+
+// MD4 with its rounds cut down to eight steps each.
+static void half_md4_transform(u32 buf[4], const u32 in[8])
+{
+    u32 a = buf[0], b = buf[1], c = buf[2], d = buf[3];
+
+    ROUND(F, a, b, c, d, in[0] + K1, 3);
+    ROUND(F, d, a, b, c, in[1] + K1, 7);
+    ROUND(F, c, d, a, b, in[2] + K1, 11);
+    ROUND(F, b, c, d, a, in[3] + K1, 19);
+    ROUND(F, a, b, c, d, in[4] + K1, 3);
+    ROUND(F, d, a, b, c, in[5] + K1, 7);
+    ROUND(F, c, d, a, b, in[6] + K1, 11);
+    ROUND(F, b, c, d, a, in[7] + K1, 19);
+
+    ROUND(G, a, b, c, d, in[1] + K2, 3);
+    ROUND(G, d, a, b, c, in[3] + K2, 5);
+    ROUND(G, c, d, a, b, in[5] + K2, 9);
+    ROUND(G, b, c, d, a, in[7] + K2, 13);
+    ROUND(G, a, b, c, d, in[0] + K2, 3);
+    ROUND(G, d, a, b, c, in[2] + K2, 5);
+    ROUND(G, c, d, a, b, in[4] + K2, 9);
+    ROUND(G, b, c, d, a, in[6] + K2, 13);
+
+    ROUND(H, a, b, c, d, in[3] + K3, 3);
+    ROUND(H, d, a, b, c, in[7] + K3, 9);
+    ROUND(H, c, d, a, b, in[2] + K3, 11);
+    ROUND(H, b, c, d, a, in[6] + K3, 15);
+    ROUND(H, a, b, c, d, in[1] + K3, 3);
+    ROUND(H, d, a, b, c, in[5] + K3, 9);
+    ROUND(H, c, d, a, b, in[0] + K3, 11);
+    ROUND(H, b, c, d, a, in[4] + K3, 15);
+
+    buf[0] += a;
+    buf[1] += b;
+    buf[2] += c;
+    buf[3] += d;
+}
+
+// Widen one name byte the way the selected hash flavour does.
+static inline u32 hash_char(const char *name, u32 i, bool is_unsigned)
+{
+    return is_unsigned ? (u32)(unsigned char)name[i] : (u32)(int)(signed char)name[i];
+}
+
+static u32 dx_hack_hash(const char *name, u32 len, bool is_unsigned)
+{
+    u32 hash;
+    u32 hash0 = 0x12a3fe2d;
+    u32 hash1 = 0x37abe8f9;
+
+    for (u32 i = 0; i < len; i++) {
+        hash = hash1 + (hash0 ^ (hash_char(name, i, is_unsigned) * 7152373));
+        if (hash & 0x80000000) {
+            hash -= 0x7fffffff;
+        }
+        hash1 = hash0;
+        hash0 = hash;
+    }
+    return hash0 << 1;
+}
+
+// Pack up to num*4 bytes of name into buf, padding with the length.
+static void str2hashbuf(const char *name, u32 len, u32 *buf, int num, bool is_unsigned)
+{
+    u32 pad = len | (len << 8);
+    pad |= pad << 16;
+
+    u32 val = pad;
+    if (len > (u32)num * 4) {
+        len = num * 4;
+    }
+    for (u32 i = 0; i < len; i++) {
+        val = hash_char(name, i, is_unsigned) + (val << 8);
+        if (i % 4 == 3) {
+            *buf++ = val;
+            val    = pad;
+            num--;
+        }
+    }
+    if (--num >= 0) {
+        *buf++ = val;
+    }
+    while (--num >= 0) {
+        *buf++ = pad;
+    }
+}
+
+/**
+ * @brief Hash a directory entry name for the directory index.
+ *
+ * @param name Name, not NUL terminated.
+ * @param len Length of the name.
+ * @param version One of the EXT2_HASH_* versions.
+ * @param seed Superblock hash seed; all zeros selects the default seed.
+ * @return Hash with the low bit clear, or 0 for an unknown version.
+ */
+u32 ext2fs_dirhash(const char *name, u32 len, int version, const u32 seed[4])
+{
+    u32 buf[4] = {0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476};
+    u32 in[8];
+    u32 hash;
+
+    if (seed != nullptr && (seed[0] | seed[1] | seed[2] | seed[3]) != 0) {
+        for (int i = 0; i < 4; i++) {
+            buf[i] = seed[i];
+        }
+    }
+
+    const bool is_unsigned = version >= EXT2_HASH_LEGACY_UNSIGNED;
+    switch (version) {
+    case EXT2_HASH_LEGACY:
+    case EXT2_HASH_LEGACY_UNSIGNED:
+        hash = dx_hack_hash(name, len, is_unsigned);
+        break;
+    case EXT2_HASH_HALF_MD4:
+    case EXT2_HASH_HALF_MD4_UNSIGNED:
+        for (int left = (int)len; left > 0; left -= 32, name += 32) {
+            str2hashbuf(name, left, in, 8, is_unsigned);
+            half_md4_transform(buf, in);
+        }
+        hash = buf[1];
+        break;
+    case EXT2_HASH_TEA:
+    case EXT2_HASH_TEA_UNSIGNED:
+        for (int left = (int)len; left > 0; left -= 16, name += 16) {
+            str2hashbuf(name, left, in, 4, is_unsigned);
+            tea_transform(buf, in);
+        }
+        hash = buf[0];
+        break;
+    default:
+        return 0;
+    }
+
+    hash &= ~1U;
+    // 0xfffffffe marks the end of a readdir stream and is never a name's hash.
+    if (hash == 0xfffffffe) {
+        hash = 0xfffffffc;
+    }
+    return hash;
+}
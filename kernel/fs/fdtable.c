@@ -0,0 +1,196 @@
+// Per-process file descriptor tables.
+//
+// Descriptor i of a process is in fdtable_slot(fdt, i); bit i of fdt->open says
+// whether it is in use. New descriptors get the lowest free number, found
+// by scanning the bitmap a word at a time from fdt->next, below which no
+// descriptor is free. A table that fills up moves to pages from the page
+// allocator and grows a page at a time, up to NOFILE_MAX.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "fdtable.h"
+#include "proc.h"
+#include "string.h"
+
+/** @brief Set up an empty table using its built-in arrays. */
+void fdtable_init(struct fdtable *fdt)
+{
+    fdt->max  = NOFILE;
+    fdt->next = 0;
+    fdt->open = fdt->open_array;
+    memset(fdt->fd_pages, 0, sizeof(fdt->fd_pages));
+    memset(fdt->fd_array, 0, sizeof(fdt->fd_array));
+    memset(fdt->open_array, 0, sizeof(fdt->open_array));
+}
+
+// Where descriptor i of fdt is stored; i must be below fdt->max.
+static struct file **fdtable_slot(struct fdtable *fdt, u32 i)
+{
+    if (fdt->open == fdt->open_array) {
+        return &fdt->fd_array[i];
+    }
+    return &fdt->fd_pages[i / FDT_PER_PAGE][i % FDT_PER_PAGE];
+}
+
+static char *fdtable_zalloc_page(void)
+{
+    char *page = kalloc_page();
+    if (page != nullptr) {
+        memset(page, 0, PGSIZE);
+    }
+    return page;
+}
+
+// Make room for at least n descriptors. Returns 0, or -1 if n is above
+// NOFILE_MAX or there is no memory.
+static int fdtable_grow(struct fdtable *fdt, u32 n)
+{
+    if (n <= fdt->max) {
+        return 0;
+    }
+    if (n > NOFILE_MAX) {
+        return -1;
+    }
+    const u32 npages = (n + FDT_PER_PAGE - 1) / FDT_PER_PAGE;
+
+    // Pages added here stay in fd_pages even if a later one fails; they
+    // are freed with the rest of the table.
+    for (u32 i = 0; i < npages; i++) {
+        if (fdt->fd_pages[i] == nullptr && (fdt->fd_pages[i] = (struct file **)fdtable_zalloc_page()) == nullptr) {
+            return -1;
+        }
+    }
+    if (fdt->open == fdt->open_array) {
+        u32 *open = (u32 *)fdtable_zalloc_page();
+        if (open == nullptr) {
+            return -1;
+        }
+        memmove(fdt->fd_pages[0], fdt->fd_array, sizeof(fdt->fd_array));
+        memmove(open, fdt->open_array, sizeof(fdt->open_array));
+        fdt->open = open;
+    }
+    fdt->max = npages * FDT_PER_PAGE;
+    return 0;
+}
+
+// Give back the pages of a table that has grown.
+static void fdtable_free_pages(struct fdtable *fdt)
+{
+    for (u32 i = 0; i < NOFILE_MAX / FDT_PER_PAGE; i++) {
+        if (fdt->fd_pages[i] != nullptr) {
+            kfree_page((char *)fdt->fd_pages[i]);
+        }
+    }
+    if (fdt->open != fdt->open_array) {
+        kfree_page((char *)fdt->open);
+    }
+}
+
+// Lowest free descriptor, or fdt->max if every one is in use.
+static u32 fdtable_find_free(struct fdtable *fdt)
+{
+    for (u32 w = fdt->next / 32; w < fdt->max / 32; w++) {
+        u32 used = fdt->open[w];
+        if (w == fdt->next / 32) {
+            used |= (1u << (fdt->next % 32)) - 1;
+        }
+        if (used != ~0u) {
+            return w * 32 + __builtin_ctz(~used);
+        }
+    }
+    return fdt->max;
+}
+
+/**
+ * @brief Give child a copy of parent's descriptors, as fork does.
+ *
+ * @return 0, or -1 if there is no memory for the table.
+ */
+int fdtable_copy(struct fdtable *child, struct fdtable *parent)
+{
+    if (fdtable_grow(child, parent->max) < 0) {
+        fdtable_free_pages(child);
+        fdtable_init(child);
+        return -1;
+    }
+    for (u32 w = 0; w < parent->max / 32; w++) {
+        child->open[w] = parent->open[w];
+        for (u32 bits = parent->open[w]; bits != 0; bits &= bits - 1) {
+            const u32 i             = w * 32 + __builtin_ctz(bits);
+            *fdtable_slot(child, i) = file_dup(*fdtable_slot(parent, i));
+        }
+    }
+    child->next = parent->next;
+    return 0;
+}
+
+/** @brief Close every descriptor and shrink the table back to its built-in arrays. */
+void fdtable_close_all(struct fdtable *fdt)
+{
+    for (u32 w = 0; w < fdt->max / 32; w++) {
+        for (u32 bits = fdt->open[w]; bits != 0; bits &= bits - 1) {
+            file_close(*fdtable_slot(fdt, w * 32 + __builtin_ctz(bits)));
+        }
+    }
+    fdtable_free_pages(fdt);
+    fdtable_init(fdt);
+}
+
+/**
+ * @brief Look up a descriptor of the current process.
+ *
+ * @return The open file, or nullptr if fd is not open.
+ */
+struct file *fd_get(int fd)
+{
+    struct fdtable *fdt = &current_process()->fdt;
+
+    if (fd < 0 || (u32)fd >= fdt->max) {
+        return nullptr;
+    }
+    return *fdtable_slot(fdt, fd);
+}
+
+/**
+ * @brief Open f as the lowest free descriptor of the current process.
+ *
+ * Takes over the caller's reference on success.
+ *
+ * @return The descriptor, or -1 if the process has NOFILE_MAX open.
+ */
+int fd_install(struct file *f)
+{
+    struct fdtable *fdt = &current_process()->fdt;
+
+    u32 fd = fdtable_find_free(fdt);
+    if (fd == fdt->max && fdtable_grow(fdt, fdt->max + 1) < 0) {
+        return -1;
+    }
+    *fdtable_slot(fdt, fd) = f;
+    fdt->open[fd / 32] |= 1u << (fd % 32);
+    fdt->next = fd + 1;
+    return fd;
+}
+
+/**
+ * @brief Close descriptor fd of the current process without dropping the file.
+ *
+ * @return The file that was open as fd, or nullptr. The caller owns its
+ *         reference.
+ */
+struct file *fd_remove(int fd)
+{
+    struct fdtable *fdt = &current_process()->fdt;
+
+    struct file *f = fd_get(fd);
+    if (f == nullptr) {
+        return nullptr;
+    }
+    *fdtable_slot(fdt, fd) = nullptr;
+    fdt->open[fd / 32] &= ~(1u << (fd % 32));
+    if ((u32)fd < fdt->next) {
+        fdt->next = fd;
+    }
+    return f;
+}
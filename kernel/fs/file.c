@@ -9,38 +9,46 @@
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "file.h"
+#include "mmu.h"
+#include "pagecache.h"
+#include "shm.h"
+#include "slab.h"
 
 #include "fcntl.h"
+#include "poll.h"
+#include "sys/uio.h"
 #include "proc.h"
+#include "status.h"
+#include "devtab.h"
+
+#define min(a, b) ((a) < (b) ? (a) : (b))
 
 struct devsw devsw[NDEV];
 
+// Open files come from a slab, so there is no system-wide limit on
+// them; the lock protects their reference counts.
 struct
 {
     struct spinlock lock;
-    struct file file[NFILE];
+    struct kmem_cache cache;
 } ftable;
 
 
 void file_init(void)
 {
     initlock(&ftable.lock, "ftable");
+    kmem_cache_init(&ftable.cache, "file", sizeof(struct file));
 }
 
 // Allocate a file structure.
 struct file *file_alloc(void)
 {
-
-    acquire(&ftable.lock);
-    for (struct file *f = ftable.file; f < ftable.file + NFILE; f++) {
-        if (f->ref == 0) {
-            f->ref = 1;
-            release(&ftable.lock);
-            return f;
-        }
+    struct file *f = kmem_cache_alloc(&ftable.cache);
+    if (f == nullptr) {
+        return nullptr;
     }
-    release(&ftable.lock);
-    return nullptr;
+    f->ref = 1;
+    return f;
 }
 
 // Increment ref count for file f.
@@ -67,14 +75,15 @@ void file_close(struct file *f)
         return;
     }
     struct file ff = *f;
-    f->ref         = 0;
-    f->type        = FD_NONE;
     release(&ftable.lock);
+    kmem_cache_free(&ftable.cache, f);
 
     if (ff.type == FD_PIPE) {
         pipe_close(ff.pipe, ff.writable);
     } else if (ff.type == FD_INODE) {
         ff.ip->iops->iput(ff.ip);
+    } else if (ff.type == FD_SHM) {
+        shm_put(ff.shm);
     }
 }
 
@@ -82,7 +91,7 @@ void file_close(struct file *f)
 int file_stat(struct file *f, struct stat *st)
 {
     if (f->type == FD_INODE) {
-        f->ip->iops->ilock(f->ip);
+        f->ip->iops->ilock_shared(f->ip);
         f->ip->iops->stati(f->ip, st);
         f->ip->iops->iunlock(f->ip);
         return 0;
@@ -90,6 +99,116 @@ int file_stat(struct file *f, struct stat *st)
     return -1;
 }
 
+// Write the inode of file f to disk if it has changes that have not
+// been written yet, along with whatever else the file system keeps
+// about it. File data already goes through the buffer cache.
+int file_sync(struct file *f)
+{
+    if (f->type != FD_INODE) {
+        return -1;
+    }
+    struct inode *ip = f->ip;
+    if (ip->iops->fsync != nullptr) {
+        return ip->iops->fsync(ip);
+    }
+    ip->iops->ilock(ip);
+    if (ip->dirty) {
+        ip->iops->iupdate(ip);
+    }
+    ip->iops->iunlock(ip);
+    return 0;
+}
+
+/**
+ * @brief Report which of POLLIN and POLLOUT f is ready for.
+ *
+ * @param pt Poll table to put on the wait queues of f, or null to only
+ *        look at its state.
+ * @return Ready events, plus POLLHUP or POLLERR for a pipe whose other
+ *         end is closed.
+ */
+int file_poll(struct file *f, struct poll_table *pt)
+{
+    int mask = POLLIN | POLLOUT; // regular files never block
+    if (f->type == FD_PIPE) {
+        mask = pipe_poll(f->pipe, pt);
+    } else if (f->type == FD_INODE && f->ip->type == T_DEV) {
+        const int major = devtab_lookup_major(f->ip);
+        if (major >= 0 && major < NDEV && devsw[major].poll != nullptr) {
+            mask = devsw[major].poll(f->ip, pt);
+        }
+    }
+    if (!f->readable) {
+        mask &= ~POLLIN;
+    }
+    if (!f->writable) {
+        mask &= ~POLLOUT;
+    }
+    return mask;
+}
+
+// Read or write the device behind ip, passing on the open file's flags
+// so O_NONBLOCK reaches the driver.
+static int dev_rw(struct inode *ip, char *buf, u32 n, u32 off, bool write, int flags)
+{
+    const int major = devtab_lookup_major(ip);
+    if (major < 0 || major >= NDEV) {
+        return -1;
+    }
+    if (write) {
+        return devsw[major].write != nullptr ? devsw[major].write(ip, buf, n, off, flags) : -1;
+    }
+    return devsw[major].read != nullptr ? devsw[major].read(ip, buf, n, off, flags) : -1;
+}
+
+// Transfer each segment of the inode file f in turn at *off under a
+// single inode lock. Stops early on a short transfer, e.g. at end of file.
+// Files opened with O_DIRECT bypass the caches when the file system and
+// the disk can do it, and fall back to readi and writei otherwise.
+//
+// Reads share the inode lock, except a read that advances the offset of
+// an open file other processes hold too: that one stays exclusive so two
+// of them never read the same bytes.
+static int inode_rw(struct file *f, const struct iovec *iov, int iovcnt, u32 *off, bool write)
+{
+    struct inode *ip = f->ip;
+    int total        = 0;
+
+    if (!write && (off != &f->off || f->ref == 1)) {
+        ip->iops->ilock_shared(ip);
+    } else {
+        ip->iops->ilock(ip);
+    }
+    for (int i = 0; i < iovcnt; i++) {
+        if (iov[i].iov_len == 0) {
+            continue;
+        }
+        int r = -ENOTSUP;
+        if (f->direct && ip->iops->direct_io != nullptr) {
+            r = ip->iops->direct_io(ip, iov[i].iov_base, *off, iov[i].iov_len, write);
+        }
+        if (r == -ENOTSUP && ip->type == T_DEV) {
+            r = dev_rw(ip, iov[i].iov_base, iov[i].iov_len, *off, write, f->flags);
+        } else if (r == -ENOTSUP) {
+            r = write ? ip->iops->writei(ip, iov[i].iov_base, *off, iov[i].iov_len)
+                      : ip->iops->readi(ip, iov[i].iov_base, *off, iov[i].iov_len);
+        }
+        if (r < 0) {
+            if (total == 0) {
+                total = r;
+            }
+            break;
+        }
+        *off += r;
+        total += r;
+        if ((u32)r < iov[i].iov_len) {
+            break;
+        }
+    }
+    ip->iops->iunlock(ip);
+    return total;
+}
+
 // Read from file f.
 int file_read(struct file *f, char *addr, int n)
 {
@@ -97,61 +216,292 @@ int file_read(struct file *f, char *addr, int n)
         return -1;
     }
     if (f->type == FD_PIPE) {
-        return pipe_read(f->pipe, addr, n);
+        return pipe_read(f->pipe, addr, n, f->flags);
     }
     if (f->type == FD_INODE) {
-        int r;
-        f->ip->iops->ilock(f->ip);
-        if ((r = f->ip->iops->readi(f->ip, addr, f->off, n)) > 0)
-            f->off += r;
-        f->ip->iops->iunlock(f->ip);
-        return r;
+        struct iovec iov = {addr, n};
+        return inode_rw(f, &iov, 1, &f->off, false);
+    }
+    if (f->type == FD_SHM) {
+        return -1; // only mmap reaches the memory
     }
     panic("fileread");
 }
 
-// Write to file f.
-int file_write(struct file *f, char *addr, int n)
+// Read from f into several buffers.
+int file_readv(struct file *f, const struct iovec *iov, int iovcnt)
 {
+    if (f->readable == 0) {
+        return -1;
+    }
+    if (f->type == FD_PIPE) {
+        int total = 0;
+        for (int i = 0; i < iovcnt; i++) {
+            if (iov[i].iov_len == 0) {
+                continue;
+            }
+            int r = pipe_read(f->pipe, iov[i].iov_base, iov[i].iov_len, f->flags);
+            if (r < 0) {
+                return total > 0 ? total : r;
+            }
+            total += r;
+            if ((u32)r < iov[i].iov_len) {
+                break;
+            }
+        }
+        return total;
+    }
+    if (f->type == FD_INODE) {
+        return inode_rw(f, iov, iovcnt, &f->off, false);
+    }
+    if (f->type == FD_SHM) {
+        return -1;
+    }
+    panic("file_readv");
+}
 
+// Write several buffers to f.
+int file_writev(struct file *f, const struct iovec *iov, int iovcnt)
+{
     if (f->writable == 0) {
         return -1;
     }
     if (f->type == FD_PIPE) {
-        return pipe_write(f->pipe, addr, n);
+        int total = 0;
+        for (int i = 0; i < iovcnt; i++) {
+            if (iov[i].iov_len == 0) {
+                continue;
+            }
+            int r = pipe_write(f->pipe, iov[i].iov_base, iov[i].iov_len, f->flags);
+            if (r < 0) {
+                return total > 0 ? total : r;
+            }
+            total += r;
+            if ((u32)r < iov[i].iov_len) {
+                break;
+            }
+        }
+        return total;
     }
     if (f->type == FD_INODE) {
-        int r;
-        // write a few blocks at a time to avoid exceeding
-        // the maximum log transaction size, including
-        // i-node, indirect block, allocation blocks,
-        // and 2 blocks of slop for non-aligned writes.
-        // this really belongs lower down, since writei()
-        // might be writing a device like the console.
-        int max = ((MAXOPBLOCKS - 1 - 1 - 2) / 2) * 512;
-        int i   = 0;
-        while (i < n) {
-            int n1 = n - i;
-            if (n1 > max) {
-                n1 = max;
+        return inode_rw(f, iov, iovcnt, &f->off, true);
+    }
+    if (f->type == FD_SHM) {
+        return -1;
+    }
+    panic("file_writev");
+}
+
+// Read from f at offset off without moving the file offset.
+int file_pread(struct file *f, char *addr, int n, u32 off)
+{
+    if (f->readable == 0 || f->type != FD_INODE) {
+        return -1;
+    }
+    struct iovec iov = {addr, n};
+    return inode_rw(f, &iov, 1, &off, false);
+}
+
+// Write to f at offset off without moving the file offset.
+int file_pwrite(struct file *f, char *addr, int n, u32 off)
+{
+    if (f->writable == 0 || f->type != FD_INODE) {
+        return -1;
+    }
+    struct iovec iov = {addr, n};
+    return inode_rw(f, &iov, 1, &off, true);
+}
+
+// Write n bytes of kernel memory to f, at *off if off is not null and at
+// the file offset otherwise.
+static int file_write_kernel(struct file *f, char *src, int n, u32 *off)
+{
+    if (f->writable == 0) {
+        return -1;
+    }
+    if (f->type == FD_PIPE) {
+        return pipe_write(f->pipe, src, n, f->flags);
+    }
+    if (f->type != FD_INODE) {
+        return -1;
+    }
+    struct inode *ip = f->ip;
+    u32 *pos         = off != nullptr ? off : &f->off;
+    ip->iops->ilock(ip);
+    int r = ip->type == T_DEV ? dev_rw(ip, src, n, *pos, true, f->flags) : ip->iops->writei(ip, src, *pos, n);
+    if (r > 0) {
+        *pos += r;
+    }
+    ip->iops->iunlock(ip);
+    return r;
+}
+
+// Move up to n bytes of the regular file in, from *in_off on, to out.
+// Each page goes from the page cache straight into the pipe or file
+// behind out. The page is unlocked while it is written so out may be
+// the same file, or a pipe whose reader reads in.
+static int splice_from_file(struct file *in, u32 *in_off, struct file *out, u32 *out_off, int n)
+{
+    struct inode *ip = in->ip;
+    char *bounce     = nullptr;
+    int total        = 0;
+
+    while (total < n) {
+        ip->iops->ilock_shared(ip);
+        if (*in_off >= ip->size) {
+            ip->iops->iunlock(ip);
+            break;
+        }
+        const u32 m     = min(min((u32)(n - total), PGSIZE - *in_off % PGSIZE), ip->size - *in_off);
+        struct page *pg = ip->iops->getpage != nullptr ? ip->iops->getpage(ip, *in_off / PGSIZE) : nullptr;
+        char *src;
+        if (pg != nullptr) {
+            page_cache_unlock(pg);
+            src = pg->data + *in_off % PGSIZE;
+        } else {
+            // No page to borrow; copy the data out the slow way.
+            if (bounce == nullptr && (bounce = kalloc_page()) == nullptr) {
+                ip->iops->iunlock(ip);
+                break;
             }
+            if (ip->iops->readi(ip, bounce, *in_off, m) != (int)m) {
+                ip->iops->iunlock(ip);
+                break;
+            }
+            src = bounce;
+        }
+        ip->iops->iunlock(ip);
 
-            f->ip->iops->ilock(f->ip);
-            if ((r = f->ip->iops->writei(f->ip, addr + i, f->off, n1)) > 0) {
-                f->off += r;
+        const int r = file_write_kernel(out, src, m, out_off);
+        if (pg != nullptr) {
+            page_cache_lock(pg);
+            page_cache_put(pg);
+        }
+        if (r < 0) {
+            if (total == 0) {
+                total = -1;
             }
-            f->ip->iops->iunlock(f->ip);
+            break;
+        }
+        *in_off += r;
+        total += r;
+        if ((u32)r < m) {
+            break;
+        }
+    }
 
+    if (bounce != nullptr) {
+        kfree_page(bounce);
+    }
+    return total;
+}
 
-            if (r < 0) {
-                break;
+// Move up to n bytes from the pipe in to out through one kernel page.
+// Returns once the pipe has been drained rather than waiting for more.
+static int splice_from_pipe(struct file *in, struct file *out, u32 *out_off, int n)
+{
+    char *bounce = kalloc_page();
+    int total    = 0;
+
+    if (bounce == nullptr) {
+        return -1;
+    }
+    while (total < n) {
+        const int want = min(n - total, PGSIZE);
+        const int r    = pipe_read(in->pipe, bounce, want, in->flags);
+        if (r <= 0) {
+            if (r < 0 && total == 0) {
+                total = -1;
             }
-            if (r != n1) {
-                panic("short filewrite");
+            break;
+        }
+        const int w = file_write_kernel(out, bounce, r, out_off);
+        if (w < 0) {
+            if (total == 0) {
+                total = -1;
             }
-            i += r;
+            break;
+        }
+        total += w;
+        if (w < r || r < want) {
+            break;
+        }
+    }
+    kfree_page(bounce);
+    return total;
+}
+
+/**
+ * @brief Move data from one file to another inside the kernel.
+ *
+ * Regular files are read straight out of the page cache, pipes through a
+ * single kernel page; either way the data never visits user memory.
+ *
+ * @param in Source: a regular file or the read end of a pipe.
+ * @param in_off Offset to read at and advance, or nullptr to use and
+ * advance the file offset. Must be nullptr for pipes.
+ * @param out Destination: a pipe, regular file or device.
+ * @param out_off As in_off, for out.
+ * @param n Most bytes to move.
+ * @return Bytes moved, 0 at end of input, or -1 on error.
+ */
+int file_splice(struct file *in, u32 *in_off, struct file *out, u32 *out_off, int n)
+{
+    if (in->readable == 0 || out->writable == 0 || n < 0) {
+        return -1;
+    }
+    if (out->type != FD_PIPE && out->type != FD_INODE) {
+        return -1;
+    }
+    if (out_off != nullptr && out->type != FD_INODE) {
+        return -1;
+    }
+    if (in->type == FD_PIPE) {
+        return in_off == nullptr ? splice_from_pipe(in, out, out_off, n) : -1;
+    }
+    if (in->type != FD_INODE || in->ip->type != T_FILE) {
+        return -1;
+    }
+    return splice_from_file(in, in_off != nullptr ? in_off : &in->off, out, out_off, n);
+}
+
+// Read directory entries from f into addr as struct dirent records.
+int file_getdents(struct file *f, char *addr, int n)
+{
+    if (f->readable == 0 || f->type != FD_INODE) {
+        return -1;
+    }
+    struct inode *ip = f->ip;
+    ip->iops->ilock(ip);
+    int r = -1;
+    if (ip->type == T_DIR && ip->iops->getdents != nullptr) {
+        r = ip->iops->getdents(ip, addr, n, &f->off);
+    }
+    ip->iops->iunlock(ip);
+    return r;
+}
+
+// Write to file f.
+int file_write(struct file *f, char *addr, int n)
+{
+    if (f->writable == 0) {
+        return -1;
+    }
+    if (f->type == FD_PIPE) {
+        return pipe_write(f->pipe, addr, n, f->flags);
+    }
+    if (f->type == FD_INODE) {
+        // The whole write happens under one inode lock; ext2 has no log
+        // transaction to keep small.
+        struct iovec iov = {addr, n};
+        int r            = inode_rw(f, &iov, 1, &f->off, true);
+        if (r == 0 && n > 0) {
+            return -1;
         }
-        return i == n ? n : -1;
+        return r; // a short count once f->off has moved, e.g. a full disk
+    }
+    if (f->type == FD_SHM) {
+        return -1;
     }
     panic("filewrite");
 }
@@ -9,10 +9,92 @@
 #include "file.h"
 #include "icache.h"
 #include "assert.h"
+#include "dcache.h"
+#include "slab.h"
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 struct icache icache;
+static struct kmem_cache inode_cache;
 
+/**
+ * @brief A file system mounted on a directory of another one.
+ *
+ * The table is only written while the system boots, so lookups read it
+ * without a lock. The covered directory stays referenced forever, which
+ * keeps its in-core inode, and therefore its address, unique.
+ */
+struct mount
+{
+    struct inode *covered; // directory the file system is mounted on
+    u32 dev;
+    u32 root; // inode number of the mounted root directory
+    struct inode_operations *iops;
+};
+
+static struct mount mounts[NMOUNT];
+static int nmounts;
+
+/** @brief Initialize the inode cache. */
+void icache_init(void)
+{
+    initlock(&icache.lock, "icache");
+    icache.lru.lru_prev = &icache.lru;
+    icache.lru.lru_next = &icache.lru;
+    kmem_cache_init(&inode_cache, "inode", sizeof(struct inode));
+    ext2fs_addrs_cache_init();
+}
+
+static u32 icache_hash(u32 dev, u32 inum)
+{
+    return (dev * 31 + inum) % ICACHE_BUCKETS;
+}
+
+static struct inode *icache_lookup(u32 dev, u32 inum)
+{
+    for (struct inode *ip = icache.hash[icache_hash(dev, inum)]; ip != nullptr; ip = ip->hash_next) {
+        if (ip->dev == dev && ip->inum == inum) {
+            return ip;
+        }
+    }
+    return nullptr;
+}
+
+static void icache_unhash(struct inode *ip)
+{
+    struct inode **pp = &icache.hash[icache_hash(ip->dev, ip->inum)];
+    while (*pp != ip) {
+        pp = &(*pp)->hash_next;
+    }
+    *pp           = ip->hash_next;
+    ip->hash_next = nullptr;
+}
+
+static void lru_remove(struct inode *ip)
+{
+    ip->lru_next->lru_prev = ip->lru_prev;
+    ip->lru_prev->lru_next = ip->lru_next;
+    icache.nunused--;
+}
+
+static void lru_push_front(struct inode *ip)
+{
+    ip->lru_next                  = icache.lru.lru_next;
+    ip->lru_prev                  = &icache.lru;
+    icache.lru.lru_next->lru_prev = ip;
+    icache.lru.lru_next           = ip;
+    icache.nunused++;
+}
+
+// Operations of the file system on dev. Anything not mounted is ext2.
+static struct inode_operations *mount_iops(u32 dev)
+{
+    for (int i = 0; i < nmounts; i++) {
+        if (mounts[i].dev == dev) {
+            return mounts[i].iops;
+        }
+    }
+    return &ext2fs_inode_ops;
+}
 
 /**
  * @brief Fetch an inode from the cache, creating an entry if needed.
@@ -23,54 +105,84 @@ struct icache icache;
  * @param inum Inode number on disk.
  * @return In-core inode pointer.
  */
-
 struct inode *iget(u32 dev, u32 inum)
 {
-    struct inode *ip;
-
     acquire(&icache.lock);
-
-    // Is the inode already cached?
-    struct inode *empty = nullptr;
-    for (ip = &icache.inode[0]; ip < &icache.inode[NINODE]; ip++) {
-        if (ip->ref > 0 && ip->dev == dev && ip->inum == inum) {
-            ip->ref++;
-            release(&icache.lock);
-            return ip;
-        }
-        if (empty == nullptr && ip->ref == 0) // Remember the empty slot.
-        {
-            empty = ip;
+    struct inode *ip = icache_lookup(dev, inum);
+    if (ip != nullptr) {
+        if (ip->ref++ == 0) {
+            lru_remove(ip);
         }
+        release(&icache.lock);
+        return ip;
     }
 
-    int i;
-    for (i = 0; i < NINODE; i++) {
-        if (ext2fs_addrs[i].busy == 0) {
-            break;
+    // Reuse the least recently used idle inode once enough are cached,
+    // otherwise grow the cache. The slab never sleeps, so this can be
+    // done under the lock without racing another iget of the same inode.
+    if (icache.nunused >= NINODE) {
+        ip = icache.lru.lru_prev;
+        lru_remove(ip);
+        icache_unhash(ip);
+    } else {
+        ip = kmem_cache_alloc(&inode_cache);
+        if (ip == nullptr || (ip->addrs = ext2fs_addrs_alloc()) == nullptr) {
+            panic("iget: out of memory");
         }
+        initrwsleeplock(&ip->lock, "inode");
+        icache.ninodes++;
     }
 
-    // Recycle an inode cache entry.
-    if (empty == nullptr) {
-        panic("iget: no inodes");
-    }
-
-    ip        = empty;
     ip->dev   = dev;
     ip->inum  = inum;
     ip->ref   = 1;
     ip->valid = 0;
+    ip->dirty = 0;
+    ip->iops  = mount_iops(dev);
 
-    ip->iops             = &ext2fs_inode_ops;
-    ip->addrs            = (void *)&ext2fs_addrs[i];
-    ext2fs_addrs[i].busy = 1;
-
+    u32 h          = icache_hash(dev, inum);
+    ip->hash_next  = icache.hash[h];
+    icache.hash[h] = ip;
     release(&icache.lock);
 
     return ip;
 }
 
+/**
+ * @brief Drop a reference to an inode.
+ *
+ * Called by the file system's iput after it has dealt with the on-disk
+ * inode. An unreferenced inode that is still valid stays cached; one
+ * that was freed on disk leaves the cache.
+ *
+ * @param ip Inode to release.
+ * @return true if that was the last reference.
+ */
+bool irelease(struct inode *ip)
+{
+    acquire(&icache.lock);
+    if (ip->ref < 1) {
+        panic("irelease");
+    }
+    const bool last = --ip->ref == 0;
+    if (last) {
+        if (ip->valid) {
+            lru_push_front(ip);
+            ip = nullptr;
+        } else {
+            icache_unhash(ip);
+            icache.ninodes--;
+        }
+    }
+    release(&icache.lock);
+
+    if (last && ip != nullptr) {
+        ext2fs_addrs_free(ip->addrs);
+        kmem_cache_free(&inode_cache, ip);
+    }
+    return last;
+}
+
 /**
  * @brief Increment the reference count on an inode.
  *
@@ -85,6 +197,85 @@ struct inode *idup(struct inode *ip)
     return ip;
 }
 
+/**
+ * @brief Mount a file system on a directory.
+ *
+ * Path lookups that reach the directory continue at inode root of dev,
+ * and ".." from that root leads back out. There is no unmount.
+ *
+ * @param path Existing directory to mount on.
+ * @param dev Device number the mounted file system's inodes use.
+ * @param root Inode number of its root directory.
+ * @param iops Its inode operations.
+ * @return 0 on success, -1 if path is not a directory or the table is full.
+ */
+int mount(char *path, u32 dev, u32 root, struct inode_operations *iops)
+{
+    if (nmounts == NMOUNT) {
+        return -1;
+    }
+    struct inode *ip = namei(path);
+    if (ip == nullptr) {
+        return -1;
+    }
+    ip->iops->ilock(ip);
+    const bool isdir = ip->type == T_DIR;
+    ip->iops->iunlock(ip);
+    if (!isdir) {
+        ip->iops->iput(ip);
+        return -1;
+    }
+
+    struct mount *m = &mounts[nmounts];
+    m->covered      = ip;
+    m->dev          = dev;
+    m->root         = root;
+    m->iops         = iops;
+    nmounts++;
+    return 0;
+}
+
+/**
+ * @brief Check whether a file system is mounted on an inode.
+ *
+ * @param ip Referenced inode.
+ * @return true if ip is covered by a mount.
+ */
+bool ismountpoint(struct inode *ip)
+{
+    for (int i = 0; i < nmounts; i++) {
+        if (mounts[i].covered == ip) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// If a file system is mounted on ip, trade ip for the mounted root.
+static struct inode *mount_enter(struct inode *ip)
+{
+    for (int i = 0; i < nmounts; i++) {
+        if (mounts[i].covered == ip) {
+            ip->iops->iput(ip);
+            return iget(mounts[i].dev, mounts[i].root);
+        }
+    }
+    return ip;
+}
+
+// If ip is the root of a mounted file system, trade it for the directory
+// it covers, whose ".." is the one a path means.
+static struct inode *mount_leave(struct inode *ip)
+{
+    for (int i = 0; i < nmounts; i++) {
+        if (mounts[i].dev == ip->dev && mounts[i].root == ip->inum) {
+            ip->iops->iput(ip);
+            return idup(mounts[i].covered);
+        }
+    }
+    return ip;
+}
+
 // Copy the next path element from path into name.
 // Return a pointer to the element following the copied one.
 // The returned path has no leading slashes,
@@ -101,7 +292,7 @@ struct inode *idup(struct inode *ip)
  * @brief Extract the next path element from a slash-delimited string.
  *
  * @param path Input path.
- * @param name Buffer receiving the next element (DIRSIZ bytes).
+ * @param name Buffer receiving the next element (EXT2_NAME_LEN + 1 bytes).
  * @return Pointer to the remaining path or 0 if no elements remain.
  */
 static char *skipelem(char *path, char *name)
@@ -131,7 +322,7 @@ static char *skipelem(char *path, char *name)
 
 // Look up and return the inode for a path name.
 // If parent != 0, return the inode for the parent and copy the final
-// path element into name, which must have room for DIRSIZ bytes.
+// path element into name, which must have room for EXT2_NAME_LEN + 1 bytes.
 // Must be called inside a transaction since it calls iput().
 /**
  * @brief Resolve a path to an inode, optionally returning the parent.
@@ -160,8 +351,11 @@ static struct inode *namex(char *path, int nameiparent, char *name)
             ip->iops->iput(ip);
             return nullptr;
         }
+        if (!(nameiparent && *nextp == '\0') && strcmp(name, "..") == 0) {
+            ip = mount_leave(ip);
+        }
 
-        ip->iops->ilock(ip);
+        ip->iops->ilock_shared(ip);
         if (ip->type != T_DIR) {
             ip->iops->iunlockput(ip);
             return nullptr;
@@ -171,12 +365,19 @@ static struct inode *namex(char *path, int nameiparent, char *name)
             ip->iops->iunlock(ip);
             return ip;
         }
-        if ((next = ip->iops->dirlookup(ip, name, nullptr)) == nullptr) {
+        u32 inum;
+        if (dcache_lookup(ip->dev, ip->inum, name, &inum)) {
+            next = inum != 0 ? iget(ip->dev, inum) : nullptr;
+        } else {
+            next = ip->iops->dirlookup(ip, name, nullptr);
+            dcache_enter(ip->dev, ip->inum, name, next != nullptr ? next->inum : 0);
+        }
+        if (next == nullptr) {
             ip->iops->iunlockput(ip);
             return nullptr;
         }
         ip->iops->iunlockput(ip);
-        ip   = next;
+        ip   = mount_enter(next);
         path = nextp;
     }
     if (nameiparent) {
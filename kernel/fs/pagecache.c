@@ -0,0 +1,355 @@
+// Page cache.
+//
+// The page cache holds file contents in whole 4 KiB pages, keyed by
+// device, inode number and page index. File systems fill pages from the
+// buffer cache the first time they are read; after that a read is a hash
+// lookup plus one memmove per page.
+//
+// Interface:
+// * To get a page, call page_cache_get. The page comes back locked and
+//     referenced. If page->valid is zero the caller fills it and sets valid.
+// * page_cache_find returns a locked page only if it is already cached.
+// * page_cache_unlock and page_cache_lock let a caller keep its reference
+//     while it does something that may sleep or touch the same page.
+// * When done with the page, call page_cache_put.
+// * page_cache_invalidate drops every page of an inode, e.g. on truncate.
+//
+// The cache has no fixed size. Pages are allocated while free memory is
+// plentiful; once the page allocator runs low, new pages are recycled from
+// the least recently used end of the list, and kalloc_page() calls
+// page_cache_reclaim() before giving up on an allocation.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "spinlock.h"
+#include "pagecache.h"
+#include "slab.h"
+
+#define PAGE_CACHE_BUCKETS 256
+
+// Keep at least 1/PAGE_CACHE_MIN_FREE_DIV of all pages free before
+// growing the cache instead of recycling one of its pages.
+#define PAGE_CACHE_MIN_FREE_DIV 16
+
+/**
+ * @brief Global page cache state.
+ */
+struct
+{
+    struct spinlock lock;
+    struct page *hash[PAGE_CACHE_BUCKETS];
+
+    // Linked list of all cached pages, through prev/next.
+    // head.next is most recently used.
+    struct page head;
+
+    // Descriptors of evicted pages, kept for reuse so reclaim never has
+    // to call back into the allocator.
+    struct page *spare;
+    u32 npages;
+    int ready;
+} pcache;
+
+static struct kmem_cache page_desc_cache;
+
+/** @brief Initialize the page cache hash table and LRU list. */
+void page_cache_init(void)
+{
+    initlock(&pcache.lock, "pcache");
+    pcache.head.prev = &pcache.head;
+    pcache.head.next = &pcache.head;
+    pcache.ready     = 1;
+    kmem_cache_init(&page_desc_cache, "page", sizeof(struct page));
+}
+
+static u32 page_hash(u32 dev, u32 inum, u32 index)
+{
+    return (dev * 31 + inum * 2654435761u + index) % PAGE_CACHE_BUCKETS;
+}
+
+static struct page *page_lookup(u32 dev, u32 inum, u32 index)
+{
+    for (struct page *pg = pcache.hash[page_hash(dev, inum, index)]; pg != nullptr; pg = pg->hash_next) {
+        if (pg->dev == dev && pg->inum == inum && pg->index == index) {
+            return pg;
+        }
+    }
+    return nullptr;
+}
+
+static void page_unhash(struct page *pg)
+{
+    struct page **pp = &pcache.hash[page_hash(pg->dev, pg->inum, pg->index)];
+    while (*pp != pg) {
+        pp = &(*pp)->hash_next;
+    }
+    *pp           = pg->hash_next;
+    pg->hash_next = nullptr;
+    pg->hashed    = 0;
+}
+
+static void lru_remove(struct page *pg)
+{
+    pg->next->prev = pg->prev;
+    pg->prev->next = pg->next;
+}
+
+static void lru_push_front(struct page *pg)
+{
+    pg->next               = pcache.head.next;
+    pg->prev               = &pcache.head;
+    pcache.head.next->prev = pg;
+    pcache.head.next       = pg;
+}
+
+/**
+ * @brief Detach the least recently used unreferenced page.
+ *
+ * Caller holds pcache.lock. The returned page keeps its frame.
+ */
+static struct page *page_evict_one(void)
+{
+    for (struct page *pg = pcache.head.prev; pg != &pcache.head; pg = pg->prev) {
+        if (pg->refcnt == 0) {
+            if (pg->hashed) {
+                page_unhash(pg);
+            }
+            lru_remove(pg);
+            pcache.npages--;
+            return pg;
+        }
+    }
+    return nullptr;
+}
+
+/** @brief Return a detached page to the spare list and hand back its frame. */
+static char *page_retire(struct page *pg)
+{
+    char *frame  = pg->data;
+    pg->data     = nullptr;
+    pg->next     = pcache.spare;
+    pcache.spare = pg;
+    return frame;
+}
+
+static bool memory_is_low(void)
+{
+    return kfree_page_count() < kpage_total() / PAGE_CACHE_MIN_FREE_DIV;
+}
+
+/**
+ * @brief Get a descriptor with a frame for a new page.
+ *
+ * Recycles a cached page when free memory is low, otherwise allocates.
+ */
+static struct page *page_alloc(void)
+{
+    struct page *pg = nullptr;
+
+    acquire(&pcache.lock);
+    if (memory_is_low()) {
+        pg = page_evict_one();
+    }
+    if (pg == nullptr && pcache.spare != nullptr) {
+        pg           = pcache.spare;
+        pcache.spare = pg->next;
+    }
+    release(&pcache.lock);
+
+    if (pg == nullptr) {
+        pg = kmem_cache_alloc(&page_desc_cache);
+        if (pg == nullptr) {
+            return nullptr;
+        }
+        initsleeplock(&pg->lock, "page");
+    }
+    if (pg->data == nullptr && (pg->data = kalloc_page()) == nullptr) {
+        acquire(&pcache.lock);
+        page_retire(pg);
+        release(&pcache.lock);
+        return nullptr;
+    }
+    return pg;
+}
+
+/**
+ * @brief Look up a page, inserting an empty one if it is not cached.
+ *
+ * @return Locked, referenced page, or nullptr if no memory is available.
+ */
+struct page *page_cache_get(u32 dev, u32 inum, u32 index)
+{
+    struct page *pg = page_cache_find(dev, inum, index);
+    if (pg != nullptr) {
+        return pg;
+    }
+
+    struct page *fresh = page_alloc();
+    if (fresh == nullptr) {
+        return nullptr;
+    }
+
+    acquire(&pcache.lock);
+    // Somebody may have inserted the page while we were allocating.
+    if ((pg = page_lookup(dev, inum, index)) != nullptr) {
+        char *frame = page_retire(fresh);
+        pg->refcnt++;
+        release(&pcache.lock);
+        kfree_page(frame);
+        acquiresleep(&pg->lock);
+        return pg;
+    }
+
+    pg             = fresh;
+    pg->dev        = dev;
+    pg->inum       = inum;
+    pg->index      = index;
+    pg->refcnt     = 1;
+    pg->valid      = 0;
+    pg->hashed     = 1;
+    u32 h          = page_hash(dev, inum, index);
+    pg->hash_next  = pcache.hash[h];
+    pcache.hash[h] = pg;
+    lru_push_front(pg);
+    pcache.npages++;
+    release(&pcache.lock);
+
+    acquiresleep(&pg->lock);
+    return pg;
+}
+
+/**
+ * @brief Look up a page without inserting it.
+ *
+ * @return Locked, referenced page, or nullptr if it is not cached.
+ */
+struct page *page_cache_find(u32 dev, u32 inum, u32 index)
+{
+    acquire(&pcache.lock);
+    struct page *pg = page_lookup(dev, inum, index);
+    if (pg != nullptr) {
+        pg->refcnt++;
+    }
+    release(&pcache.lock);
+
+    if (pg != nullptr) {
+        acquiresleep(&pg->lock);
+    }
+    return pg;
+}
+
+/**
+ * @brief Unlock a page but keep its reference.
+ *
+ * The frame stays valid and cannot be recycled until page_cache_put; its
+ * contents may change under the caller.
+ */
+void page_cache_unlock(struct page *pg)
+{
+    releasesleep(&pg->lock);
+}
+
+/** @brief Relock a page unlocked with page_cache_unlock. */
+void page_cache_lock(struct page *pg)
+{
+    acquiresleep(&pg->lock);
+}
+
+/**
+ * @brief Unlock and release a page obtained from page_cache_get/find.
+ *
+ * Pages that were never filled, or were invalidated while in use, are
+ * dropped as soon as the last reference goes away.
+ */
+void page_cache_put(struct page *pg)
+{
+    int valid = pg->valid;
+    releasesleep(&pg->lock);
+
+    char *frame = nullptr;
+    acquire(&pcache.lock);
+    pg->refcnt--;
+    if (pg->refcnt == 0) {
+        if (pg->hashed && valid) {
+            lru_remove(pg);
+            lru_push_front(pg);
+        } else {
+            if (pg->hashed) {
+                page_unhash(pg);
+            }
+            lru_remove(pg);
+            pcache.npages--;
+            frame = page_retire(pg);
+        }
+    }
+    release(&pcache.lock);
+
+    if (frame != nullptr) {
+        kfree_page(frame);
+    }
+}
+
+/**
+ * @brief Drop every cached page of an inode.
+ *
+ * Pages still referenced are unhashed and freed by their last page_cache_put.
+ */
+void page_cache_invalidate(u32 dev, u32 inum)
+{
+    struct page *victims = nullptr;
+
+    acquire(&pcache.lock);
+    for (struct page *pg = pcache.head.next; pg != &pcache.head;) {
+        struct page *next = pg->next;
+        if (pg->hashed && pg->dev == dev && pg->inum == inum) {
+            page_unhash(pg);
+            if (pg->refcnt == 0) {
+                lru_remove(pg);
+                pcache.npages--;
+                pg->hash_next = victims;
+                victims       = pg;
+            }
+        }
+        pg = next;
+    }
+    release(&pcache.lock);
+
+    while (victims != nullptr) {
+        struct page *pg = victims;
+        victims         = pg->hash_next;
+        acquire(&pcache.lock);
+        char *frame = page_retire(pg);
+        release(&pcache.lock);
+        kfree_page(frame);
+    }
+}
+
+/**
+ * @brief Give up to target unreferenced pages back to the page allocator.
+ *
+ * Called by kalloc_page() when the free list is empty.
+ *
+ * @return Number of pages freed.
+ */
+u32 page_cache_reclaim(u32 target)
+{
+    if (!pcache.ready || holding(&pcache.lock)) {
+        return 0;
+    }
+
+    u32 freed = 0;
+    while (freed < target) {
+        acquire(&pcache.lock);
+        struct page *pg = page_evict_one();
+        char *frame     = pg != nullptr ? page_retire(pg) : nullptr;
+        release(&pcache.lock);
+        if (frame == nullptr) {
+            break;
+        }
+        kfree_page(frame);
+        freed++;
+    }
+    return freed;
+}
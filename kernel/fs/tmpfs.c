@@ -0,0 +1,579 @@
+// tmpfs: a file system that lives entirely in memory.
+//
+// Every file is an array of pages from the page allocator, indexed by
+// page number and filled in as the file grows; nothing is ever written
+// to a disk. The array itself is kept in pages of pointers, allocated as
+// the file first reaches them. Inodes are slots in a fixed table of TMPFS_NINODE nodes,
+// inode number i being slot i - 1, and the whole file system holds at
+// most TMPFS_PAGES pages. A write that would go past that is cut short.
+//
+// The in-core inode caches its node the way ext2 caches the disk inode:
+// ilock loads it and iupdate stores it back. File contents are read and
+// written in place, so tmpfs does not use the page cache.
+//
+// Directories keep ext2_dir_entry_2 records, in chunks of TMPFS_DIRBLK
+// bytes that no record crosses, so code that reads or patches raw
+// directory entries through readi and writei (unlink, isdirempty)
+// works on both file systems.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "stat.h"
+#include "fs.h"
+#include "ext2.h"
+#include <string.h>
+#include "dirent.h"
+#include "file.h"
+#include "icache.h"
+#include "mmu.h"
+#include "spinlock.h"
+#include "tmpfs.h"
+
+struct inode_operations tmpfs_inode_ops = {
+    nullptr,
+    tmpfs_dirlink,
+    tmpfs_dirlookup,
+    nullptr,
+    tmpfs_getdents,
+    nullptr,
+    tmpfs_ialloc,
+    tmpfs_iinit,
+    tmpfs_ilock,
+    tmpfs_ilock_shared,
+    tmpfs_iput,
+    tmpfs_iunlock,
+    tmpfs_iunlockput,
+    tmpfs_iupdate,
+    tmpfs_readi,
+    tmpfs_stati,
+    tmpfs_writei,
+};
+
+#define min(a, b) ((a) < (b) ? (a) : (b))
+
+#define TMPFS_PTRS_PER_PAGE (PGSIZE / sizeof(char *))
+#define TMPFS_NPTRPAGES ((TMPFS_PAGES + TMPFS_PTRS_PER_PAGE - 1) / TMPFS_PTRS_PER_PAGE)
+
+/**
+ * @brief One tmpfs file, directory or device node.
+ *
+ * Protected by the sleep lock of its in-core inode, except type, which
+ * tells free slots apart and is only changed under tmpfs.lock.
+ */
+struct tmpfs_node
+{
+    short type; // 0 if the slot is free
+    u16 major;
+    u16 minor;
+    u16 nlink;
+    u32 size;
+    // Page frames by page index, TMPFS_PTRS_PER_PAGE to a page of
+    // pointers; nullptr where nothing was written.
+    char **ptrpages[TMPFS_NPTRPAGES];
+};
+
+static struct
+{
+    struct spinlock lock; // protects node allocation and used_pages
+    struct tmpfs_node nodes[TMPFS_NINODE];
+    u32 used_pages;
+} tmpfs;
+
+static struct tmpfs_node *tmpfs_node(struct inode *ip)
+{
+    if (ip->inum < 1 || ip->inum > TMPFS_NINODE) {
+        panic("tmpfs_node: bad inum %u", ip->inum);
+    }
+    return &tmpfs.nodes[ip->inum - 1];
+}
+
+// Return page index of tn, allocating a zeroed one if alloc is set and
+// there is none yet. Returns nullptr if the page is missing and cannot
+// be allocated because tmpfs or the page allocator is out of pages.
+static char *tmpfs_page(struct tmpfs_node *tn, u32 index, bool alloc)
+{
+    if (index >= TMPFS_PAGES) {
+        return nullptr;
+    }
+    char ***ptrpage = &tn->ptrpages[index / TMPFS_PTRS_PER_PAGE];
+    if (*ptrpage != nullptr && (*ptrpage)[index % TMPFS_PTRS_PER_PAGE] != nullptr) {
+        return (*ptrpage)[index % TMPFS_PTRS_PER_PAGE];
+    }
+    if (!alloc) {
+        return nullptr;
+    }
+
+    // Pointer pages are not counted against TMPFS_PAGES.
+    if (*ptrpage == nullptr) {
+        if ((*ptrpage = (char **)kalloc_page()) == nullptr) {
+            return nullptr;
+        }
+        memset(*ptrpage, 0, PGSIZE);
+    }
+
+    acquire(&tmpfs.lock);
+    if (tmpfs.used_pages >= TMPFS_PAGES) {
+        release(&tmpfs.lock);
+        return nullptr;
+    }
+    tmpfs.used_pages++;
+    release(&tmpfs.lock);
+
+    char *page = kalloc_page();
+    if (page == nullptr) {
+        acquire(&tmpfs.lock);
+        tmpfs.used_pages--;
+        release(&tmpfs.lock);
+        return nullptr;
+    }
+    memset(page, 0, PGSIZE);
+    (*ptrpage)[index % TMPFS_PTRS_PER_PAGE] = page;
+    return page;
+}
+
+// Give the pages of a node back and return its slot to the table.
+static void tmpfs_node_free(struct tmpfs_node *tn)
+{
+    u32 freed = 0;
+    for (u32 p = 0; p < TMPFS_NPTRPAGES; p++) {
+        char **pages = tn->ptrpages[p];
+        if (pages == nullptr) {
+            continue;
+        }
+        for (u32 i = 0; i < TMPFS_PTRS_PER_PAGE; i++) {
+            if (pages[i] != nullptr) {
+                kfree_page(pages[i]);
+                freed++;
+            }
+        }
+        kfree_page((char *)pages);
+    }
+
+    acquire(&tmpfs.lock);
+    tmpfs.used_pages -= freed;
+    memset(tn, 0, sizeof(*tn));
+    release(&tmpfs.lock);
+}
+
+/**
+ * @brief Set up an empty tmpfs with only its root directory.
+ *
+ * The file system must already be mounted, so that iget hands out
+ * inodes with the tmpfs operations.
+ */
+void tmpfs_iinit(int dev)
+{
+    initlock(&tmpfs.lock, "tmpfs");
+
+    struct tmpfs_node *root = &tmpfs.nodes[TMPFS_ROOTINO - 1];
+    root->type              = T_DIR;
+    root->nlink             = 1;
+
+    // The root's ".." is never looked up: namex leaves the mount first.
+    struct inode *ip = iget(dev, TMPFS_ROOTINO);
+    ip->iops->ilock(ip);
+    if (ip->iops->dirlink(ip, ".", ip->inum) < 0 || ip->iops->dirlink(ip, "..", ip->inum) < 0) {
+        panic("tmpfs_iinit: root");
+    }
+    ip->iops->iunlockput(ip);
+
+    boot_message(WARNING_LEVEL_INFO,
+                 "tmpfs: size: %u KB, inodes: %u",
+                 TMPFS_PAGES * (PGSIZE / 1024),
+                 TMPFS_NINODE);
+}
+
+struct inode *tmpfs_ialloc(u32 dev, short type)
+{
+    acquire(&tmpfs.lock);
+    for (u32 i = 0; i < TMPFS_NINODE; i++) {
+        struct tmpfs_node *tn = &tmpfs.nodes[i];
+        if (tn->type == 0) {
+            memset(tn, 0, sizeof(*tn));
+            tn->type = type;
+            release(&tmpfs.lock);
+            return iget(dev, i + 1);
+        }
+    }
+    release(&tmpfs.lock);
+    return nullptr;
+}
+
+void tmpfs_iupdate(struct inode *ip)
+{
+    struct tmpfs_node *tn = tmpfs_node(ip);
+    tn->major             = ip->major;
+    tn->minor             = ip->minor;
+    tn->nlink             = ip->nlink;
+    tn->size              = ip->size;
+    if (ip->type != 0) {
+        tn->type = ip->type;
+    }
+}
+
+void tmpfs_ilock(struct inode *ip)
+{
+    if (ip == nullptr || ip->ref < 1) {
+        panic("tmpfs_ilock");
+    }
+
+    acquirerwsleep(&ip->lock);
+    if (ip->valid == 0) {
+        const struct tmpfs_node *tn = tmpfs_node(ip);
+        ip->type                    = tn->type;
+        ip->major                   = tn->major;
+        ip->minor                   = tn->minor;
+        ip->nlink                   = tn->nlink;
+        ip->size                    = tn->size;
+        ip->i_atime                 = 0;
+        ip->i_ctime                 = 0;
+        ip->i_mtime                 = 0;
+        ip->i_dtime                 = 0;
+        ip->i_uid                   = 0;
+        ip->i_gid                   = 0;
+        ip->i_flags                 = 0;
+        ip->iops                    = &tmpfs_inode_ops;
+
+        ip->valid = 1;
+        if (ip->type == 0) {
+            panic("tmpfs_ilock: no type");
+        }
+    }
+}
+
+// Lock an inode for reading; see ext2fs_ilock_shared.
+void tmpfs_ilock_shared(struct inode *ip)
+{
+    if (ip == nullptr || ip->ref < 1) {
+        panic("tmpfs_ilock_shared");
+    }
+
+    acquirerwsleep_shared(&ip->lock);
+    if (ip->valid && ip->type != T_DEV) {
+        return;
+    }
+    releaserwsleep(&ip->lock);
+    tmpfs_ilock(ip);
+    if (ip->type != T_DEV) {
+        downgraderwsleep(&ip->lock);
+    }
+}
+
+void tmpfs_iunlock(struct inode *ip)
+{
+    if (ip == nullptr || !holdingrwsleep(&ip->lock) || ip->ref < 1) {
+        panic("tmpfs_iunlock");
+    }
+
+    releaserwsleep(&ip->lock);
+}
+
+void tmpfs_iput(struct inode *ip)
+{
+    acquirerwsleep(&ip->lock);
+
+    acquire(&icache.lock);
+    int r = ip->ref;
+    release(&icache.lock);
+    if (r == 1 && ip->valid && ip->nlink == 0) {
+        // No links and no other references: the memory goes back now.
+        tmpfs_node_free(tmpfs_node(ip));
+        ip->type  = 0;
+        ip->valid = 0;
+    }
+    releaserwsleep(&ip->lock);
+
+    irelease(ip);
+}
+
+void tmpfs_iunlockput(struct inode *ip)
+{
+    ip->iops->iunlock(ip);
+    ip->iops->iput(ip);
+}
+
+void tmpfs_stati(struct inode *ip, struct stat *st)
+{
+    st->dev     = (int)ip->dev;
+    st->ino     = ip->inum;
+    st->type    = ip->type;
+    st->nlink   = ip->nlink;
+    st->size    = ip->size;
+    st->ref     = ip->ref;
+    st->i_atime = ip->i_atime;
+    st->i_ctime = ip->i_ctime;
+    st->i_mtime = ip->i_mtime;
+    st->i_dtime = ip->i_dtime;
+    st->i_uid   = ip->i_uid;
+    st->i_gid   = ip->i_gid;
+    st->i_flags = ip->i_flags;
+}
+
+int tmpfs_readi(struct inode *ip, char *dst, u32 off, u32 n)
+{
+    u32 m;
+
+    if (ip->type == T_DEV) {
+        if (ip->major >= NDEV || !devsw[ip->major].read) {
+            return -1;
+        }
+        return devsw[ip->major].read(ip, dst, n, off, 0);
+    }
+
+    if (off > ip->size || off + n < off) {
+        return -1;
+    }
+    if (off + n > ip->size) {
+        n = ip->size - off;
+    }
+
+    struct tmpfs_node *tn = tmpfs_node(ip);
+    for (u32 tot = 0; tot < n; tot += m, off += m, dst += m) {
+        m          = min(n - tot, PGSIZE - off % PGSIZE);
+        char *page = tmpfs_page(tn, off / PGSIZE, false);
+        if (page != nullptr) {
+            memmove(dst, page + off % PGSIZE, m);
+        } else {
+            memset(dst, 0, m);
+        }
+    }
+    return n;
+}
+
+// Writes stop early once tmpfs runs out of pages; the bytes copied so
+// far stay written.
+int tmpfs_writei(struct inode *ip, char *src, u32 off, u32 n)
+{
+    u32 tot;
+    u32 m;
+
+    if (ip->type == T_DEV) {
+        if (ip->major >= NDEV || !devsw[ip->major].write) {
+            return -1;
+        }
+        return devsw[ip->major].write(ip, src, n, off, 0);
+    }
+
+    if (off > ip->size || off + n < off) {
+        return -1;
+    }
+
+    struct tmpfs_node *tn = tmpfs_node(ip);
+    for (tot = 0; tot < n; tot += m, off += m, src += m) {
+        char *page = tmpfs_page(tn, off / PGSIZE, true);
+        if (page == nullptr) {
+            break;
+        }
+        m = min(n - tot, PGSIZE - off % PGSIZE);
+        memmove(page + off % PGSIZE, src, m);
+    }
+
+    if (off > ip->size) {
+        ip->size = off;
+        tn->size = off;
+    }
+    return tot > 0 || n == 0 ? (int)tot : -1;
+}
+
+// Directories
+
+static inline u16 tmpfs_dirent_size(u8 name_len)
+{
+    u16 size = 8 + name_len;
+    return (size + 3) & ~3;
+}
+
+static inline struct ext2_dir_entry_2 *tmpfs_dirent_at(u8 *chunk, u32 off)
+{
+    return (struct ext2_dir_entry_2 *)(chunk + off);
+}
+
+// Chunk of directory dp starting at off. Directory pages are allocated
+// as the directory grows, so every chunk below dp->size exists.
+static u8 *tmpfs_dir_chunk(struct inode *dp, u32 off)
+{
+    char *page = tmpfs_page(tmpfs_node(dp), off / PGSIZE, false);
+    if (page == nullptr) {
+        panic("tmpfs_dir_chunk: hole");
+    }
+    return (u8 *)page + off % PGSIZE;
+}
+
+// Look for name in one chunk and return its offset, or -1. If slot is
+// not nullptr and *slot is negative, *slot is set to the first record
+// that can take an entry of need bytes.
+static int tmpfs_dir_scan(u8 *chunk, const char *name, u32 len, u16 need, int *slot)
+{
+    for (u32 off = 0; off < TMPFS_DIRBLK;) {
+        struct ext2_dir_entry_2 *de = tmpfs_dirent_at(chunk, off);
+        if (de->rec_len < 8 || de->rec_len % 4 != 0 || off + de->rec_len > TMPFS_DIRBLK) {
+            panic("tmpfs_dir_scan: bad rec_len");
+        }
+        if (de->inode != 0 && de->name_len == len && memcmp(de->name, name, len) == 0) {
+            return off;
+        }
+        u16 used = de->inode != 0 ? tmpfs_dirent_size(de->name_len) : 0;
+        if (slot != nullptr && *slot < 0 && de->rec_len >= used + need) {
+            *slot = off;
+        }
+        off += de->rec_len;
+    }
+    return -1;
+}
+
+static u8 tmpfs_file_type(u32 inum)
+{
+    switch (tmpfs.nodes[inum - 1].type) {
+    case T_DIR:
+        return EXT2_FT_DIR;
+    case T_FILE:
+        return EXT2_FT_REG_FILE;
+    case T_DEV:
+        return EXT2_FT_CHRDEV;
+    default:
+        return EXT2_FT_UNKNOWN;
+    }
+}
+
+struct inode *tmpfs_dirlookup(struct inode *dp, char *name, u32 *poff)
+{
+    const u32 len = strlen(name);
+    if (len == 0 || len > EXT2_NAME_LEN) {
+        return nullptr;
+    }
+
+    for (u32 off = 0; off < dp->size; off += TMPFS_DIRBLK) {
+        u8 *chunk       = tmpfs_dir_chunk(dp, off);
+        const int found = tmpfs_dir_scan(chunk, name, len, 0, nullptr);
+        if (found >= 0) {
+            if (poff) {
+                *poff = off + found;
+            }
+            return iget(dp->dev, tmpfs_dirent_at(chunk, found)->inode);
+        }
+    }
+    return nullptr;
+}
+
+/**
+ * @brief Add an entry for inum to directory dp.
+ *
+ * @return 0 on success, -1 if name is already there or tmpfs is full.
+ */
+int tmpfs_dirlink(struct inode *dp, char *name, u32 inum)
+{
+    if (name == nullptr) {
+        return -1;
+    }
+
+    const u32 len = strlen(name);
+    if (len == 0 || len > EXT2_NAME_LEN) {
+        return -1;
+    }
+
+    const u16 need = tmpfs_dirent_size(len);
+    int slot       = -1;
+    u32 base       = 0;
+    for (u32 off = 0; off < dp->size; off += TMPFS_DIRBLK) {
+        int s = slot;
+        if (tmpfs_dir_scan(tmpfs_dir_chunk(dp, off), name, len, need, &s) >= 0) {
+            return -1;
+        }
+        if (slot < 0 && s >= 0) {
+            slot = s;
+            base = off;
+        }
+    }
+
+    if (slot < 0) {
+        struct tmpfs_node *tn = tmpfs_node(dp);
+        if (tmpfs_page(tn, dp->size / PGSIZE, true) == nullptr) {
+            return -1;
+        }
+        base = dp->size;
+        slot = 0;
+
+        struct ext2_dir_entry_2 *empty = tmpfs_dirent_at(tmpfs_dir_chunk(dp, base), 0);
+        empty->inode                   = 0;
+        empty->rec_len                 = TMPFS_DIRBLK;
+        dp->size += TMPFS_DIRBLK;
+        tn->size = dp->size;
+    }
+
+    u8 *chunk                   = tmpfs_dir_chunk(dp, base);
+    struct ext2_dir_entry_2 *de = tmpfs_dirent_at(chunk, slot);
+    if (de->inode != 0) {
+        u16 used                      = tmpfs_dirent_size(de->name_len);
+        struct ext2_dir_entry_2 *next = tmpfs_dirent_at(chunk, slot + used);
+        next->rec_len                 = de->rec_len - used;
+        de->rec_len                   = used;
+        de                            = next;
+    }
+    de->inode     = inum;
+    de->name_len  = len;
+    de->file_type = tmpfs_file_type(inum);
+    memmove(de->name, name, len);
+    return 0;
+}
+
+static u8 tmpfs_dirent_type(u8 file_type)
+{
+    switch (file_type) {
+    case EXT2_FT_REG_FILE:
+        return DT_REG;
+    case EXT2_FT_DIR:
+        return DT_DIR;
+    case EXT2_FT_CHRDEV:
+        return DT_CHR;
+    default:
+        return DT_UNKNOWN;
+    }
+}
+
+/**
+ * @brief Copy directory entries starting at *off into dst as struct dirent records.
+ *
+ * Works like ext2fs_getdents, a chunk at a time.
+ *
+ * @return Bytes stored in dst, 0 at the end of the directory, or -1 if
+ *         dst cannot hold the next entry.
+ */
+int tmpfs_getdents(struct inode *dp, char *dst, u32 n, u32 *off)
+{
+    const u32 pos = *off;
+    u32 copied    = 0;
+
+    for (u32 base = pos - pos % TMPFS_DIRBLK; base < dp->size; base += TMPFS_DIRBLK) {
+        u8 *chunk = tmpfs_dir_chunk(dp, base);
+        for (u32 rec = 0; rec < TMPFS_DIRBLK;) {
+            struct ext2_dir_entry_2 *de = tmpfs_dirent_at(chunk, rec);
+            if (de->rec_len < 8 || de->rec_len % 4 != 0 || rec + de->rec_len > TMPFS_DIRBLK) {
+                panic("tmpfs_getdents: bad rec_len");
+            }
+            const u32 here = base + rec;
+            rec += de->rec_len;
+            if (here < pos || de->inode == 0) {
+                continue;
+            }
+
+            const u16 reclen = DIRENT_RECLEN(de->name_len);
+            if (copied + reclen > n) {
+                *off = here;
+                return copied > 0 ? (int)copied : -1;
+            }
+            auto d      = (struct dirent *)(dst + copied);
+            d->d_ino    = de->inode;
+            d->d_off    = base + rec;
+            d->d_reclen = reclen;
+            d->d_type   = tmpfs_dirent_type(de->file_type);
+            d->d_namlen = de->name_len;
+            memmove(d->d_name, de->name, de->name_len);
+            d->d_name[de->name_len] = '\0';
+            copied += reclen;
+        }
+    }
+
+    *off = dp->size > pos ? dp->size : pos;
+    return (int)copied;
+}
@@ -14,6 +14,11 @@
 #include "framebuffer.h"
 #include "mouse.h"
 #include "physmem.h"
+#include "pagecache.h"
+#include "icache.h"
+#include "dcache.h"
+#include "shm.h"
+#include "waitqueue.h"
 
 /** @brief Start the non-boot (AP) processors. */
 static void bring_up_cpus(void);
@@ -76,12 +81,21 @@ int main(multiboot_info_t *mbinfo, [[maybe_unused]] unsigned int magic)
     mp_report_state();
     cpu_print_info();
     process_table_init();
+    vma_init();
     trap_vectors_init();
     buffer_cache_init();
+    page_cache_init();
+    icache_init();
+    dcache_init();
     file_init();
+    pipe_init();
+    shm_init();
+    futex_init();
+    poll_init();
     bring_up_cpus();
     release_usable_memory_ranges();
     kalloc_enable_locking(); // enable allocator locking after free lists are built
+    kmalloc_enable_locking();
     kernel_enable_mmio_propagation();
     pci_scan();
 #ifdef GRAPHICS
@@ -1,4 +1,5 @@
 #include "defs.h"
+#include "spinlock.h"
 #include "string.h"
 #include "types.h"
 
@@ -8,6 +9,12 @@
 // This is a simple free-list allocator that maintains a circular linked list
 // of free memory blocks. Each block has a header containing the size and
 // pointer to the next free block.
+//
+// One lock covers the whole free list, so every call is serialized and a
+// search walks the list; objects allocated and freed often are better
+// off in a kmem_cache (slab.h). Growing the heap takes the ptable lock to
+// update every page directory, so neither kmalloc nor kfree may be called
+// with it held.
 
 // Used to force proper alignment of header structures
 typedef long Align;
@@ -32,10 +39,34 @@ static Header base;
 // Pointer to the current position in the free list (where last search ended)
 static Header *freep;
 
-// Free a previously allocated block of memory
-// ap: pointer to the memory block (not including the header)
+// Protects base and freep. Like the page allocator, the heap is used
+// before the other CPUs are up, without the lock.
+static struct spinlock kmalloc_lock;
+static bool kmalloc_use_lock;
 
-void kfree(void *ap)
+/** @brief Start taking the heap lock, once every CPU can call kmalloc. */
+void kmalloc_enable_locking(void)
+{
+    initlock(&kmalloc_lock, "kmalloc");
+    kmalloc_use_lock = true;
+}
+
+static void kmalloc_acquire(void)
+{
+    if (kmalloc_use_lock) {
+        acquire(&kmalloc_lock);
+    }
+}
+
+static void kmalloc_release(void)
+{
+    if (kmalloc_use_lock) {
+        release(&kmalloc_lock);
+    }
+}
+
+// Put a block back on the free list. Caller holds kmalloc_lock.
+static void free_block(void *ap)
 {
     Header *p;
 
@@ -78,6 +109,15 @@ void kfree(void *ap)
     freep = p;
 }
 
+// Free a previously allocated block of memory
+// ap: pointer to the memory block (not including the header)
+void kfree(void *ap)
+{
+    kmalloc_acquire();
+    free_block(ap);
+    kmalloc_release();
+}
+
 // Request more memory from the operating system
 // nu: number of Header-sized units needed
 // Returns: pointer to the free list, or nullptr on failure
@@ -100,7 +140,7 @@ static Header *morecore(u32 nu)
 
     // Add the new block to the free list by "freeing" it
     // This also handles coalescing with adjacent free blocks
-    kfree((void *)(hp + 1));
+    free_block((void *)(hp + 1));
 
     return freep;
 }
@@ -109,7 +149,9 @@ static Header *morecore(u32 nu)
 void *kzalloc(u32 nbytes)
 {
     void *ptr = kmalloc(nbytes);
-    memset(ptr, 0, nbytes);
+    if (ptr != nullptr) {
+        memset(ptr, 0, nbytes);
+    }
     return ptr;
 }
 
@@ -124,6 +166,8 @@ void *kmalloc(u32 nbytes)
     // +1 for the header itself, and round up for any remainder
     u32 nunits = (nbytes + sizeof(Header) - 1) / sizeof(Header) + 1;
 
+    kmalloc_acquire();
+
     // Initialize the free list on first call
     if ((prevp = freep) == nullptr) {
         base.s.ptr  = freep = prevp = &base;
@@ -145,7 +189,8 @@ void *kmalloc(u32 nbytes)
                 p += p->s.size;      // Move to tail of remaining block
                 p->s.size = nunits;  // Set size of allocated block
             }
-            freep = prevp;          // Update search start position
+            freep = prevp; // Update search start position
+            kmalloc_release();
             return (void *)(p + 1); // Return pointer past the header
         }
 
@@ -153,6 +198,7 @@ void *kmalloc(u32 nbytes)
         if (p == freep) {
             // Request more memory from OS
             if ((p = morecore(nunits)) == nullptr) {
+                kmalloc_release();
                 return nullptr; // Out of memory
             }
         }
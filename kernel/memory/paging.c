@@ -9,6 +9,7 @@
 #include "spinlock.h"
 #include "string.h"
 #include "param.h"
+#include "pagecache.h"
 
 void freerange(void *vstart, void *vend);
 /** @brief First address after kernel loaded from ELF file */
@@ -27,8 +28,13 @@ struct
     struct spinlock lock;
     int use_lock;
     struct run *freelist;
+    u32 nfree;  // pages on the free list
+    u32 ntotal; // pages ever handed to the allocator
 } kmem;
 
+// Pages to ask the page cache for when the free list runs dry.
+#define KALLOC_RECLAIM_BATCH 16
+
 /** @brief Initialize kernel memory allocator phase 1 */
 
 void init_memory_range(void *vstart, void *vend)
@@ -51,6 +57,7 @@ void freerange(void *vstart, void *vend)
     char *p = (char *)PGROUNDUP((u32)vstart);
     for (; p + PGSIZE <= (char *)vend; p += PGSIZE) {
         kfree_page(p);
+        kmem.ntotal++;
     }
 }
 
@@ -74,6 +81,7 @@ void kfree_page(char *v)
     auto r        = (struct run *)v;
     r->next       = kmem.freelist; // The current head of the free list becomes the next of this page
     kmem.freelist = r;             // This page becomes the head of the free list
+    kmem.nfree++;
     if (kmem.use_lock) {
         release(&kmem.lock);
     }
@@ -86,15 +94,33 @@ void kfree_page(char *v)
 
 char *kalloc_page(void)
 {
-    if (kmem.use_lock) {
-        acquire(&kmem.lock);
-    }
-    struct run *r = kmem.freelist; // Gets the first free page
-    if (r) {
-        kmem.freelist = r->next; // The next free page becomes the head of the list
-    }
-    if (kmem.use_lock) {
-        release(&kmem.lock);
+    for (;;) {
+        if (kmem.use_lock) {
+            acquire(&kmem.lock);
+        }
+        struct run *r = kmem.freelist; // Gets the first free page
+        if (r) {
+            kmem.freelist = r->next; // The next free page becomes the head of the list
+            kmem.nfree--;
+        }
+        if (kmem.use_lock) {
+            release(&kmem.lock);
+        }
+        // Out of pages: shrink the page cache and try again.
+        if (r != nullptr || !kmem.use_lock || page_cache_reclaim(KALLOC_RECLAIM_BATCH) == 0) {
+            return (char *)r; // Returns the first free page (or 0 if none)
+        }
     }
-    return (char *)r; // Returns the first free page (or 0 if none)
+}
+
+/** @brief Number of pages currently on the free list */
+u32 kfree_page_count(void)
+{
+    return kmem.nfree;
+}
+
+/** @brief Number of pages managed by the page allocator */
+u32 kpage_total(void)
+{
+    return kmem.ntotal;
 }
\ No newline at end of file
@@ -0,0 +1,247 @@
+// Named shared memory objects.
+//
+// shm_open creates or finds an object by name and returns a file for it;
+// ftruncate gives it pages and mmap maps those same pages into each
+// process that asks. A mapping holds the file it was made from, so an
+// object lives until it is unlinked and its last file and mapping are
+// gone.
+
+#include "defs.h"
+#include "fcntl.h"
+#include "file.h"
+#include "mman.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "proc.h"
+#include "shm.h"
+#include "spinlock.h"
+#include "status.h"
+#include "string.h"
+
+static struct
+{
+    struct spinlock lock;
+    struct shm_object objs[NSHM];
+} shmtab;
+
+/** @brief Initialize the table of shared memory objects. */
+void shm_init(void)
+{
+    initlock(&shmtab.lock, "shm");
+}
+
+// Slot of page i of shm. Caller holds shmtab.lock or a reference that
+// keeps the object from shrinking.
+static char **shm_slot(struct shm_object *shm, u32 i)
+{
+    return &shm->ptrpages[i / SHM_PTRS_PER_PAGE][i % SHM_PTRS_PER_PAGE];
+}
+
+// Give back the pages from index npages up. Caller holds shmtab.lock.
+static void shm_shrink(struct shm_object *shm, u32 npages)
+{
+    for (u32 i = npages; i < shm->npages; i++) {
+        kfree_page(*shm_slot(shm, i));
+    }
+    for (u32 i = (npages + SHM_PTRS_PER_PAGE - 1) / SHM_PTRS_PER_PAGE; i < SHM_NPTRPAGES; i++) {
+        if (shm->ptrpages[i] != nullptr) {
+            kfree_page((char *)shm->ptrpages[i]);
+            shm->ptrpages[i] = nullptr;
+        }
+    }
+    shm->npages = npages;
+}
+
+static bool shm_name_valid(const char *name)
+{
+    const u32 len = strlen(name);
+    return len > 0 && len < SHM_NAME_MAX;
+}
+
+/**
+ * @brief Find a shared memory object by name, creating it with O_CREATE.
+ *
+ * @param omode Open flags; O_CREATE makes a new empty object if none has
+ *        the name and O_TRUNC empties an existing one.
+ * @param shmp Set to the object, which the caller holds a reference to.
+ * @return ALL_OK, -EINVARG for a bad name, -ENOENT if it does not exist
+ *         without O_CREATE, or -ENOMEM if the table is full.
+ */
+int shm_get(const char *name, int omode, struct shm_object **shmp)
+{
+    if (!shm_name_valid(name)) {
+        return -EINVARG;
+    }
+
+    struct shm_object *free = nullptr;
+    acquire(&shmtab.lock);
+    for (struct shm_object *shm = shmtab.objs; shm < &shmtab.objs[NSHM]; shm++) {
+        if (shm->ref == 0) {
+            if (free == nullptr) {
+                free = shm;
+            }
+            continue;
+        }
+        if (shm->linked && strncmp(shm->name, name, SHM_NAME_MAX) == 0) {
+            if ((omode & O_TRUNC) && shm->nmaps == 0) {
+                shm_shrink(shm, 0);
+                shm->size = 0;
+            }
+            shm->ref++;
+            release(&shmtab.lock);
+            *shmp = shm;
+            return ALL_OK;
+        }
+    }
+    if (!(omode & O_CREATE)) {
+        release(&shmtab.lock);
+        return -ENOENT;
+    }
+    if (free == nullptr) {
+        release(&shmtab.lock);
+        return -ENOMEM;
+    }
+    memset(free, 0, sizeof(*free));
+    safestrcpy(free->name, name, SHM_NAME_MAX);
+    free->linked = true;
+    free->ref    = 2; // the name and the caller
+    release(&shmtab.lock);
+    *shmp = free;
+    return ALL_OK;
+}
+
+/** @brief Drop a reference, freeing the object with the last one. */
+void shm_put(struct shm_object *shm)
+{
+    acquire(&shmtab.lock);
+    if (--shm->ref == 0) {
+        shm_shrink(shm, 0);
+        shm->size = 0;
+    }
+    release(&shmtab.lock);
+}
+
+/**
+ * @brief Remove the name of a shared memory object.
+ *
+ * Open files and mappings keep working; the memory is freed once they
+ * are gone.
+ *
+ * @return ALL_OK, -EINVARG for a bad name or -ENOENT.
+ */
+int shm_unlink(const char *name)
+{
+    if (!shm_name_valid(name)) {
+        return -EINVARG;
+    }
+    acquire(&shmtab.lock);
+    for (struct shm_object *shm = shmtab.objs; shm < &shmtab.objs[NSHM]; shm++) {
+        if (shm->ref > 0 && shm->linked && strncmp(shm->name, name, SHM_NAME_MAX) == 0) {
+            shm->linked = false;
+            if (--shm->ref == 0) {
+                shm_shrink(shm, 0);
+                shm->size = 0;
+            }
+            release(&shmtab.lock);
+            return ALL_OK;
+        }
+    }
+    release(&shmtab.lock);
+    return -ENOENT;
+}
+
+/**
+ * @brief Set the size of a shared memory object.
+ *
+ * New pages are zeroed. An object that is mapped anywhere can grow but
+ * not shrink, since a mapping may still use its pages.
+ *
+ * @return ALL_OK, -EINVARG above SHM_PAGES pages, -ENOTSUP to shrink a
+ *         mapped object, or -ENOMEM.
+ */
+int shm_truncate(struct shm_object *shm, u32 size)
+{
+    if (size > SHM_PAGES * PGSIZE) {
+        return -EINVARG;
+    }
+    const u32 npages = PGROUNDUP(size) / PGSIZE;
+
+    acquire(&shmtab.lock);
+    if (npages < shm->npages) {
+        if (shm->nmaps > 0) {
+            release(&shmtab.lock);
+            return -ENOTSUP;
+        }
+        shm_shrink(shm, npages);
+    }
+    while (shm->npages < npages) {
+        const u32 i = shm->npages;
+        if (shm->ptrpages[i / SHM_PTRS_PER_PAGE] == nullptr &&
+            (shm->ptrpages[i / SHM_PTRS_PER_PAGE] = (char **)kalloc_page()) == nullptr) {
+            break;
+        }
+        char *page = kalloc_page();
+        if (page == nullptr) {
+            break;
+        }
+        memset(page, 0, PGSIZE);
+        *shm_slot(shm, i) = page;
+        shm->npages++;
+    }
+    if (shm->npages < npages) {
+        release(&shmtab.lock);
+        return -ENOMEM;
+    }
+    // Zero the tail of the last page so growing again shows zeroes.
+    if (size < shm->size && size % PGSIZE != 0) {
+        memset(*shm_slot(shm, size / PGSIZE) + size % PGSIZE, 0, PGSIZE - size % PGSIZE);
+    }
+    shm->size = size;
+    release(&shmtab.lock);
+    return ALL_OK;
+}
+
+/**
+ * @brief Map the pages a VMA covers into the page table of p.
+ *
+ * The VMA refers to the object through its file; file_offset selects
+ * the first page.
+ *
+ * @return 0 on success or -1 if the range is past the end of the object
+ *         or a page table cannot be allocated.
+ */
+int shm_map(struct proc *p, struct vm_area *vma)
+{
+    struct shm_object *shm = vma->file->shm;
+    const u32 first        = vma->file_offset / PGSIZE;
+    const u32 n            = (vma->end - vma->start) / PGSIZE;
+    const int perm         = PTE_U | ((vma->prot & PROT_WRITE) ? PTE_W : 0);
+
+    acquire(&shmtab.lock);
+    if (first + n > shm->npages) {
+        release(&shmtab.lock);
+        return -1;
+    }
+    for (u32 i = 0; i < n; i++) {
+        const u32 pa = V2P(*shm_slot(shm, first + i));
+        if (map_physical_range(p->page_directory, vma->start + i * PGSIZE, pa, PGSIZE, perm) < 0) {
+            unmap_vm_range(p->page_directory, vma->start, vma->start + i * PGSIZE, 0);
+            release(&shmtab.lock);
+            return -1;
+        }
+    }
+    shm->nmaps++;
+    release(&shmtab.lock);
+    return 0;
+}
+
+/** @brief Remove a mapping shm_map made, leaving the pages to the object. */
+void shm_unmap(struct proc *p, struct vm_area *vma)
+{
+    if (p->page_directory != nullptr) {
+        unmap_vm_range(p->page_directory, vma->start, vma->end, 0);
+    }
+    acquire(&shmtab.lock);
+    vma->file->shm->nmaps--;
+    release(&shmtab.lock);
+}
@@ -0,0 +1,83 @@
+// Object caches for fixed-size kernel structures.
+//
+// kmalloc() searches one locked first-fit free list, which makes it a
+// poor fit for objects that come and go as often as in-core inodes. A
+// kmem_cache hands out objects of one size from pages it owns and keeps
+// freed objects for the next caller.
+
+#include "types.h"
+#include "defs.h"
+#include "mmu.h"
+#include "slab.h"
+#include "string.h"
+
+/**
+ * @brief Prepare an empty cache for objects of the given size.
+ */
+void kmem_cache_init(struct kmem_cache *cache, char *name, u32 size)
+{
+    if (size > PGSIZE) {
+        panic("kmem_cache_init: %s objects are larger than a page", name);
+    }
+    initlock(&cache->lock, name);
+    cache->name   = name;
+    cache->size   = (size + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+    cache->free   = nullptr;
+    cache->nalloc = 0;
+    cache->npages = 0;
+}
+
+// Cut a fresh page into objects and put them on the free list.
+static bool kmem_cache_grow(struct kmem_cache *cache)
+{
+    char *page = kalloc_page();
+    if (page == nullptr) {
+        return false;
+    }
+
+    acquire(&cache->lock);
+    for (u32 off = 0; off + cache->size <= PGSIZE; off += cache->size) {
+        *(void **)(page + off) = cache->free;
+        cache->free            = page + off;
+    }
+    cache->npages++;
+    release(&cache->lock);
+    return true;
+}
+
+/**
+ * @brief Allocate a zeroed object.
+ *
+ * @return The object, or nullptr if no memory is available.
+ */
+void *kmem_cache_alloc(struct kmem_cache *cache)
+{
+    for (;;) {
+        acquire(&cache->lock);
+        void *obj = cache->free;
+        if (obj != nullptr) {
+            cache->free = *(void **)obj;
+            cache->nalloc++;
+            release(&cache->lock);
+            memset(obj, 0, cache->size);
+            return obj;
+        }
+        release(&cache->lock);
+
+        if (!kmem_cache_grow(cache)) {
+            return nullptr;
+        }
+    }
+}
+
+/**
+ * @brief Return an object to its cache.
+ */
+void kmem_cache_free(struct kmem_cache *cache, void *obj)
+{
+    acquire(&cache->lock);
+    *(void **)obj = cache->free;
+    cache->free   = obj;
+    cache->nalloc--;
+    release(&cache->lock);
+}
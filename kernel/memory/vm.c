@@ -625,7 +625,7 @@ void unmap_vm_range(pde_t *pgdir, u32 start, u32 end, int free_frames)
     start = PGROUNDDOWN(start);
     end   = PGROUNDDOWN(end + PGSIZE - 1);
 
-    for (u32 a = start; a <= end; a += PGSIZE) {
+    for (u32 a = start; a < end; a += PGSIZE) {
         pte_t *pte = walkpgdir(pgdir, (char *)a, 0);
         if (pte == nullptr) {
             a = PGADDR(PDX(a) + 1, 0, 0) - PGSIZE;
@@ -716,13 +716,26 @@ bad:
 char *uva2ka(pde_t *pgdir, char *uva)
 {
     pte_t *pte = walkpgdir(pgdir, uva, 0);
-    if ((*pte & PTE_P) == 0)
+    if (pte == nullptr || (*pte & PTE_P) == 0)
         return nullptr;
     if ((*pte & PTE_U) == 0)
         return nullptr;
     return (char *)P2V(PTE_ADDR(*pte));
 }
 
+/**
+ * @brief Like uva2ka, but only for pages the user may write.
+ *
+ * @return Kernel virtual address if writable by the user, otherwise 0.
+ */
+char *uva2ka_writable(pde_t *pgdir, char *uva)
+{
+    pte_t *pte = walkpgdir(pgdir, uva, 0);
+    if (pte == nullptr || (*pte & (PTE_P | PTE_U | PTE_W)) != (PTE_P | PTE_U | PTE_W))
+        return nullptr;
+    return (char *)P2V(PTE_ADDR(*pte));
+}
+
 /**
  * @brief Copy data from kernel space to user memory.
  *
@@ -66,7 +66,7 @@ int exec(char *path, char **argv)
         return -1;
     }
 
-    ip->iops->ilock(ip);
+    ip->iops->ilock_shared(ip);
 
     struct elf_header elf;
     pde_t *pgdir = nullptr;
@@ -1,28 +1,128 @@
 #include "types.h"
 #include "defs.h"
+#include "mmu.h"
 #include "proc.h"
+#include "slab.h"
 #include "spinlock.h"
 #include "file.h"
+#include "fcntl.h"
+#include "poll.h"
+#include "status.h"
+#include "string.h"
+#include "waitqueue.h"
 
-/** @brief Maximum number of buffered bytes per pipe. */
-#define PIPESIZE 512
+/** @brief Capacity of a new pipe. */
+#define PIPE_DEFAULT_SIZE (16 * 1024)
+/** @brief Largest capacity F_SETPIPE_SZ accepts. */
+#define PIPE_MAX_SIZE (64 * 1024)
+#define PIPE_MAX_PAGES (PIPE_MAX_SIZE / PGSIZE)
+
+#define min(a, b) ((a) < (b) ? (a) : (b))
 
 /**
  * @brief Kernel representation of a unidirectional pipe.
  *
  * Synchronizes readers and writers via a spinlock and keeps a ring buffer
  * that tracks read/write offsets along with open counts for each endpoint.
+ * The ring is spread over separately allocated pages; its size is a power
+ * of two so the free-running offsets can wrap.
  */
 struct pipe
 {
     struct spinlock lock;
-    char data[PIPESIZE];
-    u32 nread;     /**< Number of bytes read from the buffer. */
-    u32 nwrite;    /**< Number of bytes written to the buffer. */
-    int readopen;  /**< Non-zero while the read end remains open. */
-    int writeopen; /**< Non-zero while the write end remains open. */
+    char *pages[PIPE_MAX_PAGES]; /**< Ring buffer, size / PGSIZE pages. */
+    u32 size;                    /**< Capacity in bytes. */
+    u32 nread;                   /**< Number of bytes read from the buffer. */
+    u32 nwrite;                  /**< Number of bytes written to the buffer. */
+    int readopen;                /**< Non-zero while the read end remains open. */
+    int writeopen;               /**< Non-zero while the write end remains open. */
+    int rwaiting;                /**< Readers asleep on an empty pipe. */
+    int wwaiting;                /**< Writers asleep on a full pipe. */
+    struct wait_queue wq;        /**< Pollers of either end. */
 };
 
+static struct kmem_cache pipe_cache;
+
+/** @brief Set up the cache pipes are allocated from. */
+void pipe_init(void)
+{
+    kmem_cache_init(&pipe_cache, "pipe", sizeof(struct pipe));
+}
+
+// Round a requested capacity up to a power of two number of pages.
+static u32 pipe_round_size(u32 size)
+{
+    u32 r = PGSIZE;
+    while (r < size) {
+        r <<= 1;
+    }
+    return r;
+}
+
+static void pipe_free_pages(char **pages, u32 npages)
+{
+    for (u32 i = 0; i < npages; i++) {
+        if (pages[i] != nullptr) {
+            kfree_page(pages[i]);
+        }
+    }
+}
+
+static bool pipe_alloc_pages(char **pages, u32 npages)
+{
+    for (u32 i = 0; i < npages; i++) {
+        if ((pages[i] = kalloc_page()) == nullptr) {
+            pipe_free_pages(pages, i);
+            return false;
+        }
+    }
+    return true;
+}
+
+// Copy n bytes at ring offset pos into dst, a page at a time.
+static void pipe_copy_out(char *const *pages, u32 size, u32 pos, char *dst, u32 n)
+{
+    while (n > 0) {
+        const u32 off   = pos & (size - 1);
+        const u32 chunk = min(n, PGSIZE - off % PGSIZE);
+        memmove(dst, pages[off / PGSIZE] + off % PGSIZE, chunk);
+        pos += chunk;
+        dst += chunk;
+        n -= chunk;
+    }
+}
+
+// Copy n bytes from src to ring offset pos, a page at a time.
+static void pipe_copy_in(char **pages, u32 size, u32 pos, const char *src, u32 n)
+{
+    while (n > 0) {
+        const u32 off   = pos & (size - 1);
+        const u32 chunk = min(n, PGSIZE - off % PGSIZE);
+        memmove(pages[off / PGSIZE] + off % PGSIZE, src, chunk);
+        pos += chunk;
+        src += chunk;
+        n -= chunk;
+    }
+}
+
+// Readers only sleep on an empty pipe and writers on a full one, so the
+// callers wake them when it stops being so rather than on every transfer.
+static void pipe_wake_readers(struct pipe *p)
+{
+    if (p->rwaiting > 0) {
+        wakeup(&p->nread);
+    }
+    wait_queue_wake(&p->wq);
+}
+
+static void pipe_wake_writers(struct pipe *p)
+{
+    if (p->wwaiting > 0) {
+        wakeup(&p->nwrite);
+    }
+    wait_queue_wake(&p->wq);
+}
+
 /**
  * @brief Allocate and initialize a pipe along with the file descriptors.
  *
@@ -36,13 +136,20 @@ int pipe_alloc(struct file **f0, struct file **f1)
     *f0            = *f1 = nullptr;
     if ((*f0 = file_alloc()) == nullptr || (*f1 = file_alloc()) == nullptr)
         goto bad;
-    if ((p = (struct pipe *)kalloc_page()) == nullptr)
+    if ((p = kmem_cache_alloc(&pipe_cache)) == nullptr)
+        goto bad;
+    if (!pipe_alloc_pages(p->pages, PIPE_DEFAULT_SIZE / PGSIZE)) {
+        kmem_cache_free(&pipe_cache, p);
+        p = nullptr;
         goto bad;
+    }
+    p->size      = PIPE_DEFAULT_SIZE;
     p->readopen  = 1;
     p->writeopen = 1;
     p->nwrite    = 0;
     p->nread     = 0;
     initlock(&p->lock, "pipe");
+    wait_queue_init(&p->wq);
     (*f0)->type     = FD_PIPE;
     (*f0)->readable = 1;
     (*f0)->writable = 0;
@@ -54,8 +161,6 @@ int pipe_alloc(struct file **f0, struct file **f1)
     return 0;
 
 bad:
-    if (p)
-        kfree_page((char *)p);
     if (*f0)
         file_close(*f0);
     if (*f1)
@@ -79,9 +184,11 @@ void pipe_close(struct pipe *p, int writable)
         p->readopen = 0;
         wakeup(&p->nwrite);
     }
+    wait_queue_wake(&p->wq);
     if (p->readopen == 0 && p->writeopen == 0) {
         release(&p->lock);
-        kfree_page((char *)p);
+        pipe_free_pages(p->pages, p->size / PGSIZE);
+        kmem_cache_free(&pipe_cache, p);
     } else
         release(&p->lock);
 }
@@ -89,26 +196,48 @@ void pipe_close(struct pipe *p, int writable)
 /**
  * @brief Write bytes into a pipe, blocking while the buffer is full.
  *
+ * Copies as much as fits at a time straight from addr.
+ *
  * @param p Pipe to write to.
  * @param addr User buffer with bytes to copy.
  * @param n Number of bytes requested.
- * @return Count of bytes written or -1 if interrupted/closed.
+ * @param flags Status flags of the open file; with O_NONBLOCK a full pipe
+ *        ends the write early instead of waiting.
+ * @return Count of bytes written, -EAGAIN if O_NONBLOCK is set and the
+ *         pipe was full, or -1 if interrupted/closed.
  */
-int pipe_write(struct pipe *p, char *addr, int n)
+int pipe_write(struct pipe *p, char *addr, int n, int flags)
 {
+    int i = 0;
+
     acquire(&p->lock);
-    for (int i = 0; i < n; i++) {
-        while (p->nwrite == p->nread + PIPESIZE) {
+    while (i < n) {
+        while (p->nwrite == p->nread + p->size) {
             if (p->readopen == 0 || current_process()->killed) {
                 release(&p->lock);
                 return -1;
             }
-            wakeup(&p->nread);
+            if (flags & O_NONBLOCK) {
+                release(&p->lock);
+                return i > 0 ? i : -EAGAIN;
+            }
+            p->wwaiting++;
             sleep(&p->nwrite, &p->lock);
+            p->wwaiting--;
+        }
+        const bool was_empty = p->nread == p->nwrite;
+        const u32 chunk      = min((u32)(n - i), p->size - (p->nwrite - p->nread));
+        pipe_copy_in(p->pages, p->size, p->nwrite, addr + i, chunk);
+        p->nwrite += chunk;
+        i += chunk;
+        if (was_empty) {
+            pipe_wake_readers(p);
         }
-        p->data[p->nwrite++ % PIPESIZE] = addr[i];
     }
-    wakeup(&p->nread);
+    // Another writer may fit in what is left.
+    if (p->wwaiting > 0 && p->nwrite != p->nread + p->size) {
+        wakeup(&p->nwrite);
+    }
     release(&p->lock);
     return n;
 }
@@ -116,30 +245,134 @@ int pipe_write(struct pipe *p, char *addr, int n)
 /**
  * @brief Read bytes from a pipe, blocking until data or closure.
  *
+ * Copies everything available up to n straight into addr.
+ *
  * @param p Pipe to read from.
  * @param addr Destination buffer to fill.
  * @param n Maximum number of bytes to copy.
- * @return Count of bytes read or ::-1 if interrupted.
+ * @param flags Status flags of the open file.
+ * @return Count of bytes read, -EAGAIN if O_NONBLOCK is set and the pipe
+ *         is empty, or ::-1 if interrupted.
  */
-int pipe_read(struct pipe *p, char *addr, int n)
+int pipe_read(struct pipe *p, char *addr, int n, int flags)
 {
-    int i;
-
     acquire(&p->lock);
     while (p->nread == p->nwrite && p->writeopen) {
         if (current_process()->killed) {
             release(&p->lock);
             return -1;
         }
+        if (flags & O_NONBLOCK) {
+            release(&p->lock);
+            return -EAGAIN;
+        }
+        p->rwaiting++;
         sleep(&p->nread, &p->lock);
+        p->rwaiting--;
     }
-    for (i = 0; i < n; i++) {
-        if (p->nread == p->nwrite) {
-            break;
-        }
-        addr[i] = p->data[p->nread++ % PIPESIZE];
+    const bool was_full = p->nwrite == p->nread + p->size;
+    const u32 chunk     = min((u32)n, p->nwrite - p->nread);
+    pipe_copy_out(p->pages, p->size, p->nread, addr, chunk);
+    p->nread += chunk;
+    if (was_full && chunk > 0) {
+        pipe_wake_writers(p);
+    }
+    // Another reader may want what is left.
+    if (p->rwaiting > 0 && p->nread != p->nwrite) {
+        wakeup(&p->nread);
+    }
+    release(&p->lock);
+    return (int)chunk;
+}
+
+/**
+ * @brief Report whether a pipe can be read or written without blocking.
+ *
+ * @param p Pipe to look at.
+ * @param pt Poll table to put on the pipe's wait queue, or null.
+ * @return POLLIN when data is buffered, POLLOUT when there is room,
+ *         POLLHUP once the write end is closed and POLLERR once the read
+ *         end is.
+ */
+int pipe_poll(struct pipe *p, struct poll_table *pt)
+{
+    poll_wait(pt, &p->wq);
+
+    int mask = 0;
+    acquire(&p->lock);
+    if (p->nread != p->nwrite) {
+        mask |= POLLIN;
+    }
+    if (p->nwrite != p->nread + p->size) {
+        mask |= POLLOUT;
+    }
+    if (!p->writeopen) {
+        mask |= POLLHUP;
+    }
+    if (!p->readopen) {
+        mask |= POLLERR;
     }
-    wakeup(&p->nwrite);
     release(&p->lock);
-    return i;
-}
\ No newline at end of file
+    return mask;
+}
+
+/** @brief Capacity of a pipe in bytes. */
+int pipe_get_size(struct pipe *p)
+{
+    acquire(&p->lock);
+    const int size = (int)p->size;
+    release(&p->lock);
+    return size;
+}
+
+/**
+ * @brief Change the capacity of a pipe, keeping what is buffered.
+ *
+ * @param p Pipe to resize.
+ * @param size Requested capacity, rounded up to a power of two number of
+ *        pages.
+ * @return The new capacity, -EINVARG if size is not positive or above
+ *         64 KiB, -EBUFFULL if more than the new capacity is buffered, or
+ *         -ENOMEM.
+ */
+int pipe_set_size(struct pipe *p, int size)
+{
+    if (size <= 0 || size > PIPE_MAX_SIZE) {
+        return -EINVARG;
+    }
+    const u32 new_size = pipe_round_size((u32)size);
+    char *pages[PIPE_MAX_PAGES];
+    if (!pipe_alloc_pages(pages, new_size / PGSIZE)) {
+        return -ENOMEM;
+    }
+
+    acquire(&p->lock);
+    const u32 used = p->nwrite - p->nread;
+    if (used > new_size) {
+        release(&p->lock);
+        pipe_free_pages(pages, new_size / PGSIZE);
+        return -EBUFFULL;
+    }
+    // Move the buffered bytes to the start of the new ring.
+    for (u32 done = 0; done < used;) {
+        const u32 chunk = min(used - done, PGSIZE);
+        pipe_copy_out(p->pages, p->size, p->nread + done, pages[done / PGSIZE], chunk);
+        done += chunk;
+    }
+    const bool was_full = used == p->size;
+    char *old[PIPE_MAX_PAGES];
+    const u32 old_npages = p->size / PGSIZE;
+    memmove(old, p->pages, sizeof(old));
+    memset(p->pages, 0, sizeof(p->pages));
+    memmove(p->pages, pages, new_size / PGSIZE * sizeof(pages[0]));
+    p->size   = new_size;
+    p->nread  = 0;
+    p->nwrite = used;
+    if (was_full && used < new_size) {
+        pipe_wake_writers(p);
+    }
+    release(&p->lock);
+
+    pipe_free_pages(old, old_npages);
+    return (int)new_size;
+}
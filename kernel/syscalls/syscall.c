@@ -129,6 +129,20 @@ extern int sys_uptime(void);
 extern int sys_getcwd(void);
 extern int sys_reboot(void);
 extern int sys_shutdown(void);
+extern int sys_getdents(void);
+extern int sys_pread(void);
+extern int sys_pwrite(void);
+extern int sys_readv(void);
+extern int sys_writev(void);
+extern int sys_sendfile(void);
+extern int sys_splice(void);
+extern int sys_fsync(void);
+extern int sys_fcntl(void);
+extern int sys_poll(void);
+extern int sys_shm_open(void);
+extern int sys_shm_unlink(void);
+extern int sys_ftruncate(void);
+extern int sys_futex(void);
 
 /** @brief Dispatch table mapping syscall numbers to handlers. */
 static int (*syscalls[])(void) = {
@@ -163,6 +177,20 @@ static int (*syscalls[])(void) = {
     [SYS_ioctl] = sys_ioctl,
     [SYS_reboot] = sys_reboot,
     [SYS_shutdown] = sys_shutdown,
+    [SYS_getdents] = sys_getdents,
+    [SYS_pread] = sys_pread,
+    [SYS_pwrite] = sys_pwrite,
+    [SYS_readv] = sys_readv,
+    [SYS_writev] = sys_writev,
+    [SYS_sendfile] = sys_sendfile,
+    [SYS_splice] = sys_splice,
+    [SYS_fsync] = sys_fsync,
+    [SYS_fcntl] = sys_fcntl,
+    [SYS_poll] = sys_poll,
+    [SYS_shm_open] = sys_shm_open,
+    [SYS_shm_unlink] = sys_shm_unlink,
+    [SYS_ftruncate] = sys_ftruncate,
+    [SYS_futex] = sys_futex,
 };
 
 /**
@@ -14,9 +14,19 @@
 #include "ext2.h"
 #include "file.h"
 #include "fcntl.h"
+#include "poll.h"
+#include "sys/uio.h"
 #include "printf.h"
 #include "string.h"
+#include "dcache.h"
+#include "shm.h"
+#include "status.h"
+#include "waitqueue.h"
 
+/** @brief Most descriptors poll keeps its state for on the kernel stack. */
+#define POLL_STACK_FDS 16
+/** @brief Most descriptors one poll call takes; its wait entries fill a page. */
+#define POLL_MAX_FDS ((int)(PGSIZE / sizeof(struct wait_entry)) - 1)
 
 /**
  * @brief Normalize an absolute path by collapsing '.', '..', and duplicate '/'.
@@ -192,7 +202,7 @@ static int argfd(int n, int *pfd, struct file **pf)
     if (argint(n, &fd) < 0) {
         return -1;
     }
-    if (fd < 0 || fd >= NOFILE || (f = current_process()->ofile[fd]) == nullptr) {
+    if ((f = fd_get(fd)) == nullptr) {
         return -1;
     }
     if (pfd) {
@@ -204,27 +214,6 @@ static int argfd(int n, int *pfd, struct file **pf)
     return 0;
 }
 
-/**
- * @brief Allocate a new descriptor slot for an open file.
- *
- * Takes ownership of the reference on success.
- *
- * @param f File to install.
- * @return Descriptor index or -1 if the table is full.
- */
-static int fdalloc(struct file *f)
-{
-    struct proc *curproc = current_process();
-
-    for (int fd = 0; fd < NOFILE; fd++) {
-        if (curproc->ofile[fd] == nullptr) {
-            curproc->ofile[fd] = f;
-            return fd;
-        }
-    }
-    return -1;
-}
-
 /** @brief Duplicate a file descriptor (syscall handler). */
 int sys_dup(void)
 {
@@ -234,7 +223,7 @@ int sys_dup(void)
     if (argfd(0, nullptr, &f) < 0) {
         return -1;
     }
-    if ((fd = fdalloc(f)) < 0) {
+    if ((fd = fd_install(f)) < 0) {
         return -1;
     }
     file_dup(f);
@@ -254,6 +243,26 @@ int sys_read(void)
     return file_read(f, p, n);
 }
 
+/**
+ * @brief Read directory entries as struct dirent records.
+ *
+ * Fills the buffer with as many entries as fit, starting at the file
+ * offset, and advances the offset past them.
+ *
+ * @return Bytes stored, 0 at the end of the directory, or -1 on error.
+ */
+int sys_getdents(void)
+{
+    struct file *f;
+    int n;
+    char *p;
+
+    if (argfd(0, nullptr, &f) < 0 || argint(2, &n) < 0 || argptr(1, &p, n) < 0) {
+        return -1;
+    }
+    return file_getdents(f, p, n);
+}
+
 /** @brief Write user memory to a file descriptor. */
 int sys_write(void)
 {
@@ -267,6 +276,186 @@ int sys_write(void)
     return file_write(f, p, n);
 }
 
+/**
+ * @brief Read at an explicit offset without moving the file offset.
+ *
+ * @return Bytes read, or -1 on error or if the file cannot seek.
+ */
+int sys_pread(void)
+{
+    struct file *f;
+    int n;
+    int off;
+    char *p;
+
+    if (argfd(0, nullptr, &f) < 0 || argint(2, &n) < 0 || argptr(1, &p, n) < 0 || argint(3, &off) < 0 || off < 0) {
+        return -1;
+    }
+    return file_pread(f, p, n, off);
+}
+
+/**
+ * @brief Write at an explicit offset without moving the file offset.
+ *
+ * @return Bytes written, or -1 on error or if the file cannot seek.
+ */
+int sys_pwrite(void)
+{
+    struct file *f;
+    int n;
+    int off;
+    char *p;
+
+    if (argfd(0, nullptr, &f) < 0 || argint(2, &n) < 0 || argptr(1, &p, n) < 0 || argint(3, &off) < 0 || off < 0) {
+        return -1;
+    }
+    return file_pwrite(f, p, n, off);
+}
+
+// Copy the iovec array in argument n into iov and check every segment
+// lies in user memory. Returns the segment count, or -1.
+static int argiov(int n, struct iovec *iov)
+{
+    struct proc *curproc = current_process();
+    int cnt;
+    char *p;
+
+    if (argint(n + 1, &cnt) < 0 || cnt < 0 || cnt > IOV_MAX) {
+        return -1;
+    }
+    if (argptr(n, &p, cnt * (int)sizeof(struct iovec)) < 0) {
+        return -1;
+    }
+    memmove(iov, p, cnt * sizeof(struct iovec));
+
+    u32 total = 0;
+    for (int i = 0; i < cnt; i++) {
+        u32 base = (u32)iov[i].iov_base;
+        u32 len  = iov[i].iov_len;
+        if (len == 0) {
+            continue;
+        }
+        if (base >= curproc->brk || len > curproc->brk - base || len > 0x7fffffff - total) {
+            return -1;
+        }
+        total += len;
+    }
+    return cnt;
+}
+
+/**
+ * @brief Read into several buffers with one call.
+ *
+ * Fills the segments in order and stops at the first short read.
+ *
+ * @return Total bytes read, or -1 on error.
+ */
+int sys_readv(void)
+{
+    struct file *f;
+    struct iovec iov[IOV_MAX];
+    int cnt;
+
+    if (argfd(0, nullptr, &f) < 0 || (cnt = argiov(1, iov)) < 0) {
+        return -1;
+    }
+    return file_readv(f, iov, cnt);
+}
+
+/**
+ * @brief Write several buffers with one call.
+ *
+ * Inode writes happen under a single lock, so the segments land
+ * contiguously even when other processes write the same file.
+ *
+ * @return Total bytes written, or -1 on error.
+ */
+int sys_writev(void)
+{
+    struct file *f;
+    struct iovec iov[IOV_MAX];
+    int cnt;
+
+    if (argfd(0, nullptr, &f) < 0 || (cnt = argiov(1, iov)) < 0) {
+        return -1;
+    }
+    return file_writev(f, iov, cnt);
+}
+
+// Fetch the optional offset pointer in argument n: *pp is nullptr when
+// the caller passed a null pointer. Returns -1 if the pointer is invalid
+// or the offset is negative.
+static int argoff(int n, u32 **pp)
+{
+    int addr;
+    char *p;
+
+    if (argint(n, &addr) < 0) {
+        return -1;
+    }
+    if (addr == 0) {
+        *pp = nullptr;
+        return 0;
+    }
+    if (argptr(n, &p, sizeof(int)) < 0 || *(int *)p < 0) {
+        return -1;
+    }
+    *pp = (u32 *)p;
+    return 0;
+}
+
+/**
+ * @brief Copy data from one file to another without a trip through user memory.
+ *
+ * Reads from the regular file in_fd straight out of the page cache and
+ * writes it to out_fd, which may be a pipe, file or device.
+ *
+ * Arguments: out_fd, in_fd, offset (may be null), count. When offset is
+ * not null, reading starts at *offset, which is advanced, and the file
+ * offset of in_fd is left alone.
+ *
+ * @return Bytes copied, 0 at end of file, or -1 on error.
+ */
+int sys_sendfile(void)
+{
+    struct file *out;
+    struct file *in;
+    u32 *off;
+    int n;
+
+    if (argfd(0, nullptr, &out) < 0 || argfd(1, nullptr, &in) < 0 || argoff(2, &off) < 0 || argint(3, &n) < 0) {
+        return -1;
+    }
+    if (in->type != FD_INODE) {
+        return -1;
+    }
+    return file_splice(in, off, out, nullptr, n);
+}
+
+/**
+ * @brief Move data between two files inside the kernel.
+ *
+ * Arguments: fd_in, off_in, fd_out, off_out, len. The offsets work as
+ * for sendfile and must be null for pipes. Reading from a pipe returns
+ * once the pipe is drained.
+ *
+ * @return Bytes moved, 0 at end of input, or -1 on error.
+ */
+int sys_splice(void)
+{
+    struct file *in;
+    struct file *out;
+    u32 *in_off;
+    u32 *out_off;
+    int n;
+
+    if (argfd(0, nullptr, &in) < 0 || argoff(1, &in_off) < 0 || argfd(2, nullptr, &out) < 0 ||
+        argoff(3, &out_off) < 0 || argint(4, &n) < 0) {
+        return -1;
+    }
+    return file_splice(in, in_off, out, out_off, n);
+}
+
 /** @brief Close a file descriptor. */
 int sys_close(void)
 {
@@ -276,7 +465,7 @@ int sys_close(void)
     if (argfd(0, &fd, &f) < 0) {
         return -1;
     }
-    current_process()->ofile[fd] = nullptr;
+    fd_remove(fd);
     file_close(f);
     return 0;
 }
@@ -293,6 +482,230 @@ int sys_fstat(void)
     return file_stat(f, st);
 }
 
+int sys_fsync(void)
+{
+    struct file *f;
+
+    if (argfd(0, nullptr, &f) < 0) {
+        return -1;
+    }
+    return file_sync(f);
+}
+
+/**
+ * @brief Get or set the status flags of an open file or the size of a pipe (syscall handler).
+ *
+ * F_GETFL returns the access mode together with O_DIRECT and O_NONBLOCK.
+ * F_SETFL only changes O_NONBLOCK; the other bits of the argument are
+ * ignored. F_GETPIPE_SZ and F_SETPIPE_SZ only work on pipes.
+ */
+int sys_fcntl(void)
+{
+    struct file *f;
+    int cmd;
+    int arg;
+
+    if (argfd(0, nullptr, &f) < 0 || argint(1, &cmd) < 0 || argint(2, &arg) < 0) {
+        return -1;
+    }
+    switch (cmd) {
+    case F_GETFL: {
+        int mode = f->readable && f->writable ? O_RDWR : f->writable ? O_WRONLY : O_RDONLY;
+        return mode | (f->direct ? O_DIRECT : 0) | f->flags;
+    }
+    case F_SETFL:
+        f->flags = (f->flags & ~O_NONBLOCK) | (arg & O_NONBLOCK);
+        return 0;
+    case F_GETPIPE_SZ:
+        return f->type == FD_PIPE ? pipe_get_size(f->pipe) : -EINVARG;
+    case F_SETPIPE_SZ:
+        return f->type == FD_PIPE ? pipe_set_size(f->pipe, arg) : -EINVARG;
+    default:
+        return -1;
+    }
+}
+
+/**
+ * @brief Wait for any of a set of file descriptors to become ready (syscall handler).
+ *
+ * Arguments: struct pollfd array, its length and a timeout in
+ * milliseconds; a negative timeout waits forever and zero only looks.
+ * The timeout is rounded up to whole clock ticks.
+ *
+ * @return Number of entries with a non-zero revents, 0 on timeout, -1 if
+ *         the process was killed while waiting, -EINVARG for more than
+ *         POLL_MAX_FDS entries, or -ENOMEM.
+ */
+int sys_poll(void)
+{
+    struct pollfd *fds;
+    int nfds;
+    int timeout;
+
+    if (argint(1, &nfds) < 0 || argint(2, &timeout) < 0) {
+        return -1;
+    }
+    if (nfds < 0 || nfds > POLL_MAX_FDS) {
+        return -EINVARG;
+    }
+    if (argptr(0, (void *)&fds, nfds * (int)sizeof(*fds)) < 0) {
+        return -1;
+    }
+
+    // Hold a reference to every file so none goes away while this process
+    // sits on its wait queue. One wait entry per file plus one for the clock.
+    // Small calls keep both on the stack; larger ones take a page for each.
+    struct file *files_small[POLL_STACK_FDS + 1];
+    struct wait_entry entries_small[POLL_STACK_FDS + 1];
+    struct file **files        = files_small;
+    struct wait_entry *entries = entries_small;
+    const bool large           = nfds > POLL_STACK_FDS;
+    if (large) {
+        files   = (struct file **)kalloc_page();
+        entries = (struct wait_entry *)kalloc_page();
+        if (files == nullptr || entries == nullptr) {
+            if (files != nullptr) {
+                kfree_page((char *)files);
+            }
+            if (entries != nullptr) {
+                kfree_page((char *)entries);
+            }
+            return -ENOMEM;
+        }
+    }
+    for (int i = 0; i < nfds; i++) {
+        struct file *f = fds[i].fd >= 0 ? fd_get(fds[i].fd) : nullptr;
+        files[i]       = f != nullptr ? file_dup(f) : nullptr;
+    }
+
+    struct poll_table pt;
+    poll_table_init(&pt, entries, nfds + 1);
+    struct poll_table *wait = timeout != 0 ? &pt : nullptr;
+    u32 deadline            = 0;
+    if (timeout > 0) {
+        acquire(&tickslock);
+        deadline = ticks + (u32)(((u64)timeout * TIMER_FREQUENCY_HZ + 999) / 1000);
+        release(&tickslock);
+        poll_wait(wait, &timer_wait_queue);
+    }
+
+    int ready;
+    for (;;) {
+        ready = 0;
+        for (int i = 0; i < nfds; i++) {
+            fds[i].revents = 0;
+            if (files[i] != nullptr) {
+                const int mask = file_poll(files[i], wait);
+                fds[i].revents = (short)(mask & (fds[i].events | POLLERR | POLLHUP));
+            } else if (fds[i].fd >= 0) {
+                fds[i].revents = POLLNVAL;
+            }
+            if (fds[i].revents != 0) {
+                ready++;
+            }
+        }
+        wait = nullptr; // already on every wait queue
+        if (ready > 0 || timeout == 0) {
+            break;
+        }
+        if (current_process()->killed) {
+            ready = -1;
+            break;
+        }
+        if (timeout > 0 && (i32)(ticks - deadline) >= 0) {
+            break;
+        }
+        poll_table_sleep(&pt);
+    }
+
+    poll_table_free(&pt);
+    for (int i = 0; i < nfds; i++) {
+        if (files[i] != nullptr) {
+            file_close(files[i]);
+        }
+    }
+    if (large) {
+        kfree_page((char *)files);
+        kfree_page((char *)entries);
+    }
+    return ready;
+}
+
+/**
+ * @brief Open a named shared memory object (syscall handler).
+ *
+ * Arguments: name and open flags. O_CREATE creates the object if it does
+ * not exist, O_TRUNC empties it, and the access mode limits what mmap
+ * may map. A new object is empty until ftruncate sizes it.
+ *
+ * @return File descriptor, -EINVARG for a bad name, -ENOENT, or -ENOMEM.
+ */
+int sys_shm_open(void)
+{
+    char *name;
+    int omode;
+
+    if (argstr(0, &name) < 0 || argint(1, &omode) < 0) {
+        return -1;
+    }
+    struct shm_object *shm;
+    const int r = shm_get(name, omode, &shm);
+    if (r < 0) {
+        return r;
+    }
+
+    struct file *f;
+    int fd = -1;
+    if ((f = file_alloc()) == nullptr || (fd = fd_install(f)) < 0) {
+        if (f) {
+            file_close(f);
+        }
+        shm_put(shm);
+        return -ENOMEM;
+    }
+    f->type     = FD_SHM;
+    f->shm      = shm;
+    f->readable = !(omode & O_WRONLY);
+    f->writable = (omode & O_WRONLY) || (omode & O_RDWR);
+    return fd;
+}
+
+/**
+ * @brief Remove the name of a shared memory object (syscall handler).
+ *
+ * @return 0, -EINVARG for a bad name or -ENOENT.
+ */
+int sys_shm_unlink(void)
+{
+    char *name;
+
+    if (argstr(0, &name) < 0) {
+        return -1;
+    }
+    return shm_unlink(name);
+}
+
+/**
+ * @brief Set the size of an open shared memory object (syscall handler).
+ *
+ * @return 0, -EINVARG for a negative or too large size or a descriptor
+ *         that is not shared memory opened for writing, -ENOTSUP to shrink
+ *         a mapped object, or -ENOMEM.
+ */
+int sys_ftruncate(void)
+{
+    struct file *f;
+    int length;
+
+    if (argfd(0, nullptr, &f) < 0 || argint(1, &length) < 0) {
+        return -1;
+    }
+    if (f->type != FD_SHM || !f->writable || length < 0) {
+        return -EINVARG;
+    }
+    return shm_truncate(f->shm, (u32)length);
+}
+
 int sys_lseek(void)
 {
     struct file *f;
@@ -367,6 +780,7 @@ int sys_link(void)
         ip->iops->iunlockput(dp);
         goto bad;
     }
+    dcache_enter(dp->dev, dp->inum, name, ip->inum);
     ip->iops->iunlockput(dp);
     ip->iops->iput(ip);
 
@@ -441,6 +855,10 @@ int sys_unlink(void)
 
     if ((ip = dp->iops->dirlookup(dp, name, &off)) == nullptr)
         goto bad;
+    if (ismountpoint(ip)) {
+        ip->iops->iput(ip);
+        goto bad;
+    }
     ip->iops->ilock(ip);
 
     if (ip->nlink < 1)
@@ -453,7 +871,9 @@ int sys_unlink(void)
     u32 zero = 0;
     if (dp->iops->writei(dp, (char *)&zero, off, sizeof(zero)) != sizeof(zero))
         panic("unlink: write inode");
+    dcache_enter(dp->dev, dp->inum, name, 0);
     if (ip->type == T_DIR) {
+        dcache_purge(ip->dev, ip->inum);
         dp->nlink--;
         ip->iops->iupdate(dp);
     }
@@ -498,8 +918,10 @@ static struct inode *create(char *path, short type, short major, short minor)
         return nullptr;
     }
 
+    // A file system that lives in memory can run out of inodes or space.
     if ((ip = dp->iops->ialloc(dp->dev, type)) == nullptr) {
-        panic("create: ialloc");
+        dp->iops->iunlockput(dp);
+        return nullptr;
     }
 
     ASSERT(ip->addrs != nullptr, "ip->addrs is null in create");
@@ -516,11 +938,12 @@ static struct inode *create(char *path, short type, short major, short minor)
         dp->iops->iupdate(dp);
         // No ip->nlink++ for ".": avoid cyclic ref count.
         if (ip->iops->dirlink(ip, ".", ip->inum) < 0 || ip->iops->dirlink(ip, "..", dp->inum) < 0)
-            panic("create dots");
+            goto bad;
     }
 
     if (dp->iops->dirlink(dp, name, ip->inum) < 0)
-        panic("create: dirlink");
+        goto bad;
+    dcache_enter(dp->dev, dp->inum, name, ip->inum);
 
     dp->iops->iunlockput(dp);
 
@@ -529,6 +952,18 @@ static struct inode *create(char *path, short type, short major, short minor)
     }
 
     return ip;
+
+bad:
+    // Out of space: drop the new inode again.
+    if (type == T_DIR) {
+        dp->nlink--;
+        dp->iops->iupdate(dp);
+    }
+    dp->iops->iunlockput(dp);
+    ip->nlink = 0;
+    ip->iops->iupdate(ip);
+    ip->iops->iunlockput(ip);
+    return nullptr;
 }
 
 int open_file(char *path, int omode)
@@ -548,14 +983,14 @@ int open_file(char *path, int omode)
         if ((ip = namei(path)) == nullptr) {
             return -1;
         }
-        ip->iops->ilock(ip);
+        ip->iops->ilock_shared(ip);
         if (ip->type == T_DIR && omode != O_RDONLY) {
             ip->iops->iunlockput(ip);
             return -1;
         }
     }
 
-    if ((f = file_alloc()) == nullptr || (fd = fdalloc(f)) < 0) {
+    if ((f = file_alloc()) == nullptr || (fd = fd_install(f)) < 0) {
         if (f) {
             file_close(f);
         }
@@ -569,6 +1004,8 @@ int open_file(char *path, int omode)
     f->off      = 0;
     f->readable = !(omode & O_WRONLY);
     f->writable = (omode & O_WRONLY) || (omode & O_RDWR);
+    f->direct   = (omode & O_DIRECT) != 0;
+    f->flags    = omode & O_NONBLOCK;
     return fd;
 }
 
@@ -697,9 +1134,9 @@ int sys_pipe(void)
     if (pipe_alloc(&rf, &wf) < 0)
         return -1;
     int fd0 = -1;
-    if ((fd0 = fdalloc(rf)) < 0 || (fd1 = fdalloc(wf)) < 0) {
+    if ((fd0 = fd_install(rf)) < 0 || (fd1 = fd_install(wf)) < 0) {
         if (fd0 >= 0)
-            current_process()->ofile[fd0] = nullptr;
+            fd_remove(fd0);
         file_close(rf);
         file_close(wf);
         return -1;
@@ -8,9 +8,13 @@
 #include "file.h"
 #include "mman.h"
 #include "framebuffer.h"
+#include "futex.h"
 #include "memlayout.h"
+#include "shm.h"
+#include "status.h"
 #include "console.h"
 #include "devtab.h"
+#include "ext2.h"
 #include "termios.h"
 #include "sys/ioctl.h"
 
@@ -51,11 +55,7 @@ int sys_getpid(void)
 
 static int fd_is_console(int fd)
 {
-    struct proc *curproc = current_process();
-    if (fd < 0 || fd >= NOFILE) {
-        return 0;
-    }
-    struct file *f = curproc->ofile[fd];
+    struct file *f = fd_get(fd);
     if (f == nullptr || f->type != FD_INODE || f->ip == nullptr) {
         return 0;
     }
@@ -163,11 +163,7 @@ int sys_ioctl(void)
         return -1;
     }
 
-    struct proc *curproc = current_process();
-    if (fd < 0 || fd >= NOFILE) {
-        return -1;
-    }
-    f = curproc->ofile[fd];
+    f = fd_get(fd);
     if (f == nullptr || f->type != FD_INODE || f->ip == nullptr || f->ip->type != T_DEV) {
         return -1;
     }
@@ -248,7 +244,7 @@ static int mmap_framebuffer(struct proc *p, u32 length, int prot, int flags, str
     }
     length = PGROUNDUP(length);
 
-    struct vm_area *vma = (struct vm_area *)kzalloc(sizeof(*vma));
+    struct vm_area *vma = vma_alloc();
     if (vma == nullptr) {
         return -1;
     }
@@ -275,7 +271,7 @@ static int mmap_framebuffer(struct proc *p, u32 length, int prot, int flags, str
         if (vma->file != nullptr) {
             file_close(vma->file);
         }
-        kfree(vma);
+        vma_free(vma);
         return -1;
     }
 
@@ -285,9 +281,58 @@ static int mmap_framebuffer(struct proc *p, u32 length, int prot, int flags, str
 #endif
 }
 
+/**
+ * @brief Map a shared memory object at the lowest free address above
+ * SHM_MMAP_BASE.
+ */
+static int mmap_shm(struct proc *p, u32 length, int prot, int flags, struct file *f, u32 offset)
+{
+    if ((flags & MAP_SHARED) == 0 || offset % PGSIZE != 0) {
+        return -1;
+    }
+    if ((prot & PROT_WRITE) && !f->writable) {
+        return -1;
+    }
+    length = PGROUNDUP(length);
+
+    u32 start = SHM_MMAP_BASE;
+    for (struct vm_area *v = p->vma_list; v != nullptr;) {
+        if (v->start < start + length && start < v->end) {
+            start = PGROUNDUP(v->end);
+            v     = p->vma_list; // look again from the top
+            continue;
+        }
+        v = v->next;
+    }
+    if (start + length > KERNBASE || start + length < start) {
+        return -1;
+    }
+
+    struct vm_area *vma = vma_alloc();
+    if (vma == nullptr) {
+        return -1;
+    }
+    vma->start       = start;
+    vma->end         = start + length;
+    vma->prot        = prot;
+    vma->flags       = VMA_FLAG_SHM;
+    vma->file        = file_dup(f);
+    vma->file_offset = offset;
+
+    if (shm_map(p, vma) < 0) {
+        file_close(vma->file);
+        vma_free(vma);
+        return -1;
+    }
+
+    vma->next   = p->vma_list;
+    p->vma_list = vma;
+    return (int)vma->start;
+}
+
 /**
  * @brief Memory-map a file or device (syscall handler).
- * @warning Only framebuffer mapping is currently supported.
+ * @warning Only the framebuffer and shared memory objects can be mapped.
  */
 int sys_mmap(void)
 {
@@ -304,10 +349,7 @@ int sys_mmap(void)
     }
 
     struct proc *p = current_process();
-    if (fd < 0 || fd >= NOFILE) {
-        return -1;
-    }
-    struct file *f = p->ofile[fd];
+    struct file *f = fd_get(fd);
     if (f == nullptr) {
         return -1;
     }
@@ -317,6 +359,9 @@ int sys_mmap(void)
     if (length <= 0) {
         return -1;
     }
+    if (f->type == FD_SHM) {
+        return mmap_shm(p, (u32)length, prot, flags, f, (u32)offset);
+    }
     if (f->type != FD_INODE || f->ip == nullptr || f->ip->type != T_DEV) {
         return -1;
     }
@@ -331,7 +376,7 @@ int sys_mmap(void)
 
 /**
  * @brief Unmap a memory-mapped region (syscall handler).
- * @warning Only device unmapping is currently supported.
+ * @warning Only device and shared memory mappings can be unmapped.
  */
 int sys_munmap(void)
 {
@@ -351,6 +396,10 @@ int sys_munmap(void)
         if (addr == (int)cur->start && (u32)(addr + length) >= cur->end) {
             if (cur->flags & VMA_FLAG_DEVICE) {
                 unmap_vm_range(p->page_directory, cur->start, cur->end, 0);
+            } else if (cur->flags & VMA_FLAG_SHM) {
+                shm_unmap(p, cur);
+                // The pages may be freed below; drop stale TLB entries.
+                lcr3(V2P(p->page_directory));
             } else {
                 return -1;
             }
@@ -358,7 +407,7 @@ int sys_munmap(void)
             if (cur->file != nullptr) {
                 file_close(cur->file);
             }
-            kfree(cur);
+            vma_free(cur);
             return 0;
         }
         prev = &cur->next;
@@ -392,6 +441,35 @@ int sys_sleep(void)
     return 0;
 }
 
+/**
+ * @brief Wait on or wake a user-space lock word (syscall handler).
+ *
+ * futex(addr, FUTEX_WAIT, val, timeout) sleeps while *addr == val, for at
+ * most timeout milliseconds unless timeout is negative.
+ * futex(addr, FUTEX_WAKE, n, 0) wakes up to n of those sleepers.
+ *
+ * @return 0 or the number woken on success, otherwise a negative error.
+ */
+int sys_futex(void)
+{
+    int addr;
+    int op;
+    int val;
+    int timeout;
+
+    if (argint(0, &addr) < 0 || argint(1, &op) < 0 || argint(2, &val) < 0 || argint(3, &timeout) < 0) {
+        return -1;
+    }
+    switch (op) {
+    case FUTEX_WAIT:
+        return futex_wait((u32)addr, (u32)val, timeout);
+    case FUTEX_WAKE:
+        return futex_wake((u32)addr, val);
+    default:
+        return -EINVARG;
+    }
+}
+
 int sys_yield(void)
 {
     yield();
@@ -411,6 +489,7 @@ int sys_uptime(void)
 
 int sys_reboot(void)
 {
+    ext2fs_sync(true);
     u8 good = 0x02;
     while (good & 0x02)
         good = inb(0x64);
@@ -420,6 +499,7 @@ int sys_reboot(void)
 
 int sys_shutdown()
 {
+    ext2fs_sync(true);
     outw(0x604, 0x2000);  // qemu
     outw(0x4004, 0x3400); // VirtualBox
     outw(0xB004, 0x2000); // Bochs
@@ -0,0 +1,185 @@
+// Fast user-space locks.
+//
+// A futex is any aligned 32-bit word in user memory. User code changes it
+// with atomic instructions and only enters the kernel to sleep when the
+// word says the lock is taken, or to wake sleepers after releasing it.
+// Sleepers are keyed by the physical address of the word so processes
+// sharing the page through shm find each other, and hashed into buckets
+// whose lock orders the value check in futex_wait against futex_wake.
+
+#include "types.h"
+#include "defs.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "param.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "status.h"
+
+#define FUTEX_BUCKETS 64
+
+// One process sleeping in futex_wait, on its kernel stack.
+struct futex_waiter
+{
+    u32 key;
+    bool woken;
+    void *chan; // what the waiter sleeps on
+    struct futex_waiter *next;
+};
+
+static struct futex_bucket
+{
+    struct spinlock lock;
+    struct futex_waiter *head; // oldest first
+} futex_buckets[FUTEX_BUCKETS];
+
+/** @brief Initialize the futex hash buckets. */
+void futex_init(void)
+{
+    for (int i = 0; i < FUTEX_BUCKETS; i++) {
+        initlock(&futex_buckets[i].lock, "futex");
+        futex_buckets[i].head = nullptr;
+    }
+}
+
+static struct futex_bucket *futex_bucket(u32 key)
+{
+    return &futex_buckets[(key >> 2) % FUTEX_BUCKETS];
+}
+
+// Whether uaddr is in ordinary process memory or a shared memory
+// mapping. Device mappings such as the framebuffer are user pages too,
+// but not RAM, so they cannot hold a futex.
+static bool futex_addr_ok(struct proc *p, u32 uaddr)
+{
+    if (uaddr + sizeof(u32) <= p->brk) {
+        return true;
+    }
+    for (struct vm_area *vma = p->vma_list; vma != nullptr; vma = vma->next) {
+        if ((vma->flags & VMA_FLAG_SHM) && uaddr >= vma->start && uaddr + sizeof(u32) <= vma->end) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Find the physical address of the user word at uaddr. The page stays
+// mapped for the rest of the system call since only this process can
+// unmap it.
+static int futex_key(u32 uaddr, u32 *key, u32 **kaddr)
+{
+    struct proc *p = current_process();
+    if (uaddr % sizeof(u32) != 0 || uaddr >= KERNBASE) {
+        return -EINVARG;
+    }
+    if (!futex_addr_ok(p, uaddr)) {
+        return -EFAULT;
+    }
+    char *page = uva2ka(p->page_directory, (char *)PGROUNDDOWN(uaddr));
+    if (page == nullptr || V2P(page) >= PHYSTOP) {
+        return -EFAULT;
+    }
+    *kaddr = (u32 *)(page + (uaddr & (PGSIZE - 1)));
+    *key   = V2P(*kaddr);
+    return 0;
+}
+
+static void futex_dequeue(struct futex_bucket *b, struct futex_waiter *w)
+{
+    struct futex_waiter **pp;
+    for (pp = &b->head; *pp != w; pp = &(*pp)->next)
+        ;
+    *pp = w->next;
+}
+
+/**
+ * @brief Sleep until woken by futex_wake, if the word at uaddr holds val.
+ *
+ * @param uaddr User address of an aligned 32-bit word.
+ * @param val Value the caller last saw in the word.
+ * @param timeout Milliseconds to wait at most, or negative to wait forever.
+ * @return 0 once woken, -EAGAIN if the word no longer holds val,
+ *         -ETIMEDOUT, -EINVARG or -EFAULT for a bad address, or -1 if
+ *         killed.
+ */
+int futex_wait(u32 uaddr, u32 val, int timeout)
+{
+    u32 key;
+    u32 *kaddr;
+    const int rc = futex_key(uaddr, &key, &kaddr);
+    if (rc < 0) {
+        return rc;
+    }
+
+    u32 deadline = 0;
+    if (timeout >= 0) {
+        acquire(&tickslock);
+        deadline = ticks + (u32)(((u64)timeout * TIMER_FREQUENCY_HZ + 999) / 1000);
+        release(&tickslock);
+    }
+
+    struct futex_bucket *b = futex_bucket(key);
+    acquire(&b->lock);
+    if (__atomic_load_n(kaddr, __ATOMIC_SEQ_CST) != val) {
+        release(&b->lock);
+        return -EAGAIN;
+    }
+
+    // With a timeout, sleep on the clock so every tick checks the deadline.
+    struct futex_waiter w = {.key = key, .woken = false, .next = nullptr};
+    w.chan                = timeout >= 0 ? (void *)&ticks : (void *)&w;
+    struct futex_waiter **pp;
+    for (pp = &b->head; *pp != nullptr; pp = &(*pp)->next)
+        ;
+    *pp = &w;
+
+    int result = 0;
+    while (!w.woken) {
+        if (current_process()->killed) {
+            result = -1;
+            break;
+        }
+        if (timeout >= 0 && (i32)(ticks - deadline) >= 0) {
+            result = -ETIMEDOUT;
+            break;
+        }
+        sleep(w.chan, &b->lock);
+    }
+    if (!w.woken) {
+        futex_dequeue(b, &w);
+    }
+    release(&b->lock);
+    return result;
+}
+
+/**
+ * @brief Wake up to n processes waiting on the word at uaddr, oldest first.
+ *
+ * @return Number of processes woken, or -EINVARG or -EFAULT for a bad address.
+ */
+int futex_wake(u32 uaddr, int n)
+{
+    u32 key;
+    u32 *kaddr;
+    const int rc = futex_key(uaddr, &key, &kaddr);
+    if (rc < 0) {
+        return rc;
+    }
+
+    struct futex_bucket *b = futex_bucket(key);
+    int woken              = 0;
+    acquire(&b->lock);
+    for (struct futex_waiter **pp = &b->head; *pp != nullptr && woken < n;) {
+        struct futex_waiter *w = *pp;
+        if (w->key != key) {
+            pp = &w->next;
+            continue;
+        }
+        *pp      = w->next;
+        w->woken = true;
+        wakeup(w->chan);
+        woken++;
+    }
+    release(&b->lock);
+    return woken;
+}
@@ -8,11 +8,14 @@
 #include "x86.h"
 #include "proc.h"
 #include "ext2.h"
+#include "tmpfs.h"
 #include "io.h"
 #include "printf.h"
 #include "scheduler.h"
 #include "file.h"
 #include "mman.h"
+#include "shm.h"
+#include "slab.h"
 
 extern struct ptable_t ptable;
 
@@ -42,6 +45,26 @@ struct proc *current_process(void)
     return p;
 }
 
+static struct kmem_cache vma_cache;
+
+/** @brief Set up the cache VM areas are allocated from. */
+void vma_init(void)
+{
+    kmem_cache_init(&vma_cache, "vma", sizeof(struct vm_area));
+}
+
+/** @brief Allocate a zeroed VM area, or nullptr if memory is short. */
+struct vm_area *vma_alloc(void)
+{
+    return kmem_cache_alloc(&vma_cache);
+}
+
+/** @brief Free a VM area that is no longer on any list. */
+void vma_free(struct vm_area *vma)
+{
+    kmem_cache_free(&vma_cache, vma);
+}
+
 static void free_vma_chain(struct vm_area *head)
 {
     struct vm_area *vma = head;
@@ -50,7 +73,7 @@ static void free_vma_chain(struct vm_area *head)
         if (vma->file != nullptr) {
             file_close(vma->file);
         }
-        kfree(vma);
+        vma_free(vma);
         vma = next;
     }
 }
@@ -64,6 +87,8 @@ void proc_free_vmas(struct proc *p)
     while (vma != nullptr) {
         if ((vma->flags & VMA_FLAG_DEVICE) && p->page_directory != nullptr) {
             unmap_vm_range(p->page_directory, vma->start, vma->end, 0);
+        } else if (vma->flags & VMA_FLAG_SHM) {
+            shm_unmap(p, vma);
         }
         vma = vma->next;
     }
@@ -88,7 +113,7 @@ struct vm_area *proc_ensure_heap_vma(struct proc *p)
         return heap;
     }
 
-    heap = (struct vm_area *)kzalloc(sizeof(*heap));
+    heap = vma_alloc();
     if (heap == nullptr) {
         return nullptr;
     }
@@ -131,7 +156,7 @@ int proc_clone_vmas(struct proc *dst, struct proc *src)
     struct vm_area **tail    = &new_head;
 
     for (struct vm_area *cur = src->vma_list; cur != nullptr; cur = cur->next) {
-        struct vm_area *copy = (struct vm_area *)kzalloc(sizeof(*copy));
+        struct vm_area *copy = vma_alloc();
         if (copy == nullptr) {
             free_vma_chain(new_head);
             return -1;
@@ -149,7 +174,12 @@ int proc_clone_vmas(struct proc *dst, struct proc *src)
     dst->vma_list = new_head;
 
     for (struct vm_area *cur = dst->vma_list; cur != nullptr; cur = cur->next) {
-        if (map_device_vma(dst, cur) < 0) {
+        const int r = (cur->flags & VMA_FLAG_SHM) ? shm_map(dst, cur) : map_device_vma(dst, cur);
+        if (r < 0) {
+            // The rest was never mapped, so must not be unmapped either.
+            for (struct vm_area *v = cur; v != nullptr; v = v->next) {
+                v->flags &= ~VMA_FLAG_SHM;
+            }
             proc_free_vmas(dst);
             return -1;
         }
@@ -165,6 +195,7 @@ static struct proc *init_proc(struct proc *p)
         return nullptr;
     }
     proc_free_vmas(p);
+    fdtable_init(&p->fdt);
     char *stack_pointer = p->kstack + KSTACKSIZE;
 
     // Leave room for the trap frame.
@@ -215,13 +246,14 @@ found:
     return init_proc(p);
 }
 
-[[maybe_unused]] static struct proc *alloc_kernel_proc(struct proc *p, void (*entry_point)(void))
+static struct proc *alloc_kernel_proc(struct proc *p, void (*entry_point)(void))
 {
     if ((p->kstack = kalloc_page()) == nullptr) {
         p->state = UNUSED;
         return nullptr;
     }
     proc_free_vmas(p);
+    fdtable_init(&p->fdt);
     char *stack_pointer = p->kstack + KSTACKSIZE;
 
     stack_push_pointer(&stack_pointer, (u32)entry_point);
@@ -236,6 +268,48 @@ found:
     return p;
 }
 
+/**
+ * @brief Start a process that runs entry_point in the kernel.
+ *
+ * Kernel processes use the kernel page directory and have no user
+ * address space, so entry_point must never return.
+ *
+ * @param name Process name shown by procdump.
+ * @param entry_point Function the process runs.
+ * @return The new process, or nullptr if none is free.
+ */
+struct proc *kernel_proc_create(char *name, void (*entry_point)(void))
+{
+    struct proc *p;
+
+    acquire(&ptable.lock);
+    for (p = ptable.proc; p < &ptable.proc[NPROC]; p++) {
+        if (p->state == UNUSED) {
+            break;
+        }
+    }
+    if (p == &ptable.proc[NPROC]) {
+        release(&ptable.lock);
+        return nullptr;
+    }
+    p->state = EMBRYO;
+    p->pid   = nextpid++;
+    release(&ptable.lock);
+
+    if (alloc_kernel_proc(p, entry_point) == nullptr) {
+        return nullptr;
+    }
+    safestrcpy(p->name, name, sizeof(p->name));
+    p->parent          = initproc;
+    p->cwd             = nullptr;
+    p->fpu_initialized = false;
+    memset(p->fpu_state, 0, sizeof(p->fpu_state));
+
+    p->state = RUNNABLE;
+    enqueue_runnable(p);
+    return p;
+}
+
 /**
  * @brief Create the initial user process containing initcode.
  */
@@ -338,9 +412,10 @@ int fork(void)
         return -1;
     }
     np->brk = curproc->brk;
-    if (proc_clone_vmas(np, curproc) < 0) {
-        freevm(np->page_directory);
+    if (proc_clone_vmas(np, curproc) < 0 || fdtable_copy(&np->fdt, &curproc->fdt) < 0) {
+        // Unmap shared pages first so freevm leaves them alone.
         proc_free_vmas(np);
+        freevm(np->page_directory);
         kfree_page(np->kstack);
         np->kstack = nullptr;
         np->state  = UNUSED;
@@ -352,11 +427,6 @@ int fork(void)
     // Clear %eax so that fork returns 0 in the child.
     np->trap_frame->eax = 0;
 
-    for (int i = 0; i < NOFILE; i++) {
-        if (curproc->ofile[i]) {
-            np->ofile[i] = file_dup(curproc->ofile[i]);
-        }
-    }
     np->cwd = idup(curproc->cwd);
     memset(np->cwd_path, 0, MAX_FILE_PATH);
     strncpy(np->cwd_path, curproc->cwd_path, MAX_FILE_PATH);
@@ -395,6 +465,11 @@ void forkret(void)
         // iinit(ROOTDEV);
         // initlog(ROOTDEV);
         ext2fs_iinit(ROOTDEV);
+        if (mount("/tmp", TMPFSDEV, TMPFS_ROOTINO, &tmpfs_inode_ops) == 0) {
+            tmpfs_iinit(TMPFSDEV);
+        } else {
+            boot_message(WARNING_LEVEL_WARNING, "tmpfs: no /tmp directory, not mounted");
+        }
     }
 
     // Return to "caller", actually trapret (see allocproc).
@@ -194,12 +194,7 @@ void exit(void)
     }
 
     // Close all open files.
-    for (int fd = 0; fd < NOFILE; fd++) {
-        if (curproc->ofile[fd]) {
-            file_close(curproc->ofile[fd]);
-            curproc->ofile[fd] = nullptr;
-        }
-    }
+    fdtable_close_all(&curproc->fdt);
 
     curproc->cwd->iops->iput(curproc->cwd);
     curproc->cwd = nullptr;
@@ -56,4 +56,123 @@ int holdingsleep(struct sleeplock *lk)
     int r = lk->locked && (lk->pid == current_process()->pid);
     release(&lk->lk);
     return r;
-}
\ No newline at end of file
+}
+
+// Reader/writer sleeping locks. Readers wait on &lk->readers and
+// writers on &lk->writer, so a release wakes only the side that can
+// make progress.
+
+/** @brief Initialize a reader/writer sleeplock. */
+void initrwsleeplock(struct rwsleeplock *lk, char *name)
+{
+    initlock(&lk->lk, "rw sleep lock");
+    lk->name            = name;
+    lk->readers         = 0;
+    lk->writer          = 0;
+    lk->waiting_writers = 0;
+    lk->pid             = 0;
+}
+
+/** @brief Acquire a reader/writer sleeplock exclusively. */
+void acquirerwsleep(struct rwsleeplock *lk)
+{
+    acquire(&lk->lk);
+    lk->waiting_writers++;
+    while (lk->writer || lk->readers > 0) {
+        sleep(&lk->writer, &lk->lk);
+    }
+    lk->waiting_writers--;
+    lk->writer = 1;
+    lk->pid    = current_process()->pid;
+    release(&lk->lk);
+}
+
+/**
+ * @brief Acquire a reader/writer sleeplock exclusively if nobody holds it.
+ *
+ * @return 1 if the lock was taken, 0 otherwise.
+ */
+int tryacquirerwsleep(struct rwsleeplock *lk)
+{
+    acquire(&lk->lk);
+    int ok = !lk->writer && lk->readers == 0;
+    if (ok) {
+        lk->writer = 1;
+        lk->pid    = current_process()->pid;
+    }
+    release(&lk->lk);
+    return ok;
+}
+
+/**
+ * @brief Acquire a reader/writer sleeplock shared with other readers.
+ *
+ * Sleeps while a writer holds the lock or is waiting for it.
+ */
+void acquirerwsleep_shared(struct rwsleeplock *lk)
+{
+    acquire(&lk->lk);
+    while (lk->writer || lk->waiting_writers > 0) {
+        sleep(&lk->readers, &lk->lk);
+    }
+    lk->readers++;
+    release(&lk->lk);
+}
+
+/**
+ * @brief Turn an exclusive hold into a shared one without letting a writer in.
+ */
+void downgraderwsleep(struct rwsleeplock *lk)
+{
+    acquire(&lk->lk);
+    lk->writer  = 0;
+    lk->pid     = 0;
+    lk->readers = 1;
+    if (lk->waiting_writers == 0) {
+        wakeup(&lk->readers);
+    }
+    release(&lk->lk);
+}
+
+/**
+ * @brief Release a reader/writer sleeplock held either way.
+ *
+ * The last holder out wakes a waiting writer if there is one, and the
+ * waiting readers otherwise.
+ */
+void releaserwsleep(struct rwsleeplock *lk)
+{
+    acquire(&lk->lk);
+    if (lk->writer) {
+        lk->writer = 0;
+        lk->pid    = 0;
+    } else if (lk->readers > 0) {
+        lk->readers--;
+    } else {
+        panic("releaserwsleep: %s not held", lk->name);
+    }
+    if (lk->readers == 0) {
+        if (lk->waiting_writers > 0) {
+            wakeup(&lk->writer);
+        } else {
+            wakeup(&lk->readers);
+        }
+    }
+    release(&lk->lk);
+}
+
+/**
+ * @brief Check whether the current process may release a reader/writer sleeplock.
+ *
+ * Shared holders are not tracked, so a lock held shared counts as held
+ * by every caller.
+ *
+ * @return Non-zero if held exclusively by the caller or held shared.
+ */
+int holdingrwsleep(struct rwsleeplock *lk)
+{
+    acquire(&lk->lk);
+    int r = (lk->writer && lk->pid == current_process()->pid) || lk->readers > 0;
+    release(&lk->lk);
+    return r;
+}
@@ -0,0 +1,112 @@
+// Wait queues for poll.
+//
+// A process in poll joins the wait queue of every file it polls, then
+// sleeps on its poll table. Whoever makes one of those files ready wakes
+// the queue, which wakes every poll table on it. The woken flag closes
+// the gap between poll finding nothing ready and going to sleep.
+
+#include "defs.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "waitqueue.h"
+
+// Protects every wait queue and the woken flag of every poll table.
+static struct spinlock poll_lock;
+
+struct wait_queue timer_wait_queue;
+
+/** @brief Initialize the lock shared by all wait queues. */
+void poll_init(void)
+{
+    initlock(&poll_lock, "poll");
+    wait_queue_init(&timer_wait_queue);
+}
+
+/** @brief Initialize an empty wait queue. */
+void wait_queue_init(struct wait_queue *wq)
+{
+    wq->head = nullptr;
+}
+
+/**
+ * @brief Wake every poller waiting on a wait queue.
+ *
+ * Call it after changing the state the queue's owner reports to poll,
+ * while still holding the lock that state is read under.
+ */
+void wait_queue_wake(struct wait_queue *wq)
+{
+    // Nobody polls most files, so skip the lock then. A poller joins the
+    // queue before it looks at the state, and the caller's lock orders
+    // that look against this one.
+    if (wq->head == nullptr) {
+        return;
+    }
+    acquire(&poll_lock);
+    for (struct wait_entry *e = wq->head; e != nullptr; e = e->next) {
+        e->pt->woken = true;
+        wakeup(e->pt);
+    }
+    release(&poll_lock);
+}
+
+/**
+ * @brief Set up the state of one poll call.
+ *
+ * @param entries Room for one entry per wait queue the call may join.
+ * @param max Number of entries.
+ */
+void poll_table_init(struct poll_table *pt, struct wait_entry *entries, int max)
+{
+    pt->entries  = entries;
+    pt->nentries = 0;
+    pt->max      = max;
+    pt->woken    = false;
+}
+
+/**
+ * @brief Join a wait queue, if pt is not null.
+ *
+ * A file's poll callback calls this before it looks at its state so no
+ * wakeup in between is lost. Passing a null pt just asks for the state.
+ */
+void poll_wait(struct poll_table *pt, struct wait_queue *wq)
+{
+    if (pt == nullptr || pt->nentries == pt->max) {
+        return;
+    }
+    struct wait_entry *e = &pt->entries[pt->nentries++];
+    e->pt                = pt;
+    e->wq                = wq;
+
+    acquire(&poll_lock);
+    e->next  = wq->head;
+    wq->head = e;
+    release(&poll_lock);
+}
+
+/** @brief Sleep until one of the wait queues pt joined is woken. */
+void poll_table_sleep(struct poll_table *pt)
+{
+    acquire(&poll_lock);
+    if (!pt->woken) {
+        sleep(pt, &poll_lock);
+    }
+    pt->woken = false;
+    release(&poll_lock);
+}
+
+/** @brief Leave every wait queue pt joined. */
+void poll_table_free(struct poll_table *pt)
+{
+    acquire(&poll_lock);
+    for (int i = 0; i < pt->nentries; i++) {
+        struct wait_entry *e = &pt->entries[i];
+        struct wait_entry **pp;
+        for (pp = &e->wq->head; *pp != e; pp = &(*pp)->next)
+            ;
+        *pp = e->next;
+    }
+    pt->nentries = 0;
+    release(&poll_lock);
+}
@@ -10,6 +10,7 @@
 #include "spinlock.h"
 #include "termcolors.h"
 #include "string.h"
+#include "waitqueue.h"
 
 /** @brief Interrupt descriptor table shared by all CPUs. */
 struct gate_desc idt[256];
@@ -111,6 +112,7 @@ void timer_handler([[maybe_unused]] struct trapframe *tf)
         acquire(&tickslock);
         ticks++;
         wakeup((void *)&ticks);
+        wait_queue_wake(&timer_wait_queue);
         release(&tickslock);
     }
     lapic_ack_interrupt(); // Acknowledge the interrupt
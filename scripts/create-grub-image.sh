@@ -4,6 +4,8 @@ set -euo pipefail
 
 readonly IMG_PATH="./disk.img"
 readonly MOUNT_POINT="${MOUNT_POINT:-/mnt/aegr}"
+# ext2 block size: 1024, 2048 or 4096
+readonly EXT2_BLOCK_SIZE="${EXT2_BLOCK_SIZE:-1024}"
 
 sudo mkdir -p "$MOUNT_POINT"
 
@@ -33,7 +35,7 @@ parted -s "${IMG_PATH}" set 1 boot on
 # Set up loop device with partition scanning
 loopdev=$(sudo losetup -fP --show "${IMG_PATH}")
 
-sudo mkfs.ext2 "${loopdev}p1" -L AegrOS -b 1024
+sudo mkfs.ext2 "${loopdev}p1" -L AegrOS -b "${EXT2_BLOCK_SIZE}"
 sudo mount -t ext2 "${loopdev}p1" "$MOUNT_POINT"
 
 sudo grub-install --target=i386-pc --boot-directory="$MOUNT_POINT/boot" --modules="normal part_msdos ext2 multiboot" "$loopdev"
@@ -2,10 +2,21 @@
 
 char buf[512];
 
+// Bytes cat asks the kernel to move per sendfile call.
+#define CAT_CHUNK (1 << 20)
+
 void cat(int fd)
 {
     int n;
 
+    // Regular files go straight from the page cache to stdout. sendfile
+    // fails on anything else, such as a pipe or the console.
+    while ((n = sendfile(1, fd, nullptr, CAT_CHUNK)) > 0) {
+    }
+    if (n == 0) {
+        return;
+    }
+
     while ((n = read(fd, buf, sizeof(buf))) > 0) {
         if (write(1, buf, n) != n) {
             printf("cat: write error\n");
@@ -5,6 +5,7 @@
 #include <stdio.h>
 #include <ctype.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <unistd.h>
 #include <string.h>
 #include <stdint.h>
@@ -329,7 +330,10 @@ static void handleKeyInput()
     static int extendedScan = 0;
     static int escState     = 0;
 
-    while (read(KeyboardFd, &scancode, 1) > 0) {
+    // Only read what is already there; the game loop must never block on
+    // the keyboard, whatever mode the console is in.
+    struct pollfd pfd = {.fd = KeyboardFd, .events = POLLIN};
+    while (poll(&pfd, 1, 0) > 0 && (pfd.revents & POLLIN) && read(KeyboardFd, &scancode, 1) > 0) {
         if (scancode == 0) {
             continue;
         }
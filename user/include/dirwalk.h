@@ -7,7 +7,7 @@
 struct dirent_view
 {
     u32 inode;
-    u8 file_type;
+    u8 file_type; // DT_* value from dirent.h
     u8 name_len;
     char name[EXT2_DIRENT_NAME_MAX + 1];
 };
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "types.h"
+
+// Locks for processes sharing memory, built on futex. Taking a free lock,
+// releasing one nobody waits for and posting to a semaphore nobody waits
+// on are single atomic instructions; only waiting enters the kernel.
+
+struct mutex
+{
+    int state; // 0 unlocked, 1 locked, 2 locked with possible waiters
+};
+
+struct cond
+{
+    int seq;     // bumped by every signal and broadcast
+    int waiters; // processes in cond_wait
+};
+
+struct semaphore
+{
+    int value;
+    int waiters;
+};
+
+void mutex_init(struct mutex *m);
+void mutex_lock(struct mutex *m);
+bool mutex_trylock(struct mutex *m);
+void mutex_unlock(struct mutex *m);
+
+void cond_init(struct cond *c);
+void cond_wait(struct cond *c, struct mutex *m);
+void cond_signal(struct cond *c);
+void cond_broadcast(struct cond *c);
+
+void sem_init(struct semaphore *s, int value);
+void sem_wait(struct semaphore *s);
+bool sem_trywait(struct semaphore *s);
+void sem_post(struct semaphore *s);
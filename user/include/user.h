@@ -8,8 +8,11 @@
 #include "mman.h"
 #include <termios.h>
 #include <sys/ioctl.h>
+#include <sys/uio.h>
 struct stat;
 struct rtcdate;
+struct dirent;
+struct pollfd;
 typedef void (*atexit_function)(void);
 
 #define SEEK_SET 0
@@ -26,6 +29,19 @@ int wait_(void);
 int pipe(int *);
 int write(int, const void *, int);
 int read(int, void *, int);
+int pread(int, void *, int, int);
+int pwrite(int, const void *, int, int);
+int readv(int, const struct iovec *, int);
+int writev(int, const struct iovec *, int);
+int sendfile(int out_fd, int in_fd, int *offset, int count);
+int splice(int fd_in, int *off_in, int fd_out, int *off_out, int len);
+int fsync(int fd);
+int fcntl(int fd, int cmd, int arg);
+int poll(struct pollfd *fds, int nfds, int timeout);
+int shm_open(const char *name, int oflag);
+int shm_unlink(const char *name);
+int ftruncate(int fd, int length);
+int futex(int *addr, int op, int val, int timeout);
 int close(int);
 int kill(int);
 int exec(char *, char **);
@@ -38,6 +54,7 @@ int link(const char *, const char *);
 int mkdir(const char *);
 int chdir(const char *);
 int getcwd(char *, int);
+int getdents(int fd, struct dirent *buf, int n);
 int dup(int);
 int getpid(void);
 int atexit(atexit_function func);
@@ -1,15 +1,11 @@
 #include "types.h"
 #include "stat.h"
 #include "user.h"
+#include "dirent.h"
 #include "dirwalk.h"
 
-struct ext2_dirent_raw
-{
-    u32 inode;
-    u16 rec_len;
-    u8 name_len;
-    u8 file_type;
-};
+// Room for a few hundred typical entries per getdents() call.
+#define DIRWALK_BUFSZ 4096
 
 int dirwalk(int fd, dirwalk_cb cb, void *arg)
 {
@@ -22,59 +18,32 @@ int dirwalk(int fd, dirwalk_cb cb, void *arg)
     if (st.type != T_DIR)
         return -1;
 
-    int bufsz  = st.size > 0 ? st.size : 1;
-    char *data = malloc(bufsz);
-    if (data == 0) {
+    char *buf = malloc(DIRWALK_BUFSZ);
+    if (buf == nullptr) {
         return -1;
     }
 
-    u32 total = 0;
-    while (total < st.size) {
-        int r = read(fd, data + total, st.size - total);
-        if (r < 0) {
-            free(data);
-            return -1;
-        }
-        if (r == 0) {
-            break;
-        }
-        total += r;
-    }
-    if (st.size == 0) {
-        total = 0;
-    }
-
     int result = 0;
-    for (u32 off = 0; off + sizeof(struct ext2_dirent_raw) <= (u32)total;) {
-        struct ext2_dirent_raw *raw = (struct ext2_dirent_raw *)(data + off);
-        if (raw->rec_len < sizeof(struct ext2_dirent_raw)) {
-            break;
-        }
-        if (off + raw->rec_len > (u32)total) {
-            break;
-        }
-        if (raw->inode != 0) {
+    int n;
+    while (result == 0 && (n = getdents(fd, (struct dirent *)buf, DIRWALK_BUFSZ)) > 0) {
+        for (int off = 0; off < n;) {
+            const struct dirent *d = (const struct dirent *)(buf + off);
             struct dirent_view view;
-            view.inode     = raw->inode;
-            view.file_type = raw->file_type;
-            view.name_len  = raw->name_len;
-            int name_len   = raw->name_len;
-            if (name_len > EXT2_DIRENT_NAME_MAX) {
-                name_len = EXT2_DIRENT_NAME_MAX;
-            }
-            memmove(view.name, data + off + sizeof(struct ext2_dirent_raw), name_len);
-            view.name[name_len] = 0;
-            result              = cb(&view, arg);
+            view.inode     = d->d_ino;
+            view.file_type = d->d_type;
+            view.name_len  = d->d_namlen;
+            memmove(view.name, d->d_name, d->d_namlen + 1);
+            off += d->d_reclen;
+            result = cb(&view, arg);
             if (result != 0) {
                 break;
             }
         }
-        off += raw->rec_len;
-        if (raw->rec_len == 0) {
-            break;
-        }
+    }
+    if (n < 0) {
+        result = -1;
     }
 
-    free(data);
+    free(buf);
     return result;
-}
\ No newline at end of file
+}
@@ -0,0 +1,131 @@
+#include "types.h"
+#include "user.h"
+#include "futex.h"
+#include "sync.h"
+
+#define WAKE_ALL 0x7fffffff
+
+/** @brief Initialize an unlocked mutex. */
+void mutex_init(struct mutex *m)
+{
+    m->state = 0;
+}
+
+/**
+ * @brief Take a mutex, sleeping in the kernel while another process holds it.
+ *
+ * A waiter marks the mutex contended so the holder knows to wake it.
+ */
+void mutex_lock(struct mutex *m)
+{
+    int c = 0;
+    if (__atomic_compare_exchange_n(&m->state, &c, 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        return;
+    }
+    if (c != 2) {
+        c = __atomic_exchange_n(&m->state, 2, __ATOMIC_ACQUIRE);
+    }
+    while (c != 0) {
+        futex(&m->state, FUTEX_WAIT, 2, -1);
+        c = __atomic_exchange_n(&m->state, 2, __ATOMIC_ACQUIRE);
+    }
+}
+
+/** @brief Take a mutex if it is free. */
+bool mutex_trylock(struct mutex *m)
+{
+    int c = 0;
+    return __atomic_compare_exchange_n(&m->state, &c, 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+/** @brief Release a mutex, entering the kernel only if somebody may be waiting. */
+void mutex_unlock(struct mutex *m)
+{
+    if (__atomic_fetch_sub(&m->state, 1, __ATOMIC_RELEASE) != 1) {
+        __atomic_store_n(&m->state, 0, __ATOMIC_RELEASE);
+        futex(&m->state, FUTEX_WAKE, 1, 0);
+    }
+}
+
+/** @brief Initialize a condition variable. */
+void cond_init(struct cond *c)
+{
+    c->seq     = 0;
+    c->waiters = 0;
+}
+
+/**
+ * @brief Release m, wait for a signal and take m again.
+ *
+ * Wakeups can be spurious, so callers recheck their condition in a loop.
+ */
+void cond_wait(struct cond *c, struct mutex *m)
+{
+    const int seq = __atomic_load_n(&c->seq, __ATOMIC_SEQ_CST);
+    __atomic_fetch_add(&c->waiters, 1, __ATOMIC_SEQ_CST);
+    mutex_unlock(m);
+    // A signal after the load above changes seq, so the wait returns at once.
+    futex(&c->seq, FUTEX_WAIT, seq, -1);
+    // Other waiters may have been woken too; take m as contended so none of
+    // them is left asleep on it.
+    while (__atomic_exchange_n(&m->state, 2, __ATOMIC_ACQUIRE) != 0) {
+        futex(&m->state, FUTEX_WAIT, 2, -1);
+    }
+    __atomic_fetch_sub(&c->waiters, 1, __ATOMIC_SEQ_CST);
+}
+
+/** @brief Wake one process in cond_wait. Call with the mutex held. */
+void cond_signal(struct cond *c)
+{
+    __atomic_fetch_add(&c->seq, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&c->waiters, __ATOMIC_SEQ_CST) > 0) {
+        futex(&c->seq, FUTEX_WAKE, 1, 0);
+    }
+}
+
+/** @brief Wake every process in cond_wait. Call with the mutex held. */
+void cond_broadcast(struct cond *c)
+{
+    __atomic_fetch_add(&c->seq, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&c->waiters, __ATOMIC_SEQ_CST) > 0) {
+        futex(&c->seq, FUTEX_WAKE, WAKE_ALL, 0);
+    }
+}
+
+/** @brief Initialize a counting semaphore. */
+void sem_init(struct semaphore *s, int value)
+{
+    s->value   = value;
+    s->waiters = 0;
+}
+
+/** @brief Take one unit if the count is positive. */
+bool sem_trywait(struct semaphore *s)
+{
+    int v = __atomic_load_n(&s->value, __ATOMIC_RELAXED);
+    while (v > 0) {
+        if (__atomic_compare_exchange_n(&s->value, &v, v - 1, true, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/** @brief Take one unit, sleeping while the count is zero. */
+void sem_wait(struct semaphore *s)
+{
+    while (!sem_trywait(s)) {
+        __atomic_fetch_add(&s->waiters, 1, __ATOMIC_SEQ_CST);
+        futex(&s->value, FUTEX_WAIT, 0, -1);
+        __atomic_fetch_sub(&s->waiters, 1, __ATOMIC_SEQ_CST);
+    }
+}
+
+/** @brief Give back one unit and wake a waiter if there is one. */
+void sem_post(struct semaphore *s)
+{
+    __atomic_fetch_add(&s->value, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&s->waiters, __ATOMIC_SEQ_CST) > 0) {
+        futex(&s->value, FUTEX_WAKE, 1, 0);
+    }
+}
@@ -56,3 +56,17 @@ SYSCALL uptime
 SYSCALL getcwd
 SYSCALL reboot
 SYSCALL shutdown
+SYSCALL getdents
+SYSCALL pread
+SYSCALL pwrite
+SYSCALL readv
+SYSCALL writev
+SYSCALL sendfile
+SYSCALL splice
+SYSCALL fsync
+SYSCALL fcntl
+SYSCALL poll
+SYSCALL shm_open
+SYSCALL shm_unlink
+SYSCALL ftruncate
+SYSCALL futex
@@ -5,7 +5,12 @@
 #include "stat.h"
 #include "file.h"
 #include "fcntl.h"
+#include "poll.h"
+#include "status.h"
+#include "dirent.h"
 #include "include/dirwalk.h"
+#include "include/sync.h"
+#include "futex.h"
 #include "syscall.h"
 #include "traps.h"
 #include "memlayout.h"
@@ -625,9 +630,9 @@ void duptest(void)
         printf(KBRED "\nopen dupfile for limit test failed\n" KRESET);
         exit();
     }
-    int copies[NOFILE];
-    int copied = 0;
-    for (; copied < NOFILE; copied++) {
+    int *copies = malloc(NOFILE_MAX * sizeof(int));
+    int copied  = 0;
+    for (; copied < NOFILE_MAX; copied++) {
         int d = dup(limitfd);
         if (d < 0) {
             break;
@@ -638,8 +643,12 @@ void duptest(void)
         printf(KBRED "\ndup produced no copies\n" KRESET);
         exit();
     }
-    if (copied == NOFILE) {
-        printf(KBRED "\ndup exceeded NOFILE limit\n" KRESET);
+    if (copied <= NOFILE) {
+        printf(KBRED "\ndup did not grow the descriptor table\n" KRESET);
+        exit();
+    }
+    if (copied == NOFILE_MAX) {
+        printf(KBRED "\ndup exceeded NOFILE_MAX limit\n" KRESET);
         exit();
     }
     if (dup(limitfd) >= 0) {
@@ -649,6 +658,7 @@ void duptest(void)
     for (int i = 0; i < copied; i++) {
         close(copies[i]);
     }
+    free(copies);
     close(limitfd);
 
     if (unlink("dupfile") != 0) {
@@ -1359,6 +1369,58 @@ void bigdir(void)
     printf(" [ " KBGRN "OK" KRESET " ]\n");
 }
 
+// Fill a subdirectory with long names so that it needs several blocks and
+// its index splits, then check every name still resolves.
+void bigdirlookup(void)
+{
+    char name[64];
+    const int n = 300;
+
+    printf("bigdirlookup test");
+    if (mkdir("bdl") != 0) {
+        printf(KBRED "\nbigdirlookup mkdir failed\n" KRESET);
+        exit();
+    }
+
+    for (int i = 0; i < n; i++) {
+        snprintf(name, sizeof(name), "bdl/a-rather-long-directory-entry-name-%d", i);
+        int fd = open(name, O_CREATE | O_RDWR);
+        if (fd < 0) {
+            printf(KBRED "\nbigdirlookup create %s failed\n" KRESET, name);
+            exit();
+        }
+        close(fd);
+    }
+
+    for (int i = n - 1; i >= 0; i--) {
+        snprintf(name, sizeof(name), "bdl/a-rather-long-directory-entry-name-%d", i);
+        int fd = open(name, O_RDONLY);
+        if (fd < 0) {
+            printf(KBRED "\nbigdirlookup open %s failed\n" KRESET, name);
+            exit();
+        }
+        close(fd);
+    }
+    if (open("bdl/a-rather-long-directory-entry-name-x", O_RDONLY) >= 0) {
+        printf(KBRED "\nbigdirlookup opened a missing name\n" KRESET);
+        exit();
+    }
+
+    for (int i = 0; i < n; i++) {
+        snprintf(name, sizeof(name), "bdl/a-rather-long-directory-entry-name-%d", i);
+        if (unlink(name) != 0) {
+            printf(KBRED "\nbigdirlookup unlink %s failed\n" KRESET, name);
+            exit();
+        }
+    }
+    if (unlink("bdl") != 0) {
+        printf(KBRED "\nbigdirlookup unlink bdl failed\n" KRESET);
+        exit();
+    }
+
+    printf(" [ " KBGRN "OK" KRESET " ]\n");
+}
+
 void
 subdir(void)
 {
@@ -2003,6 +2065,773 @@ iref(void)
     printf(" [ " KBGRN "OK" KRESET " ]\n");
 }
 
+// read a directory in small getdents() batches
+void getdentstest(void)
+{
+    char name[32];
+    char buf[128];
+    const int n = 40;
+
+    printf("getdents test");
+    if (mkdir("gdd") != 0) {
+        printf(KBRED "\ngetdents mkdir failed\n" KRESET);
+        exit();
+    }
+    for (int i = 0; i < n; i++) {
+        snprintf(name, sizeof(name), "gdd/entry%d", i);
+        int fd = open(name, O_CREATE | O_RDWR);
+        if (fd < 0) {
+            printf(KBRED "\ngetdents create failed\n" KRESET);
+            exit();
+        }
+        close(fd);
+    }
+
+    int fd = open("gdd", O_RDONLY);
+    if (fd < 0) {
+        printf(KBRED "\ngetdents open failed\n" KRESET);
+        exit();
+    }
+    if (getdents(fd, (struct dirent *)buf, 8) >= 0) {
+        printf(KBRED "\ngetdents accepted a buffer too small for one entry\n" KRESET);
+        exit();
+    }
+
+    int seen = 0, calls = 0, r;
+    while ((r = getdents(fd, (struct dirent *)buf, sizeof(buf))) > 0) {
+        calls++;
+        for (int off = 0; off < r;) {
+            struct dirent *d = (struct dirent *)(buf + off);
+            if (d->d_reclen == 0 || strlen(d->d_name) != d->d_namlen) {
+                printf(KBRED "\ngetdents bad record\n" KRESET);
+                exit();
+            }
+            if (strcmp(d->d_name, ".") != 0 && strcmp(d->d_name, "..") != 0) {
+                seen++;
+            }
+            off += d->d_reclen;
+        }
+    }
+    close(fd);
+    if (r < 0 || seen != n || calls < 2) {
+        printf(KBRED "\ngetdents saw %d of %d entries in %d calls\n" KRESET, seen, n, calls);
+        exit();
+    }
+
+    for (int i = 0; i < n; i++) {
+        snprintf(name, sizeof(name), "gdd/entry%d", i);
+        unlink(name);
+    }
+    unlink("gdd");
+
+    printf(" [ " KBGRN "OK" KRESET " ]\n");
+}
+
+// pread/pwrite leave the offset alone; readv/writev scatter and gather
+void preadwritev(void)
+{
+    char buf[32];
+    char a[4], b[6];
+
+    printf("pread/readv test");
+    int fd = open("uiofile", O_CREATE | O_RDWR);
+    if (fd < 0) {
+        printf(KBRED "\npreadwritev create failed\n" KRESET);
+        exit();
+    }
+
+    struct iovec out[3] = {{"abc", 3}, {"", 0}, {"defghij", 7}};
+    if (writev(fd, out, 3) != 10) {
+        printf(KBRED "\nwritev failed\n" KRESET);
+        exit();
+    }
+    if (pwrite(fd, "XY", 2, 4) != 2 || lseek(fd, 0, SEEK_CUR) != 10) {
+        printf(KBRED "\npwrite failed or moved the offset\n" KRESET);
+        exit();
+    }
+    if (pread(fd, buf, sizeof(buf), 2) != 8 || memcmp(buf, "cdXYghij", 8) != 0) {
+        printf(KBRED "\npread returned the wrong data\n" KRESET);
+        exit();
+    }
+    if (lseek(fd, 0, SEEK_CUR) != 10) {
+        printf(KBRED "\npread moved the offset\n" KRESET);
+        exit();
+    }
+
+    lseek(fd, 0, SEEK_SET);
+    struct iovec in[2] = {{a, sizeof(a)}, {b, sizeof(b)}};
+    if (readv(fd, in, 2) != 10 || memcmp(a, "abcd", 4) != 0 || memcmp(b, "XYghij", 6) != 0) {
+        printf(KBRED "\nreadv returned the wrong data\n" KRESET);
+        exit();
+    }
+    if (readv(fd, in, IOV_MAX + 1) >= 0) {
+        printf(KBRED "\nreadv accepted too many segments\n" KRESET);
+        exit();
+    }
+    close(fd);
+    unlink("uiofile");
+
+    int fds[2];
+    if (pipe(fds) != 0) {
+        printf(KBRED "\npreadwritev pipe failed\n" KRESET);
+        exit();
+    }
+    if (pread(fds[0], buf, 1, 0) >= 0) {
+        printf(KBRED "\npread on a pipe succeeded\n" KRESET);
+        exit();
+    }
+    if (writev(fds[1], out, 3) != 10 || read(fds[0], buf, sizeof(buf)) != 10 || memcmp(buf, "abcdefghij", 10) != 0) {
+        printf(KBRED "\nwritev to a pipe failed\n" KRESET);
+        exit();
+    }
+    close(fds[0]);
+    close(fds[1]);
+
+    printf(" [ " KBGRN "OK" KRESET " ]\n");
+}
+
+// one large write, then unaligned overwrites across block boundaries
+void largewrite(void)
+{
+    const int size = 64 * 1024;
+
+    printf("large write test");
+    char *data = malloc(size);
+    char *back = malloc(size);
+    if (data == nullptr || back == nullptr) {
+        printf(KBRED "\nlargewrite malloc failed\n" KRESET);
+        exit();
+    }
+    for (int i = 0; i < size; i++) {
+        data[i] = (char)(i * 7 + i / 251);
+    }
+
+    int fd = open("largewrite", O_CREATE | O_RDWR);
+    if (fd < 0 || write(fd, data, size) != size) {
+        printf(KBRED "\nlargewrite write failed\n" KRESET);
+        exit();
+    }
+    for (int i = 0; i < 3000; i++) {
+        data[1000 + i]         = 'x';
+        data[size - 5 + i % 5] = 'y';
+    }
+    if (pwrite(fd, data + 1000, 3000, 1000) != 3000 || pwrite(fd, data + size - 5, 5, size - 5) != 5) {
+        printf(KBRED "\nlargewrite overwrite failed\n" KRESET);
+        exit();
+    }
+    // Append a partial block to check the rest of it is not read back.
+    if (write(fd, "tail", 4) != 4) {
+        printf(KBRED "\nlargewrite append failed\n" KRESET);
+        exit();
+    }
+    close(fd);
+
+    fd = open("largewrite", O_RDONLY);
+    if (read(fd, back, size) != size || memcmp(back, data, size) != 0) {
+        printf(KBRED "\nlargewrite read back wrong data\n" KRESET);
+        exit();
+    }
+    if (read(fd, back, size) != 4 || memcmp(back, "tail", 4) != 0) {
+        printf(KBRED "\nlargewrite read back wrong tail\n" KRESET);
+        exit();
+    }
+    close(fd);
+    unlink("largewrite");
+    free(data);
+    free(back);
+
+    printf(" [ " KBGRN "OK" KRESET " ]\n");
+}
+
+// O_DIRECT transfers stay coherent with buffered opens of the same file
+void directio(void)
+{
+    const int size = 16 * 1024;
+
+    printf("O_DIRECT test");
+    char *raw   = malloc(size + PGSIZE);
+    char *check = malloc(size);
+    if (raw == nullptr || check == nullptr) {
+        printf(KBRED "\ndirectio malloc failed\n" KRESET);
+        exit();
+    }
+    char *data = (char *)(((u32)raw + PGSIZE - 1) & ~(PGSIZE - 1));
+    memset(data, 'a', size);
+
+    int fd = open("directfile", O_CREATE | O_RDWR);
+    if (fd < 0 || write(fd, data, size) != size) {
+        printf(KBRED "\ndirectio create failed\n" KRESET);
+        exit();
+    }
+    close(fd);
+
+    // Cache the file through a buffered open first.
+    int bfd = open("directfile", O_RDONLY);
+    if (bfd < 0 || read(bfd, check, size) != size) {
+        printf(KBRED "\ndirectio buffered read failed\n" KRESET);
+        exit();
+    }
+
+    for (int i = 0; i < size; i++) {
+        data[i] = (char)(i % 253);
+    }
+    int dfd = open("directfile", O_RDWR | O_DIRECT);
+    if (dfd < 0 || write(dfd, data, size) != size) {
+        printf(KBRED "\ndirectio write failed\n" KRESET);
+        exit();
+    }
+    if (write(dfd, data + 1, size) >= 0) {
+        printf(KBRED "\ndirectio accepted a misaligned buffer\n" KRESET);
+        exit();
+    }
+    lseek(bfd, 0, SEEK_SET);
+    if (read(bfd, check, size) != size || memcmp(check, data, size) != 0) {
+        printf(KBRED "\ndirectio write not seen by a buffered read\n" KRESET);
+        exit();
+    }
+
+    lseek(dfd, 0, SEEK_SET);
+    memset(data, 0, size);
+    if (read(dfd, data, size) != size || memcmp(check, data, size) != 0) {
+        printf(KBRED "\ndirectio read returned the wrong data\n" KRESET);
+        exit();
+    }
+    close(dfd);
+    close(bfd);
+    unlink("directfile");
+    free(raw);
+    free(check);
+
+    printf(" [ " KBGRN "OK" KRESET " ]\n");
+}
+
+// sendfile and splice move data between files and pipes in the kernel
+void sendfiletest(void)
+{
+    const int size = 6000;
+    char *data     = malloc(size);
+    char *back     = malloc(size);
+
+    printf("sendfile test");
+    for (int i = 0; i < size; i++) {
+        data[i] = (char)('a' + i % 26);
+    }
+    int fd = open("sendsrc", O_CREATE | O_RDWR);
+    if (fd < 0 || write(fd, data, size) != size) {
+        printf(KBRED "\nsendfile create failed\n" KRESET);
+        exit();
+    }
+
+    // File to file at an explicit offset; the file offset must not move.
+    int out = open("senddst", O_CREATE | O_RDWR);
+    int off = 100;
+    if (out < 0 || sendfile(out, fd, &off, size) != size - 100 || off != size) {
+        printf(KBRED "\nsendfile to a file failed\n" KRESET);
+        exit();
+    }
+    if (lseek(fd, 0, SEEK_CUR) != size) {
+        printf(KBRED "\nsendfile moved the file offset\n" KRESET);
+        exit();
+    }
+    lseek(out, 0, SEEK_SET);
+    if (read(out, back, size) != size - 100 || memcmp(back, data + 100, size - 100) != 0) {
+        printf(KBRED "\nsendfile copied the wrong data\n" KRESET);
+        exit();
+    }
+
+    // File to pipe, then pipe to file with splice.
+    int fds[2];
+    if (pipe(fds) != 0) {
+        printf(KBRED "\nsendfile pipe failed\n" KRESET);
+        exit();
+    }
+    int pid = fork();
+    if (pid == 0) {
+        close(fds[0]);
+        lseek(fd, 0, SEEK_SET);
+        if (sendfile(fds[1], fd, nullptr, size) != size) {
+            printf(KBRED "\nsendfile to a pipe failed\n" KRESET);
+        }
+        exit();
+    }
+    close(fds[1]);
+    lseek(out, 0, SEEK_SET);
+    int total = 0, r;
+    while ((r = splice(fds[0], nullptr, out, nullptr, size)) > 0) {
+        total += r;
+    }
+    close(fds[0]);
+    wait();
+    lseek(out, 0, SEEK_SET);
+    if (r < 0 || total != size || read(out, back, size) != size || memcmp(back, data, size) != 0) {
+        printf(KBRED "\nsplice from a pipe moved the wrong data\n" KRESET);
+        exit();
+    }
+
+    // Shared memory objects are only written through a mapping.
+    int shm = shm_open("sendfiletest", O_CREATE | O_RDWR);
+    if (shm < 0 || pipe(fds) != 0) {
+        printf(KBRED "\nsendfile shm_open failed\n" KRESET);
+        exit();
+    }
+    off = 0;
+    if (sendfile(shm, fd, &off, size) != -1 || sendfile(shm, fd, nullptr, size) != -1 ||
+        splice(fds[0], nullptr, shm, nullptr, size) != -1) {
+        printf(KBRED "\nsendfile to shared memory did not fail\n" KRESET);
+        exit();
+    }
+    close(fds[0]);
+    close(fds[1]);
+    close(shm);
+    shm_unlink("sendfiletest");
+    close(out);
+    close(fd);
+    unlink("senddst");
+    unlink("sendsrc");
+    free(data);
+    free(back);
+
+    printf(" [ " KBGRN "OK" KRESET " ]\n");
+}
+
+// files and directories under /tmp live on the tmpfs, not on the disk
+void tmpfstest(void)
+{
+    const int size = 10000;
+    char *data     = malloc(size);
+    char *back     = malloc(size);
+    struct stat root, st;
+
+    printf("tmpfs test");
+    for (int i = 0; i < size; i++) {
+        data[i] = (char)('A' + i % 26);
+    }
+    if (mkdir("/tmp/tmpfsdir") != 0) {
+        printf(KBRED "\ntmpfs mkdir failed\n" KRESET);
+        exit();
+    }
+    int fd = open("/tmp/tmpfsdir/f", O_CREATE | O_RDWR);
+    if (fd < 0 || write(fd, data, size) != size) {
+        printf(KBRED "\ntmpfs write failed\n" KRESET);
+        exit();
+    }
+    close(fd);
+
+    // ".." inside the tmpfs, and out of its root back to the disk.
+    fd = open("/tmp/../tmp/tmpfsdir/../tmpfsdir/f", O_RDONLY);
+    if (fd < 0 || read(fd, back, size) != size || memcmp(back, data, size) != 0) {
+        printf(KBRED "\ntmpfs read back failed\n" KRESET);
+        exit();
+    }
+    close(fd);
+    if (stat("/", &root) != 0 || stat("/tmp/tmpfsdir/f", &st) != 0 || st.dev == root.dev || st.size != size) {
+        printf(KBRED "\ntmpfs file is not on the tmpfs\n" KRESET);
+        exit();
+    }
+
+    if (unlink("/tmp/tmpfsdir") == 0) {
+        printf(KBRED "\ntmpfs removed a directory that is not empty\n" KRESET);
+        exit();
+    }
+    if (unlink("/tmp") == 0) {
+        printf(KBRED "\nremoved the directory tmpfs is mounted on\n" KRESET);
+        exit();
+    }
+    if (unlink("/tmp/tmpfsdir/f") != 0 || unlink("/tmp/tmpfsdir") != 0) {
+        printf(KBRED "\ntmpfs unlink failed\n" KRESET);
+        exit();
+    }
+    if (open("/tmp/tmpfsdir/f", O_RDONLY) >= 0) {
+        printf(KBRED "\ntmpfs file still there after unlink\n" KRESET);
+        exit();
+    }
+    free(data);
+    free(back);
+
+    printf(" [ " KBGRN "OK" KRESET " ]\n");
+}
+
+// several processes reading one file at the same time share its inode lock
+void sharedread(void)
+{
+    const int size = 8192;
+    char *data     = malloc(size);
+
+    printf("shared read test");
+    for (int i = 0; i < size; i++) {
+        data[i] = (char)(i * 7);
+    }
+    int fd = open("sharedread", O_CREATE | O_RDWR);
+    if (fd < 0 || write(fd, data, size) != size) {
+        printf(KBRED "\nshared read create failed\n" KRESET);
+        exit();
+    }
+    close(fd);
+
+    for (int p = 0; p < 4; p++) {
+        if (fork() == 0) {
+            char *back = malloc(size);
+            int rfd    = open("sharedread", O_RDONLY);
+            for (int round = 0; round < 20; round++) {
+                if (pread(rfd, back, size, 0) != size || memcmp(back, data, size) != 0) {
+                    printf(KBRED "\nshared read got the wrong data\n" KRESET);
+                    exit();
+                }
+            }
+            close(rfd);
+            exit();
+        }
+    }
+    for (int p = 0; p < 4; p++) {
+        wait();
+    }
+    unlink("sharedread");
+    free(data);
+
+    printf(" [ " KBGRN "OK" KRESET " ]\n");
+}
+
+// small appends only mark the inode dirty; the size must still be right
+void fsynctest(void)
+{
+    char buf[100];
+    struct stat st;
+
+    printf("fsync test");
+    memset(buf, 'f', sizeof(buf));
+    int fd = open("fsyncfile", O_CREATE | O_RDWR);
+    if (fd < 0) {
+        printf(KBRED "\nfsync create failed\n" KRESET);
+        exit();
+    }
+    for (int i = 0; i < 50; i++) {
+        if (write(fd, buf, sizeof(buf)) != sizeof(buf)) {
+            printf(KBRED "\nfsync write failed\n" KRESET);
+            exit();
+        }
+    }
+    if (fsync(fd) != 0 || fstat(fd, &st) != 0 || st.size != 50 * sizeof(buf)) {
+        printf(KBRED "\nfsync size wrong\n" KRESET);
+        exit();
+    }
+    close(fd);
+
+    fd = open("fsyncfile", O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) != 0 || st.size != 50 * sizeof(buf)) {
+        printf(KBRED "\nfsync size lost after close\n" KRESET);
+        exit();
+    }
+    close(fd);
+    unlink("fsyncfile");
+
+    printf(" [ " KBGRN "OK" KRESET " ]\n");
+}
+
+// an empty pipe with O_NONBLOCK set fails instead of waiting
+void nonblockpipe(void)
+{
+    int fds[2];
+    char buf[8];
+
+    printf("nonblocking pipe test");
+    if (pipe(fds) != 0) {
+        printf(KBRED "\npipe failed\n" KRESET);
+        exit();
+    }
+    if (fcntl(fds[0], F_SETFL, O_NONBLOCK) != 0 || !(fcntl(fds[0], F_GETFL, 0) & O_NONBLOCK)) {
+        printf(KBRED "\nfcntl O_NONBLOCK failed\n" KRESET);
+        exit();
+    }
+    if (read(fds[0], buf, sizeof(buf)) != -EAGAIN) {
+        printf(KBRED "\nempty pipe read did not return -EAGAIN\n" KRESET);
+        exit();
+    }
+    if (write(fds[1], "abc", 3) != 3 || read(fds[0], buf, sizeof(buf)) != 3) {
+        printf(KBRED "\nnonblocking pipe read lost data\n" KRESET);
+        exit();
+    }
+    close(fds[0]);
+    close(fds[1]);
+
+    printf(" [ " KBGRN "OK" KRESET " ]\n");
+}
+
+// poll times out on an empty pipe and wakes for a writer in another process
+void polltest(void)
+{
+    int fds[2];
+    char c;
+
+    printf("poll test");
+    if (pipe(fds) != 0) {
+        printf(KBRED "\npipe failed\n" KRESET);
+        exit();
+    }
+    struct pollfd pfd = {.fd = fds[0], .events = POLLIN};
+    if (poll(&pfd, 1, 0) != 0 || poll(&pfd, 1, 40) != 0 || pfd.revents != 0) {
+        printf(KBRED "\npoll reported an empty pipe ready\n" KRESET);
+        exit();
+    }
+
+    int pid = fork();
+    if (pid < 0) {
+        printf(KBRED "\nfork failed\n" KRESET);
+        exit();
+    }
+    if (pid == 0) {
+        sleep(2);
+        write(fds[1], "x", 1);
+        exit();
+    }
+    close(fds[1]);
+    if (poll(&pfd, 1, -1) != 1 || !(pfd.revents & POLLIN) || read(fds[0], &c, 1) != 1) {
+        printf(KBRED "\npoll missed the write\n" KRESET);
+        exit();
+    }
+    wait();
+    if (poll(&pfd, 1, -1) != 1 || !(pfd.revents & POLLHUP)) {
+        printf(KBRED "\npoll missed the closed write end\n" KRESET);
+        exit();
+    }
+    close(fds[0]);
+
+    printf(" [ " KBGRN "OK" KRESET " ]\n");
+}
+
+// resize a pipe and fill it in one write without blocking
+void pipesize(void)
+{
+    int fds[2];
+    const int size = 64 * 1024;
+
+    printf("pipe size test");
+    char *buf = malloc(size);
+    if (buf == nullptr || pipe(fds) != 0) {
+        printf(KBRED "\npipe failed\n" KRESET);
+        exit();
+    }
+    if (fcntl(fds[0], F_GETPIPE_SZ, 0) != 16 * 1024 || fcntl(fds[1], F_SETPIPE_SZ, size) != size ||
+        fcntl(fds[1], F_SETPIPE_SZ, size + 1) != -EINVARG) {
+        printf(KBRED "\npipe resize failed\n" KRESET);
+        exit();
+    }
+    for (int i = 0; i < size; i++) {
+        buf[i] = (char)(i % 251);
+    }
+    fcntl(fds[1], F_SETFL, O_NONBLOCK);
+    if (write(fds[1], buf, size) != size || write(fds[1], buf, 1) != -EAGAIN) {
+        printf(KBRED "\nfull pipe write failed\n" KRESET);
+        exit();
+    }
+    if (fcntl(fds[0], F_SETPIPE_SZ, 4096) != -EBUFFULL) {
+        printf(KBRED "\nshrank a pipe below its contents\n" KRESET);
+        exit();
+    }
+    memset(buf, 0, size);
+    int total = 0;
+    while (total < size) {
+        const int n = read(fds[0], buf + total, size - total);
+        if (n <= 0) {
+            printf(KBRED "\npipe read failed\n" KRESET);
+            exit();
+        }
+        total += n;
+    }
+    for (int i = 0; i < size; i++) {
+        if (buf[i] != (char)(i % 251)) {
+            printf(KBRED "\npipe data corrupted at %d\n" KRESET, i);
+            exit();
+        }
+    }
+    close(fds[0]);
+    close(fds[1]);
+    free(buf);
+
+    printf(" [ " KBGRN "OK" KRESET " ]\n");
+}
+
+// share memory through a named object, both across fork and by name
+void shmtest(void)
+{
+    const int size = 2 * 4096;
+
+    printf("shared memory test");
+    int fd = shm_open("usertests", O_CREATE | O_RDWR);
+    if (fd < 0 || ftruncate(fd, size) != 0) {
+        printf(KBRED "\nshm_open or ftruncate failed\n" KRESET);
+        exit();
+    }
+    char *p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED || p[0] != 0 || p[size - 1] != 0) {
+        printf(KBRED "\nmmap of shared memory failed\n" KRESET);
+        exit();
+    }
+    p[0] = 'a';
+
+    int pid = fork();
+    if (pid < 0) {
+        printf(KBRED "\nfork failed\n" KRESET);
+        exit();
+    }
+    if (pid == 0) {
+        // Through the inherited mapping and through a new one by name.
+        p[1]    = 'b';
+        int fd2 = shm_open("usertests", O_RDWR);
+        char *q = fd2 < 0 ? MAP_FAILED : mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd2, 0);
+        if (q == MAP_FAILED || q[0] != 'a') {
+            printf(KBRED "\nchild does not see the shared memory\n" KRESET);
+            exit();
+        }
+        q[size - 1] = 'c';
+        exit();
+    }
+    wait();
+    if (p[1] != 'b' || p[size - 1] != 'c') {
+        printf(KBRED "\nchild writes are not visible\n" KRESET);
+        exit();
+    }
+    if (munmap(p, size) != 0 || shm_unlink("usertests") != 0 || shm_open("usertests", O_RDWR) != -ENOENT) {
+        printf(KBRED "\nshared memory cleanup failed\n" KRESET);
+        exit();
+    }
+    close(fd);
+
+    printf(" [ " KBGRN "OK" KRESET " ]\n");
+}
+
+void futextest(void)
+{
+    const int nchild = 3;
+    const int rounds = 500;
+    struct shared
+    {
+        struct mutex m;
+        struct semaphore done;
+        int counter;
+    };
+
+    printf("futex test");
+    int word = 0;
+    if (futex(&word, FUTEX_WAIT, 1, -1) != -EAGAIN || futex(&word, FUTEX_WAIT, 0, 20) != -ETIMEDOUT ||
+        futex(&word, FUTEX_WAKE, 1, 0) != 0) {
+        printf(KBRED "\nfutex wait or wake returned the wrong value\n" KRESET);
+        exit();
+    }
+
+    int fd = shm_open("futextest", O_CREATE | O_RDWR);
+    if (fd < 0 || ftruncate(fd, 4096) != 0) {
+        printf(KBRED "\nshm_open or ftruncate failed\n" KRESET);
+        exit();
+    }
+    struct shared *sh = mmap(nullptr, 4096, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (sh == MAP_FAILED) {
+        printf(KBRED "\nmmap of shared memory failed\n" KRESET);
+        exit();
+    }
+    mutex_init(&sh->m);
+    sem_init(&sh->done, 0);
+
+    for (int c = 0; c < nchild; c++) {
+        int pid = fork();
+        if (pid < 0) {
+            printf(KBRED "\nfork failed\n" KRESET);
+            exit();
+        }
+        if (pid == 0) {
+            for (int i = 0; i < rounds; i++) {
+                mutex_lock(&sh->m);
+                const int v = sh->counter;
+                if (i % 50 == 0) {
+                    yield();
+                }
+                sh->counter = v + 1;
+                mutex_unlock(&sh->m);
+            }
+            sem_post(&sh->done);
+            exit();
+        }
+    }
+    for (int c = 0; c < nchild; c++) {
+        sem_wait(&sh->done);
+    }
+    if (sh->counter != nchild * rounds || sem_trywait(&sh->done)) {
+        printf(KBRED "\ncounter is %d, expected %d\n" KRESET, sh->counter, nchild * rounds);
+        exit();
+    }
+    for (int c = 0; c < nchild; c++) {
+        wait();
+    }
+    munmap(sh, 4096);
+    shm_unlink("futextest");
+    close(fd);
+
+    printf(" [ " KBGRN "OK" KRESET " ]\n");
+}
+
+// keep more inodes in use at once than the old fixed inode table had
+void manyinodes(void)
+{
+    char name[32];
+    const int nchild = 6;
+    const int per    = 10;
+    int ready[2], hold[2];
+
+    printf("many inodes test");
+    if (pipe(ready) != 0 || pipe(hold) != 0) {
+        printf(KBRED "\nmanyinodes pipe failed\n" KRESET);
+        exit();
+    }
+
+    for (int c = 0; c < nchild; c++) {
+        int pid = fork();
+        if (pid < 0) {
+            printf(KBRED "\nmanyinodes fork failed\n" KRESET);
+            exit();
+        }
+        if (pid == 0) {
+            close(ready[0]);
+            close(hold[1]);
+            for (int i = 0; i < per; i++) {
+                snprintf(name, sizeof(name), "mi.%d.%d", c, i);
+                if (open(name, O_CREATE | O_RDWR) < 0) {
+                    printf(KBRED "\nmanyinodes open %s failed\n" KRESET, name);
+                    exit();
+                }
+            }
+            write(ready[1], "x", 1);
+            char ch;
+            read(hold[0], &ch, 1); // returns once the parent closes hold[1]
+            exit();
+        }
+    }
+    close(ready[1]);
+    close(hold[0]);
+
+    int opened = 0;
+    char ch;
+    while (opened < nchild && read(ready[0], &ch, 1) == 1) {
+        opened++;
+    }
+    close(hold[1]);
+    for (int c = 0; c < nchild; c++) {
+        wait();
+    }
+    close(ready[0]);
+    if (opened != nchild) {
+        printf(KBRED "\nmanyinodes: only %d children opened their files\n" KRESET, opened);
+        exit();
+    }
+
+    for (int c = 0; c < nchild; c++) {
+        for (int i = 0; i < per; i++) {
+            snprintf(name, sizeof(name), "mi.%d.%d", c, i);
+            unlink(name);
+        }
+    }
+
+    printf(" [ " KBGRN "OK" KRESET " ]\n");
+}
+
 // test that fork fails gracefully
 // the forktest binary also does this, but it runs out of proc entries first.
 // inside the bigger usertests binary, we run out of memory first.
@@ -2563,8 +3392,23 @@ int main(int argc, char *argv[])
     mknodtest();
     dirfile();
     iref();
+    manyinodes();
+    getdentstest();
+    preadwritev();
+    largewrite();
+    directio();
+    sendfiletest();
+    tmpfstest();
+    sharedread();
+    fsynctest();
+    nonblockpipe();
+    polltest();
+    pipesize();
+    shmtest();
+    futextest();
     forktest();
     bigdir(); // slow
+    bigdirlookup();
 
     uio();
 
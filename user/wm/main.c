@@ -5,6 +5,7 @@
 #include <wm/bmp.h>
 #include <mman.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <types.h>
 #include <printf.h>
 #include <errno.h>
@@ -24,6 +25,7 @@ static u32 *fb;
 static desktop_t *desktop;
 static struct termios orig_termios;
 static int raw_mode        = 0;
+static int orig_stdin_flags;
 static bool wm_should_exit = false;
 static int mousefd;
 vterm_t *terminal        = {};
@@ -45,6 +47,7 @@ static void disable_raw_mode(int fd)
     /* Don't even check the return value as it's too late. */
     if (raw_mode) {
         tcsetattr(fd, TCSAFLUSH, &orig_termios);
+        fcntl(fd, F_SETFL, orig_stdin_flags);
         raw_mode = 0;
     }
 
@@ -87,7 +90,7 @@ static int enable_raw_mode(int fd)
     raw.c_lflag &= ~(ECHO | ICANON | IEXTEN | ISIG);
     /* control chars - set return condition: min number of bytes and timer. */
     raw.c_cc[VMIN]  = 0; /* Return each byte, or zero for timeout. */
-    raw.c_cc[VTIME] = 1; /* 100 ms timeout (unit is tens of second). */
+    raw.c_cc[VTIME] = 0; /* Reads don't wait; stdin is O_NONBLOCK below. */
 
     raw.c_iflag &= ~(IXON | ICRNL | BRKINT | INPCK | ISTRIP);
 
@@ -95,6 +98,8 @@ static int enable_raw_mode(int fd)
     if (tcsetattr(fd, TCSAFLUSH, &raw) < 0) {
         goto fatal;
     }
+    orig_stdin_flags = fcntl(fd, F_GETFL, 0);
+    fcntl(fd, F_SETFL, orig_stdin_flags | O_NONBLOCK);
     raw_mode = 1;
     return 0;
 
@@ -124,24 +129,26 @@ void doom_button_handler([[maybe_unused]] struct button *button, [[maybe_unused]
     }
 }
 
-void wm_process_events(void)
+// Neither the mouse nor stdin ever block. Returns whether there was
+// anything to handle.
+bool wm_process_events(void)
 {
     struct ps2_mouse_packet mp;
-    int n = read(mousefd, &mp, sizeof(mp));
-    if (n == sizeof(mp)) {
+    int n      = read(mousefd, &mp, sizeof(mp));
+    bool mouse = n == sizeof(mp);
+    if (mouse) {
         desktop_process_mouse(desktop, mp.x, mp.y, mp.flags);
     }
 
     char c;
     int nread = read(STDIN_FILENO, &c, 1);
-    if (nread == -1) {
+    if (nread == -EAGAIN || nread == 0) {
+        return mouse;
+    }
+    if (nread < 0) {
         printf("wm: read error\n");
         wm_should_exit = true;
-        return;
-    }
-
-    if (nread == 0) {
-        return;
+        return false;
     }
 
     // if (c == 'q') {
@@ -150,6 +157,7 @@ void wm_process_events(void)
     // }
 
     terminal->putchar(terminal, c);
+    return true;
 }
 
 int main([[maybe_unused]] const int argc, [[maybe_unused]] char **argv)
@@ -171,7 +179,7 @@ int main([[maybe_unused]] const int argc, [[maybe_unused]] char **argv)
     fb = map;
     close(fd);
 
-    mousefd = open("/dev/mouse", O_RDWR);
+    mousefd = open("/dev/mouse", O_RDWR | O_NONBLOCK);
     if (mousefd < 0) {
         printf("wm: cannot open /dev/mouse\n");
         exit();
@@ -203,8 +211,15 @@ int main([[maybe_unused]] const int argc, [[maybe_unused]] char **argv)
 
     window_paint((window_t *)desktop, nullptr, 1);
 
+    struct pollfd fds[] = {
+        {.fd = mousefd, .events = POLLIN},
+        {.fd = STDIN_FILENO, .events = POLLIN},
+    };
     while (!wm_should_exit) {
-        wm_process_events();
+        // Sleep until the mouse or the keyboard has something.
+        if (!wm_process_events()) {
+            poll(fds, sizeof(fds) / sizeof(fds[0]), -1);
+        }
     }
 
     return 0;